@@ -0,0 +1,201 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * BACnetVirtualDevicesBenchmarks.cpp
+ *
+ * Runs one of the benchmarks of the server parts that do not need the CAS
+ * BACnet Stack, see Benchmarks.h. The responder stands in for the server so
+ * that the receive path can be measured with the load generator. The other
+ * benchmarks run on their own and print their results.
+ *
+ * Build with "make benchmarks". Linux only.
+ *
+ * Created by: Steven Smethurst
+ */
+
+#if !defined(__GNUC__)
+#error "The benchmarks use the epoll receive path of CSimpleUDP and are only built on Linux"
+#endif
+
+#include "Benchmarks.h"
+
+// Shared with the server
+#include "CASBACnetStackExampleDispatcher.h"
+
+#include <iostream>
+#include <stdlib.h> // strtoul()
+
+// Constants
+// =======================================
+const std::string APPLICATION_VERSION = "0.0.6";  // See CHANGELOG.md for a full list of changes.
+
+// Helper functions
+bool LoadArguments(int argc, char* argv[], BenchmarkOptions & options);
+void PrintUsage();
+
+int main(int argc, char* argv[])
+{
+	std::cout << "BACnet Virtual Devices Benchmarks v" << APPLICATION_VERSION << std::endl;
+
+	BenchmarkOptions options;
+	if (!LoadArguments(argc, argv, options)) {
+		PrintUsage();
+		return -1;
+	}
+	std::string topologyError;
+	if (!options.topology.Validate(topologyError)) {
+		std::cerr << "Invalid virtual device topology: " << topologyError << std::endl;
+		return -1;
+	}
+
+	if (options.benchmark == "responder") {
+		return RunResponder(options);
+	}
+	else if (options.benchmark == "object-index") {
+		return RunObjectIndex(options);
+	}
+	else if (options.benchmark == "live-values") {
+		return RunLiveValues(options);
+	}
+	else if (options.benchmark == "startup") {
+		return RunStartup(options);
+	}
+	PrintUsage();
+	return -1;
+}
+
+BenchmarkOptions::BenchmarkOptions() {
+	this->port = 47808;
+	this->receiveMode = "event";
+	this->shards = 0;
+	this->shardQueueSize = DISPATCHER_QUEUE_SIZE;
+	this->shardWorkers = 0;
+	this->durationSeconds = 0;
+	this->covRate = 0;
+	this->writers = 4;
+	this->slots = 64;
+}
+
+bool BenchmarkOptions::SetOption(const std::string & name, const std::string & value) {
+	// Numeric options
+	struct NumericOption {
+		const char* name;
+		uint32_t* value;
+		unsigned long min;
+		unsigned long max;
+	};
+	uint32_t port = this->port;
+	const NumericOption numericOptions[] = {
+		{ "port", &port, 1, 65535 },
+		{ "shards", &this->shards, 0, DISPATCHER_MAX_SHARDS },
+		{ "shard-queue-size", &this->shardQueueSize, 1, 65536 },
+		{ "shard-workers", &this->shardWorkers, 0, 1 },
+		{ "duration", &this->durationSeconds, 0, 86400 },
+		{ "cov-rate", &this->covRate, 0, 1000000 },
+		{ "writers", &this->writers, 1, 255 },
+		{ "slots", &this->slots, 1, 10000000 }
+	};
+	for (size_t offset = 0; offset < sizeof(numericOptions) / sizeof(numericOptions[0]); offset++) {
+		if (name != numericOptions[offset].name) {
+			continue;
+		}
+		char* end = NULL;
+		unsigned long number = strtoul(value.c_str(), &end, 10);
+		if (value.empty() || end == NULL || *end != '\0' || number < numericOptions[offset].min || number > numericOptions[offset].max) {
+			return false;
+		}
+		if (numericOptions[offset].value == &this->shardQueueSize && (number & (number - 1)) != 0) {
+			return false; // Must be a power of two
+		}
+		*numericOptions[offset].value = (uint32_t)number;
+		this->port = (uint16_t)port;
+		return true;
+	}
+
+	if (name == "benchmark") {
+		if (value != "responder" && value != "object-index" && value != "live-values" && value != "startup") {
+			return false;
+		}
+		this->benchmark = value;
+		return true;
+	}
+	else if (name == "receive-mode") {
+		if (value != "event" && value != "poll") {
+			return false;
+		}
+		this->receiveMode = value;
+		return true;
+	}
+	return this->topology.SetOption(name, value);
+}
+
+// Reads the command line. Options are given as --name value or --name=value.
+bool LoadArguments(int argc, char* argv[], BenchmarkOptions & options)
+{
+	for (int offset = 1; offset < argc; offset++) {
+		std::string argument = argv[offset];
+		if (argument == "-h" || argument == "--help") {
+			return false;
+		}
+		if (argument.compare(0, 2, "--") != 0) {
+			std::cerr << "Unexpected argument [" << argument << "]" << std::endl;
+			return false;
+		}
+
+		std::string name = argument.substr(2);
+		std::string value;
+		size_t equals = name.find('=');
+		if (equals != std::string::npos) {
+			value = name.substr(equals + 1);
+			name = name.substr(0, equals);
+		}
+		else {
+			if (offset + 1 >= argc) {
+				std::cerr << "Missing value for option [" << name << "]" << std::endl;
+				return false;
+			}
+			value = argv[++offset];
+		}
+
+		if (!options.SetOption(name, value)) {
+			std::cerr << "Unknown option or invalid value. " << name << "=[" << value << "]" << std::endl;
+			return false;
+		}
+	}
+	if (options.benchmark.empty()) {
+		std::cerr << "No benchmark given, see --benchmark" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void PrintUsage()
+{
+	std::cout << std::endl;
+	std::cout << "Usage: BACnetVirtualDevicesBenchmarks --benchmark <name> [options]" << std::endl;
+	std::cout << "Options are given as --name value or --name=value" << std::endl;
+	std::cout << "  --benchmark <name>                 responder, object-index, live-values or startup" << std::endl;
+	std::cout << "                                       responder: answers the load generator like the server, without the CAS BACnet Stack" << std::endl;
+	std::cout << "                                       object-index: old vs new device and object lookups at 30, 10k and 100k devices" << std::endl;
+	std::cout << "                                       live-values: writer threads and one reader on the live Analog Input values, fails on a torn value" << std::endl;
+	std::cout << "                                       startup: time and resident memory to build 1k, 10k and 100k virtual devices" << std::endl;
+	std::cout << "Responder options:" << std::endl;
+	std::cout << "  --port <port>                      BACnet/IP port (default 47808)" << std::endl;
+	std::cout << "  --receive-mode <event|poll>        Receive path, the same as the server's option (default event)" << std::endl;
+	std::cout << "  --shards <count>                   Receive on a thread with this many shards, 0 is off (default 0)" << std::endl;
+	std::cout << "  --shard-queue-size <count>         Messages each shard can queue, a power of two (default " << DISPATCHER_QUEUE_SIZE << ")" << std::endl;
+	std::cout << "  --shard-workers <0|1>              1 answers each shard on its own thread, the server can not (default 0)" << std::endl;
+	std::cout << "  --duration <seconds>               Stop after this long, 0 runs until stopped (default 0)" << std::endl;
+	std::cout << "  --cov-rate <notifications/s>       COV notifications sent to the subscribed objects in turn, 0 is off (default 0)" << std::endl;
+	std::cout << "Live values options:" << std::endl;
+	std::cout << "  --writers <count>                  Writer threads (default 4)" << std::endl;
+	std::cout << "  --slots <count>                    Analog Inputs, up to 100 per device, fewer means more contention (default 64)" << std::endl;
+	std::cout << "  --duration <seconds>               How long to run, 0 is 5 s (default 0)" << std::endl;
+	std::cout << "The topology options of the server (--networks, --devices-per-network, ...) are also taken." << std::endl;
+	std::cout << std::endl;
+}
+
+uint64_t GetElapsedNs(const Clock::time_point start, const Clock::time_point end)
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
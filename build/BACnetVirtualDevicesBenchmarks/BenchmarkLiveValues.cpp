@@ -0,0 +1,255 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * BenchmarkLiveValues.cpp
+ *
+ * Stress test of the live Analog Input values of the ExampleDatabase. Writer
+ * threads call UpdateAnalogInput() for random Analog Inputs the way the field
+ * drivers do, while one reader sweeps them with GetAnalogInputValue() like the
+ * BACnet thread and collects the changed values. Every value written carries
+ * its timestamp and a check derived from it, so the reader can tell a torn
+ * value from a whole one. Fails if a torn value is read, a timestamp goes
+ * backwards, a newer update is lost or a written value is never reported as
+ * changed. Every LIVE_VALUES_SAMPLE_INTERVAL reads one read is timed on its
+ * own for the latency percentiles.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#include "Benchmarks.h"
+
+// Shared with the server
+#include "CASBACnetStackExampleDatabase.h"
+
+#include <algorithm> // std::sort()
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+static const uint32_t LIVE_VALUES_DEFAULT_SECONDS = 5; // When --duration is 0
+static const uint32_t LIVE_VALUES_WRITER_ID_BITS = 8; // The low bits of a timestamp are the writer
+static const uint32_t LIVE_VALUES_ANALOG_INPUTS_PER_DEVICE = 100; // --slots is spread over devices with this many
+static const uint32_t LIVE_VALUES_DEVICES_PER_NETWORK = 1000;
+static const uint32_t LIVE_VALUES_SAMPLE_INTERVAL = 64; // One read in this many is timed
+static const size_t LIVE_VALUES_MAX_SAMPLES = 4000000; // Long runs stop sampling after this many
+
+// A timestamp has 40 bits. The reliability carries the low 32 bits, the present value
+// the high 8 bits and a 16 bit check of the whole timestamp, which stays exact in a
+// float. Written values always have a reliability that is not zero, the writer id.
+static float GetLiveValue(const uint64_t timestamp)
+{
+	uint32_t check = (uint32_t)((timestamp * 2654435761ULL) >> 16) & 0xFFFF;
+	return (float)((((timestamp >> 32) & 0xFF) << 16) | check);
+}
+
+static uint32_t GetLiveReliability(const uint64_t timestamp)
+{
+	return (uint32_t)timestamp;
+}
+
+// Returns the timestamp of a value that was read, 0 if it was never written or was torn
+static uint64_t GetLiveTimestamp(const float presentValue, const uint32_t reliability, bool & torn)
+{
+	torn = false;
+	if (reliability == 0) {
+		return 0; // The default value from Setup()
+	}
+	uint64_t timestamp = (((uint64_t)presentValue >> 16) << 32) | reliability;
+	if (GetLiveValue(timestamp) != presentValue) {
+		torn = true;
+		return 0;
+	}
+	return timestamp;
+}
+
+// One Analog Input, in the same order as the slots of the database
+struct LiveValuesObject {
+	uint32_t deviceInstance;
+	uint32_t objectInstance;
+};
+
+class LiveValuesWriter
+{
+public:
+	uint64_t writes;
+	uint64_t applied;
+	std::vector<uint64_t> lastApplied; // Newest timestamp applied to each Analog Input
+
+	LiveValuesWriter() : writes(0), applied(0) {}
+};
+
+static void RunLiveValuesWriter(ExampleDatabase & database, const std::vector<LiveValuesObject> & objects, const uint32_t writerId, const std::atomic<bool> & stop, LiveValuesWriter & writer)
+{
+	writer.lastApplied.assign(objects.size(), 0);
+	uint32_t random = 2463534242u + writerId * 7919u;
+	uint64_t counter = 0;
+	while (!stop.load(std::memory_order_relaxed)) {
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		size_t slot = random % objects.size();
+
+		// Timestamps go up for each writer but are not in order between writers,
+		// so some updates are older than the stored value and are discarded.
+		counter++;
+		uint64_t timestamp = (counter << LIVE_VALUES_WRITER_ID_BITS) | writerId;
+		writer.writes++;
+		if (database.UpdateAnalogInput(objects[slot].deviceInstance, objects[slot].objectInstance, GetLiveValue(timestamp), GetLiveReliability(timestamp), timestamp)) {
+			writer.applied++;
+			writer.lastApplied[slot] = timestamp;
+		}
+	}
+}
+
+int RunLiveValues(const BenchmarkOptions & options)
+{
+	if (options.writers >= (1u << LIVE_VALUES_WRITER_ID_BITS)) {
+		std::cerr << "Error - at most " << ((1u << LIVE_VALUES_WRITER_ID_BITS) - 1) << " writers" << std::endl;
+		return -1;
+	}
+	uint32_t seconds = options.durationSeconds > 0 ? options.durationSeconds : LIVE_VALUES_DEFAULT_SECONDS;
+
+	// Enough devices for --slots Analog Inputs, packed like the object index benchmark
+	ExampleDatabase database;
+	uint32_t analogInputsPerDevice = options.slots < LIVE_VALUES_ANALOG_INPUTS_PER_DEVICE ? options.slots : LIVE_VALUES_ANALOG_INPUTS_PER_DEVICE;
+	uint32_t devices = (options.slots + analogInputsPerDevice - 1) / analogInputsPerDevice;
+	database.topology.numberOfNetworks = (devices + LIVE_VALUES_DEVICES_PER_NETWORK - 1) / LIVE_VALUES_DEVICES_PER_NETWORK;
+	database.topology.devicesPerNetwork = devices < LIVE_VALUES_DEVICES_PER_NETWORK ? devices : LIVE_VALUES_DEVICES_PER_NETWORK;
+	database.topology.networkOffset = 1;
+	database.topology.deviceInstanceOffset = LIVE_VALUES_DEVICES_PER_NETWORK;
+	database.topology.analogInputsPerDevice = analogInputsPerDevice;
+	database.topology.analogValuesPerDevice = 0;
+	std::string topologyError;
+	if (!database.topology.Validate(topologyError)) {
+		std::cerr << "Error - invalid topology for the live values: " << topologyError << std::endl;
+		return -1;
+	}
+	database.Setup();
+
+	std::vector<LiveValuesObject> objects(database.analogInputs.size());
+	for (size_t slot = 0; slot < objects.size(); slot++) {
+		objects[slot].deviceInstance = database.analogInputs[slot].deviceInstance;
+		objects[slot].objectInstance = database.analogInputs[slot].instance;
+	}
+	std::cout << "FYI: Live value stress test, writers=[" << options.writers << "], analogInputs=[" << objects.size() << "], devices=[" << database.virtualDevices.size() << "], seconds=[" << seconds << "]" << std::endl;
+
+	std::atomic<bool> stop(false);
+	std::vector<LiveValuesWriter> writers(options.writers);
+	std::vector<std::thread> threads;
+	Clock::time_point start = Clock::now();
+	for (uint32_t writerId = 0; writerId < options.writers; writerId++) {
+		threads.push_back(std::thread(RunLiveValuesWriter, std::ref(database), std::cref(objects), writerId + 1, std::cref(stop), std::ref(writers[writerId])));
+	}
+
+	// The reader, on this thread
+	std::vector<uint64_t> lastTimestamp(objects.size(), 0);
+	std::vector<bool> reported(objects.size(), false);
+	std::vector<uint32_t> changed;
+	std::vector<uint32_t> readNs; // Sampled single reads
+	uint64_t reads = 0;
+	uint64_t torn = 0;
+	uint64_t backwards = 0;
+	uint64_t missing = 0;
+	uint64_t collected = 0;
+	Clock::time_point end = start + std::chrono::seconds(seconds);
+	while (Clock::now() < end) {
+		for (size_t slot = 0; slot < objects.size(); slot++) {
+			float presentValue;
+			uint32_t reliability;
+			bool found;
+			if (reads % LIVE_VALUES_SAMPLE_INTERVAL == 0 && readNs.size() < LIVE_VALUES_MAX_SAMPLES) {
+				Clock::time_point readStart = Clock::now();
+				found = database.GetAnalogInputValue(objects[slot].deviceInstance, objects[slot].objectInstance, &presentValue, &reliability);
+				readNs.push_back((uint32_t)GetElapsedNs(readStart, Clock::now()));
+			}
+			else {
+				found = database.GetAnalogInputValue(objects[slot].deviceInstance, objects[slot].objectInstance, &presentValue, &reliability);
+			}
+			reads++;
+			if (!found) {
+				missing++;
+				continue;
+			}
+
+			bool isTorn;
+			uint64_t timestamp = GetLiveTimestamp(presentValue, reliability, isTorn);
+			if (isTorn) {
+				torn++;
+				continue;
+			}
+			if (timestamp < lastTimestamp[slot]) {
+				backwards++;
+			}
+			lastTimestamp[slot] = timestamp;
+		}
+
+		changed.clear();
+		collected += database.analogInputValues.CollectChanged(changed);
+		for (size_t offset = 0; offset < changed.size(); offset++) {
+			reported[changed[offset]] = true;
+		}
+	}
+	stop.store(true);
+	for (size_t offset = 0; offset < threads.size(); offset++) {
+		threads[offset].join();
+	}
+	double elapsedSeconds = (double)GetElapsedNs(start, Clock::now()) / 1e9;
+	changed.clear();
+	collected += database.analogInputValues.CollectChanged(changed);
+	for (size_t offset = 0; offset < changed.size(); offset++) {
+		reported[changed[offset]] = true;
+	}
+
+	// The stored value must be the newest one that was applied, and every written
+	// Analog Input must have been reported as changed
+	uint64_t writes = 0;
+	uint64_t applied = 0;
+	uint64_t lost = 0;
+	uint64_t unreported = 0;
+	for (size_t offset = 0; offset < writers.size(); offset++) {
+		writes += writers[offset].writes;
+		applied += writers[offset].applied;
+	}
+	for (size_t slot = 0; slot < objects.size(); slot++) {
+		uint64_t newest = 0;
+		for (size_t offset = 0; offset < writers.size(); offset++) {
+			if (writers[offset].lastApplied[slot] > newest) {
+				newest = writers[offset].lastApplied[slot];
+			}
+		}
+		float presentValue = 0.0f;
+		uint32_t reliability = 0;
+		bool isTorn;
+		database.GetAnalogInputValue(objects[slot].deviceInstance, objects[slot].objectInstance, &presentValue, &reliability);
+		if (GetLiveTimestamp(presentValue, reliability, isTorn) != newest) {
+			lost++;
+		}
+		if (newest != 0 && !reported[slot]) {
+			unreported++;
+		}
+	}
+
+	// Read latency. The clock is read twice for each sample, its cost is shown on its own.
+	std::sort(readNs.begin(), readNs.end());
+	uint64_t clockNs = 0;
+	const uint32_t CLOCK_SAMPLES = 1000;
+	for (uint32_t count = 0; count < CLOCK_SAMPLES; count++) {
+		Clock::time_point clockStart = Clock::now();
+		clockNs += GetElapsedNs(clockStart, Clock::now());
+	}
+	uint32_t p50Ns = readNs.empty() ? 0 : readNs[readNs.size() / 2];
+	uint32_t p99Ns = readNs.empty() ? 0 : readNs[(readNs.size() * 99) / 100];
+	uint32_t maxNs = readNs.empty() ? 0 : readNs.back();
+
+	std::cout << "FYI: writes=[" << writes << "] (" << (uint64_t)(writes / elapsedSeconds) << "/s), applied=[" << applied << "], stale=[" << (writes - applied) << "]" << std::endl;
+	std::cout << "FYI: reads=[" << reads << "] (" << (uint64_t)(reads / elapsedSeconds) << "/s), changed collected=[" << collected << "]" << std::endl;
+	std::cout << "FYI: read latency p50=[" << p50Ns << " ns], p99=[" << p99Ns << " ns], max=[" << maxNs << " ns], samples=[" << readNs.size() << "], clock=[" << clockNs / CLOCK_SAMPLES << " ns]" << std::endl;
+	std::cout << "FYI: torn=[" << torn << "], backwards=[" << backwards << "], lost=[" << lost << "], unreported=[" << unreported << "], missing=[" << missing << "]" << std::endl;
+	if (torn > 0 || backwards > 0 || lost > 0 || unreported > 0 || missing > 0) {
+		std::cerr << "Error - the live values failed the stress test" << std::endl;
+		return -1;
+	}
+	std::cout << "FYI: Passed" << std::endl;
+	return 0;
+}
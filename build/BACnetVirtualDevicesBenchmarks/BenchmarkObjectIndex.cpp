@@ -0,0 +1,118 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * BenchmarkObjectIndex.cpp
+ *
+ * Compares the object lookups of the ExampleDatabase with the lookups the
+ * server used before the ExampleDatabaseObjectIndex was added: a walk over a
+ * map of device vectors for a device, and a std::map keyed by the device
+ * instance for its Analog Input. Both are timed at 30, 10k and 100k devices
+ * with the same random order of lookups.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#include "Benchmarks.h"
+#include "BenchmarkOldDatabase.h"
+
+// Shared with the server
+#include "CASBACnetStackExampleConstants.h"
+#include "CASBACnetStackExampleDatabase.h"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+static const uint64_t OBJECT_INDEX_MIN_RUN_NS = 200000000; // Each lookup is repeated for at least this long
+static const size_t OBJECT_INDEX_LOOKUP_KEYS = 4096;
+static const size_t OBJECT_INDEX_LOOKUP_BATCH = 256; // The clock is read once per batch
+
+// Topologies that are measured. Networks and device instances are packed so
+// the 100k topology stays inside the valid network and instance ranges.
+struct ObjectIndexSize {
+	uint32_t numberOfNetworks;
+	uint32_t devicesPerNetwork;
+};
+static const ObjectIndexSize OBJECT_INDEX_SIZES[] = {
+	{ 3, 10 },		// The default topology
+	{ 10, 1000 },
+	{ 100, 1000 }
+};
+
+// Calls lookup(deviceInstance) for the keys in turn until OBJECT_INDEX_MIN_RUN_NS
+// has passed. Returns the average time of one lookup in ns, missed counts the
+// lookups that did not find the object.
+template <typename Lookup>
+static double TimeLookups(const std::vector<uint32_t> & keys, Lookup lookup, uint64_t & missed)
+{
+	uint64_t lookups = 0;
+	uint64_t elapsedNs = 0;
+	size_t offset = 0;
+	Clock::time_point start = Clock::now();
+	while (elapsedNs < OBJECT_INDEX_MIN_RUN_NS) {
+		for (size_t count = 0; count < OBJECT_INDEX_LOOKUP_BATCH; count++) {
+			if (!lookup(keys[offset])) {
+				missed++;
+			}
+			offset = (offset + 1) % keys.size();
+		}
+		lookups += OBJECT_INDEX_LOOKUP_BATCH;
+		elapsedNs = GetElapsedNs(start, Clock::now());
+	}
+	return (double)elapsedNs / (double)lookups;
+}
+
+int RunObjectIndex(const BenchmarkOptions &)
+{
+	std::cout << "FYI: Device and Analog Input lookups, old map walk vs object index, ns per lookup" << std::endl;
+	std::cout << std::setw(10) << "devices"
+		<< std::setw(14) << "device old" << std::setw(14) << "device new"
+		<< std::setw(14) << "ai old" << std::setw(14) << "ai new" << std::endl;
+
+	for (size_t sizeOffset = 0; sizeOffset < sizeof(OBJECT_INDEX_SIZES) / sizeof(OBJECT_INDEX_SIZES[0]); sizeOffset++) {
+		ExampleDatabaseTopology topology;
+		topology.numberOfNetworks = OBJECT_INDEX_SIZES[sizeOffset].numberOfNetworks;
+		topology.devicesPerNetwork = OBJECT_INDEX_SIZES[sizeOffset].devicesPerNetwork;
+		topology.networkOffset = 1;
+		topology.deviceInstanceOffset = topology.devicesPerNetwork;
+		topology.analogInputsPerDevice = 1;
+		topology.analogValuesPerDevice = 0;
+		std::string topologyError;
+		if (!topology.Validate(topologyError)) {
+			std::cerr << "Error - invalid topology for the lookups: " << topologyError << std::endl;
+			return -1;
+		}
+
+		BenchmarkOldDatabase oldDatabase;
+		oldDatabase.Setup(topology);
+		ExampleDatabase database;
+		database.topology = topology;
+		database.Setup();
+
+		// Random devices, the same order for both lookups
+		std::vector<uint32_t> keys(OBJECT_INDEX_LOOKUP_KEYS);
+		uint32_t random = 2463534242u;
+		for (size_t offset = 0; offset < keys.size(); offset++) {
+			random ^= random << 13;
+			random ^= random >> 17;
+			random ^= random << 5;
+			uint32_t device = random % topology.GetNumberOfDevices();
+			keys[offset] = topology.GetDeviceInstance(device / topology.devicesPerNetwork, device % topology.devicesPerNetwork);
+		}
+
+		uint64_t missed = 0;
+		double deviceOldNs = TimeLookups(keys, [&](uint32_t deviceInstance) { return oldDatabase.GetVirtualDevice(deviceInstance) != NULL; }, missed);
+		double deviceNewNs = TimeLookups(keys, [&](uint32_t deviceInstance) { return database.GetVirtualDevice(deviceInstance) != NULL; }, missed);
+		double analogInputOldNs = TimeLookups(keys, [&](uint32_t deviceInstance) { return oldDatabase.GetAnalogInput(deviceInstance, 1) != NULL; }, missed);
+		double analogInputNewNs = TimeLookups(keys, [&](uint32_t deviceInstance) { return database.GetAnalogInput(deviceInstance, 1) != NULL; }, missed);
+		if (missed > 0) {
+			std::cerr << "Error - " << missed << " lookups did not find the object" << std::endl;
+			return -1;
+		}
+
+		std::cout << std::fixed << std::setprecision(1) << std::setw(10) << topology.GetNumberOfDevices()
+			<< std::setw(14) << deviceOldNs << std::setw(14) << deviceNewNs
+			<< std::setw(14) << analogInputOldNs << std::setw(14) << analogInputNewNs << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * BenchmarkOldDatabase.cpp
+ *
+ * See BenchmarkOldDatabase.h
+ *
+ * Created by: Steven Smethurst
+*/
+
+#include "BenchmarkOldDatabase.h"
+
+#include <string>
+
+void BenchmarkOldDatabase::Setup(const ExampleDatabaseTopology & topology) {
+	for (uint32_t networkIndex = 0; networkIndex < topology.numberOfNetworks; networkIndex++) {
+		uint16_t network = (uint16_t)topology.GetNetwork(networkIndex);
+		for (uint32_t deviceIndex = 0; deviceIndex < topology.devicesPerNetwork; deviceIndex++) {
+			ExampleDatabaseDevice device;
+			device.instance = topology.GetDeviceInstance(networkIndex, deviceIndex);
+			device.objectName = "Virtual Device " + std::to_string(device.instance);
+			device.description = device.objectName;
+			device.systemStatus = 0;
+
+			AnalogInput analogInput;
+			analogInput.instance = 1;
+			analogInput.objectName = "Analog Input 1 of " + std::to_string(device.instance);
+			analogInput.presentValue = (float)deviceIndex;
+			analogInput.reliability = 0;
+
+			this->analogInputs[device.instance] = analogInput;
+			this->virtualDevices[network].push_back(device);
+		}
+	}
+}
+
+ExampleDatabaseDevice* BenchmarkOldDatabase::GetVirtualDevice(const uint32_t deviceInstance) {
+	std::map<uint16_t, std::vector<ExampleDatabaseDevice> >::iterator it;
+	for (it = this->virtualDevices.begin(); it != this->virtualDevices.end(); ++it) {
+		std::vector<ExampleDatabaseDevice>::iterator devIt;
+		for (devIt = it->second.begin(); devIt != it->second.end(); ++devIt) {
+			if (deviceInstance == devIt->instance) {
+				return &(*devIt);
+			}
+		}
+	}
+	return NULL;
+}
+
+BenchmarkOldDatabase::AnalogInput* BenchmarkOldDatabase::GetAnalogInput(const uint32_t deviceInstance, const uint32_t objectInstance) {
+	if (this->analogInputs.count(deviceInstance) > 0 && this->analogInputs[deviceInstance].instance == objectInstance) {
+		return &this->analogInputs[deviceInstance];
+	}
+	return NULL;
+}
@@ -0,0 +1,44 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * BenchmarkOldDatabase.h
+ *
+ * The virtual devices the way the server stored them before the topology
+ * and the object index were added: a vector of devices per network and a
+ * map of Analog Inputs by device, each object with its name in a string.
+ * The benchmarks compare the ExampleDatabase against it.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#ifndef __BenchmarkOldDatabase_h__
+#define __BenchmarkOldDatabase_h__
+
+// Shared with the server
+#include "CASBACnetStackExampleDatabase.h"
+
+#include <map>
+#include <vector>
+
+class BenchmarkOldDatabase
+{
+public:
+	class AnalogInput : public ExampleDatabaseBaseObject
+	{
+	public:
+		float presentValue;
+		uint32_t reliability;
+	};
+
+	std::map<uint16_t, std::vector<ExampleDatabaseDevice> > virtualDevices;
+	std::map<uint32_t, AnalogInput> analogInputs;
+
+	// Builds one device and one Analog Input at a time, like the old Setup()
+	void Setup(const ExampleDatabaseTopology & topology);
+
+	// The lookups of the old GetObjectName() and GetDeviceDescription()
+	ExampleDatabaseDevice* GetVirtualDevice(const uint32_t deviceInstance);
+	AnalogInput* GetAnalogInput(const uint32_t deviceInstance, const uint32_t objectInstance);
+};
+
+#endif // __BenchmarkOldDatabase_h__
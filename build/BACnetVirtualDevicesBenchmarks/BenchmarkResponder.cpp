@@ -0,0 +1,569 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * BenchmarkResponder.cpp
+ *
+ * Stands in for the server when the CAS BACnet Stack is not available. The
+ * messages are received exactly like the server does, then answered with a
+ * fixed reply instead of being passed to the stack: I-Am for a Who-Is, a
+ * SimpleAck for a SubscribeCOV and a ComplexAck for other confirmed requests.
+ * This measures the receive and send path on its own, the time the stack
+ * spends on a request is not included. With --cov-rate the subscribed objects
+ * are sent COV notifications in turn at that rate, like values that change.
+ *
+ * With --shards the dispatcher is used like the server does, and the shards are
+ * read in turn on one thread. --shard-workers 1 gives each shard its own
+ * worker thread instead, which the server can not do because the CAS BACnet
+ * Stack is not thread safe. It shows how far the dispatch itself scales.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#include "Benchmarks.h"
+
+// Shared with the server
+#include "CASBACnetStackExampleDispatcher.h"
+#include "SimpleUDP.h"
+
+#include <arpa/inet.h> // inet_pton(), ntohs()
+#include <signal.h>
+#include <sys/resource.h> // getrusage()
+#include <string.h> // memcpy()
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <thread>
+#include <vector>
+
+// BACnet encoding
+static const uint8_t BVLL_TYPE_BACNET_IP = 0x81;
+static const uint8_t BVLL_FUNCTION_FORWARDED_NPDU = 0x04;
+static const uint8_t BVLL_FUNCTION_ORIGINAL_UNICAST_NPDU = 0x0A;
+static const uint8_t NPDU_VERSION = 0x01;
+static const uint8_t NPDU_CONTROL_NETWORK_MESSAGE = 0x80;
+static const uint8_t NPDU_CONTROL_DESTINATION = 0x20;
+static const uint8_t NPDU_CONTROL_SOURCE = 0x08;
+static const uint8_t APDU_TYPE_CONFIRMED_REQUEST = 0x00;
+static const uint8_t APDU_TYPE_UNCONFIRMED_REQUEST = 0x10;
+static const uint8_t APDU_TYPE_SIMPLE_ACK = 0x20;
+static const uint8_t APDU_TYPE_COMPLEX_ACK = 0x30;
+static const uint8_t SERVICE_CONFIRMED_SUBSCRIBE_COV = 5;
+static const uint8_t SERVICE_UNCONFIRMED_COV_NOTIFICATION = 2;
+static const uint8_t SERVICE_UNCONFIRMED_I_AM = 0;
+static const uint8_t SERVICE_UNCONFIRMED_WHO_IS = 8;
+static const uint16_t GLOBAL_BROADCAST_NETWORK = 0xFFFF;
+static const uint16_t OBJECT_TYPE_DEVICE = 8;
+static const uint32_t PROPERTY_IDENTIFIER_PRESENT_VALUE = 85;
+static const uint32_t PROPERTY_IDENTIFIER_STATUS_FLAGS = 111;
+static const uint32_t OBJECT_INSTANCE_MASK = 0x3FFFFF;
+
+static const unsigned short UDP_RECEIVE_RING_SIZE = 256; // Same as the server
+static const unsigned short UDP_SEND_QUEUE_SIZE = 64;
+static const int MAIN_LOOP_IDLE_WAIT_MS = 10;
+static const unsigned int SHARD_WORKER_SEND_BATCH = 64; // Replies a shard worker holds before it sends them
+static const uint8_t VIRTUAL_DEVICE_MAC_LENGTH = 3; // The device instance
+
+static const uint32_t COV_TIME_REMAINING_SECONDS = 60; // Sent in every notification, the lifetime is not tracked
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void HandleStopSignal(int)
+{
+	g_stop = 1;
+}
+
+// CPU time of this process so far, all threads, in microseconds
+static void GetProcessCpuTimeUs(uint64_t* userUs, uint64_t* systemUs)
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		*userUs = 0;
+		*systemUs = 0;
+		return;
+	}
+	*userUs = (uint64_t)usage.ru_utime.tv_sec * 1000000 + (uint64_t)usage.ru_utime.tv_usec;
+	*systemUs = (uint64_t)usage.ru_stime.tv_sec * 1000000 + (uint64_t)usage.ru_stime.tv_usec;
+}
+
+// Reply being built, with the BVLL and NPDU in front
+class ResponderMessage
+{
+public:
+	uint8_t data[CSimpleUDPPacket::MAX_LENGTH];
+	uint16_t length;
+
+	// Starts a message from a virtual device, routed from its network
+	void Start(const uint16_t sourceNetwork, const uint8_t* sourceAddress, const uint8_t sourceAddressLength) {
+		this->length = 0;
+		this->data[this->length++] = BVLL_TYPE_BACNET_IP;
+		this->data[this->length++] = BVLL_FUNCTION_ORIGINAL_UNICAST_NPDU;
+		this->length += 2; // Set by Finish()
+		this->data[this->length++] = NPDU_VERSION;
+		this->data[this->length++] = NPDU_CONTROL_SOURCE;
+		this->data[this->length++] = (uint8_t)(sourceNetwork >> 8);
+		this->data[this->length++] = (uint8_t)sourceNetwork;
+		this->data[this->length++] = sourceAddressLength;
+		for (uint8_t index = 0; index < sourceAddressLength; index++) {
+			this->data[this->length++] = sourceAddress[index];
+		}
+	}
+	void Append(const uint8_t* bytes, const uint16_t count) {
+		for (uint16_t index = 0; index < count && this->length < sizeof(this->data); index++) {
+			this->data[this->length++] = bytes[index];
+		}
+	}
+	void Finish() {
+		this->data[2] = (uint8_t)(this->length >> 8);
+		this->data[3] = (uint8_t)this->length;
+	}
+};
+
+// Where the replies go. The main loop uses the send queue of the CSimpleUDP. That queue
+// is only for one thread, so each shard worker collects its replies in its own batch
+// and sends them with SendMessages().
+class ResponderOutput
+{
+public:
+	CSimpleUDP & udp;
+	bool ownBatch;
+	std::vector<CSimpleUDPPacket> batch;
+	size_t count;
+	uint64_t dropped; // The own batch was full
+
+	ResponderOutput(CSimpleUDP & udp, const bool ownBatch) : udp(udp), ownBatch(ownBatch), count(0), dropped(0) {
+		if (ownBatch) {
+			this->batch.resize(SHARD_WORKER_SEND_BATCH);
+		}
+	}
+
+	bool Queue(const uint8_t* ipAddress, const uint16_t port, const uint8_t* data, const uint16_t length) {
+		if (!this->ownBatch) {
+			return this->udp.QueueMessage(ipAddress, port, data, length);
+		}
+		if (this->count >= this->batch.size()) {
+			this->Flush();
+		}
+		if (this->count >= this->batch.size()) {
+			this->dropped++;
+			return false;
+		}
+		CSimpleUDPPacket & packet = this->batch[this->count++];
+		memset(&packet.address, 0, sizeof(packet.address));
+		packet.address.sin_family = AF_INET;
+		packet.address.sin_port = htons(port);
+		memcpy(&packet.address.sin_addr, ipAddress, 4);
+		memcpy(packet.data, data, length);
+		packet.length = length;
+		return true;
+	}
+
+	void Flush() {
+		if (!this->ownBatch) {
+			this->udp.FlushMessages();
+			return;
+		}
+		size_t sent = (size_t)this->udp.SendMessages(this->batch.data(), (unsigned int)this->count);
+		for (size_t offset = sent; offset < this->count; offset++) {
+			this->batch[offset - sent] = this->batch[offset];
+		}
+		this->count -= sent;
+	}
+
+	size_t GetPending() {
+		return this->ownBatch ? this->count : this->udp.GetSendQueueCount();
+	}
+};
+
+// One subscribed object. The newest subscriber of an object replaces the older one.
+struct ResponderSubscription
+{
+	uint8_t ipAddress[4];
+	uint16_t port;
+	uint16_t network;
+	uint32_t deviceInstance;
+	uint32_t objectIdentifier;
+	uint32_t subscriberProcessIdentifier;
+};
+
+class ResponderSubscriptions
+{
+public:
+	std::vector<ResponderSubscription> subscriptions; // Notified in turn
+	std::map<uint64_t, size_t> index; // Device instance and object identifier to offset in subscriptions
+	size_t next;
+	uint64_t notifications;
+
+	ResponderSubscriptions() : next(0), notifications(0) {}
+
+	void Add(const ResponderSubscription & subscription) {
+		uint64_t key = ((uint64_t)subscription.deviceInstance << 32) | subscription.objectIdentifier;
+		std::map<uint64_t, size_t>::iterator it = this->index.find(key);
+		if (it != this->index.end()) {
+			this->subscriptions[it->second] = subscription;
+			return;
+		}
+		this->index[key] = this->subscriptions.size();
+		this->subscriptions.push_back(subscription);
+	}
+};
+
+// Decodes an unsigned integer with the given context tag number. Advances offset past it.
+static bool DecodeContextUnsigned(const uint8_t* message, const uint16_t length, uint16_t* offset, const uint8_t tagNumber, uint32_t* value)
+{
+	if (*offset >= length) {
+		return false;
+	}
+	uint8_t tag = message[*offset];
+	uint8_t valueLength = tag & 0x07;
+	if ((tag >> 4) != tagNumber || (tag & 0x08) == 0 || valueLength == 0 || valueLength > 4 || *offset + 1 + valueLength > length) {
+		return false;
+	}
+	*value = 0;
+	for (uint8_t index = 0; index < valueLength; index++) {
+		*value = (*value << 8) | message[*offset + 1 + index];
+	}
+	*offset += 1 + valueLength;
+	return true;
+}
+
+// Decodes an object identifier with the given context tag number. Advances offset past it.
+static bool DecodeContextObjectIdentifier(const uint8_t* message, const uint16_t length, uint16_t* offset, const uint8_t tagNumber, uint32_t* objectIdentifier)
+{
+	if (*offset + 5 > length || message[*offset] != (uint8_t)((tagNumber << 4) | 0x08 | 4)) {
+		return false;
+	}
+	*objectIdentifier = ((uint32_t)message[*offset + 1] << 24) | ((uint32_t)message[*offset + 2] << 16) | ((uint32_t)message[*offset + 3] << 8) | message[*offset + 4];
+	*offset += 5;
+	return true;
+}
+
+// Answers one message. Returns the number of replies queued.
+static uint32_t Answer(ResponderOutput & output, const ExampleDatabaseTopology & topology, ResponderSubscriptions & subscriptions, const uint8_t* message, const uint16_t length, const uint8_t* ipAddress, const uint16_t port)
+{
+	// BVLL
+	if (length < 4 || message[0] != BVLL_TYPE_BACNET_IP) {
+		return 0;
+	}
+	uint16_t offset = message[1] == BVLL_FUNCTION_FORWARDED_NPDU ? 10 : 4;
+
+	// NPDU. Only messages for the virtual networks are answered.
+	if (offset + 2 > length || message[offset] != NPDU_VERSION) {
+		return 0;
+	}
+	uint8_t control = message[offset + 1];
+	offset += 2;
+	if ((control & NPDU_CONTROL_NETWORK_MESSAGE) != 0 || (control & NPDU_CONTROL_DESTINATION) == 0 || offset + 3 > length) {
+		return 0;
+	}
+	uint16_t network = (uint16_t)((message[offset] << 8) | message[offset + 1]);
+	uint8_t addressLength = message[offset + 2];
+	const uint8_t* address = message + offset + 3;
+	offset += 3 + addressLength;
+	if ((control & NPDU_CONTROL_SOURCE) != 0) {
+		if (offset + 3 > length) {
+			return 0;
+		}
+		offset += 3 + message[offset + 2];
+	}
+	offset += 1; // Hop count
+	if (offset + 2 > length) {
+		return 0;
+	}
+
+	ResponderMessage reply;
+	uint8_t pduType = message[offset] & 0xF0;
+	if (pduType == APDU_TYPE_UNCONFIRMED_REQUEST && message[offset + 1] == SERVICE_UNCONFIRMED_WHO_IS) {
+		uint16_t limitsOffset = offset + 2;
+		uint32_t lowLimit = 0;
+		uint32_t highLimit = 0xFFFFFFFF;
+		if (limitsOffset < length && (!DecodeContextUnsigned(message, length, &limitsOffset, 0, &lowLimit) || !DecodeContextUnsigned(message, length, &limitsOffset, 1, &highLimit))) {
+			return 0;
+		}
+
+		// I-Am from every matching device, straight away
+		uint32_t replies = 0;
+		for (uint32_t networkIndex = 0; networkIndex < topology.numberOfNetworks; networkIndex++) {
+			uint16_t deviceNetwork = (uint16_t)topology.GetNetwork(networkIndex);
+			if (network != GLOBAL_BROADCAST_NETWORK && network != deviceNetwork) {
+				continue;
+			}
+			for (uint32_t deviceIndex = 0; deviceIndex < topology.devicesPerNetwork; deviceIndex++) {
+				uint32_t instance = topology.GetDeviceInstance(networkIndex, deviceIndex);
+				if (instance < lowLimit || instance > highLimit) {
+					continue;
+				}
+				uint8_t mac[VIRTUAL_DEVICE_MAC_LENGTH] = { (uint8_t)(instance >> 16), (uint8_t)(instance >> 8), (uint8_t)instance };
+				uint32_t objectIdentifier = ((uint32_t)OBJECT_TYPE_DEVICE << 22) | instance;
+				const uint8_t iAm[] = {
+					APDU_TYPE_UNCONFIRMED_REQUEST, SERVICE_UNCONFIRMED_I_AM,
+					0xC4, (uint8_t)(objectIdentifier >> 24), (uint8_t)(objectIdentifier >> 16), (uint8_t)(objectIdentifier >> 8), (uint8_t)objectIdentifier,
+					0x22, 0x05, 0xC4,	// Max APDU 1476
+					0x91, 0x03,			// No segmentation
+					0x21, 0x0F			// Vendor
+				};
+				reply.Start(deviceNetwork, mac, VIRTUAL_DEVICE_MAC_LENGTH);
+				reply.Append(iAm, sizeof(iAm));
+				reply.Finish();
+				output.Queue(ipAddress, port, reply.data, reply.length);
+				replies++;
+			}
+		}
+		return replies;
+	}
+
+	if (pduType == APDU_TYPE_CONFIRMED_REQUEST && offset + 4 <= length && message[offset + 3] == SERVICE_CONFIRMED_SUBSCRIBE_COV) {
+		// Remember the subscriber and accept. The device is the 3 byte MAC it was sent to.
+		uint16_t parametersOffset = offset + 4;
+		ResponderSubscription subscription;
+		if (addressLength != VIRTUAL_DEVICE_MAC_LENGTH ||
+			!DecodeContextUnsigned(message, length, &parametersOffset, 0, &subscription.subscriberProcessIdentifier) ||
+			!DecodeContextObjectIdentifier(message, length, &parametersOffset, 1, &subscription.objectIdentifier)) {
+			return 0;
+		}
+		memcpy(subscription.ipAddress, ipAddress, sizeof(subscription.ipAddress));
+		subscription.port = port;
+		subscription.network = network;
+		subscription.deviceInstance = ((uint32_t)address[0] << 16) | ((uint32_t)address[1] << 8) | address[2];
+		subscriptions.Add(subscription);
+
+		const uint8_t simpleAck[] = { APDU_TYPE_SIMPLE_ACK, message[offset + 2], SERVICE_CONFIRMED_SUBSCRIBE_COV };
+		reply.Start(network, address, addressLength);
+		reply.Append(simpleAck, sizeof(simpleAck));
+		reply.Finish();
+		output.Queue(ipAddress, port, reply.data, reply.length);
+		return 1;
+	}
+
+	if (pduType == APDU_TYPE_CONFIRMED_REQUEST && offset + 4 <= length) {
+		// ComplexAck that echoes the service parameters. The load generator only matches
+		// the invoke id, the content is not decoded.
+		const uint8_t header[] = { APDU_TYPE_COMPLEX_ACK, message[offset + 2], message[offset + 3] };
+		reply.Start(network, address, addressLength);
+		reply.Append(header, sizeof(header));
+		reply.Append(message + offset + 4, length - offset - 4);
+		reply.Finish();
+		output.Queue(ipAddress, port, reply.data, reply.length);
+		return 1;
+	}
+	return 0;
+}
+
+// Sends one UnconfirmedCOVNotification with the present value and status flags, like the
+// notification of an Analog Input. Returns false if the send queue is full.
+static bool SendNotification(ResponderOutput & output, const ResponderSubscription & subscription, const float presentValue)
+{
+	uint8_t mac[VIRTUAL_DEVICE_MAC_LENGTH] = { (uint8_t)(subscription.deviceInstance >> 16), (uint8_t)(subscription.deviceInstance >> 8), (uint8_t)subscription.deviceInstance };
+	uint32_t deviceIdentifier = ((uint32_t)OBJECT_TYPE_DEVICE << 22) | (subscription.deviceInstance & OBJECT_INSTANCE_MASK);
+	uint32_t valueBits;
+	memcpy(&valueBits, &presentValue, sizeof(valueBits));
+	const uint8_t notification[] = {
+		APDU_TYPE_UNCONFIRMED_REQUEST, SERVICE_UNCONFIRMED_COV_NOTIFICATION,
+		0x0C, (uint8_t)(subscription.subscriberProcessIdentifier >> 24), (uint8_t)(subscription.subscriberProcessIdentifier >> 16), (uint8_t)(subscription.subscriberProcessIdentifier >> 8), (uint8_t)subscription.subscriberProcessIdentifier,
+		0x1C, (uint8_t)(deviceIdentifier >> 24), (uint8_t)(deviceIdentifier >> 16), (uint8_t)(deviceIdentifier >> 8), (uint8_t)deviceIdentifier,
+		0x2C, (uint8_t)(subscription.objectIdentifier >> 24), (uint8_t)(subscription.objectIdentifier >> 16), (uint8_t)(subscription.objectIdentifier >> 8), (uint8_t)subscription.objectIdentifier,
+		0x39, (uint8_t)COV_TIME_REMAINING_SECONDS,
+		0x4E,	// List of values
+		0x09, (uint8_t)PROPERTY_IDENTIFIER_PRESENT_VALUE, 0x2E, 0x44, (uint8_t)(valueBits >> 24), (uint8_t)(valueBits >> 16), (uint8_t)(valueBits >> 8), (uint8_t)valueBits, 0x2F,
+		0x09, (uint8_t)PROPERTY_IDENTIFIER_STATUS_FLAGS, 0x2E, 0x82, 0x04, 0x00, 0x2F,
+		0x4F
+	};
+	ResponderMessage message;
+	message.Start(subscription.network, mac, VIRTUAL_DEVICE_MAC_LENGTH);
+	message.Append(notification, sizeof(notification));
+	message.Finish();
+	return output.Queue(subscription.ipAddress, subscription.port, message.data, message.length);
+}
+
+// Sends the notifications that are due at --cov-rate, to the subscribed objects in turn
+static void SendNotifications(ResponderOutput & output, ResponderSubscriptions & subscriptions, const uint32_t covRate, const Clock::time_point start)
+{
+	if (covRate == 0 || subscriptions.subscriptions.empty()) {
+		return;
+	}
+	uint64_t due = GetElapsedNs(start, Clock::now()) / 1000 * covRate / 1000000;
+	while (subscriptions.notifications < due) {
+		const ResponderSubscription & subscription = subscriptions.subscriptions[subscriptions.next];
+		if (!SendNotification(output, subscription, (float)(subscriptions.notifications & 0xFFFF))) {
+			output.Flush(); // The queue is full
+			continue;
+		}
+		subscriptions.next = (subscriptions.next + 1) % subscriptions.subscriptions.size();
+		subscriptions.notifications++;
+	}
+}
+
+// Counts of one loop that answers messages, the main loop or a shard worker
+class ResponderLoop
+{
+public:
+	ResponderSubscriptions subscriptions;
+	uint32_t covRate;
+	uint64_t received;
+	uint64_t replies;
+
+	ResponderLoop() : covRate(0), received(0), replies(0) {}
+
+	// Answers one message and starts the notifications with the first subscription
+	void Answer(ResponderOutput & output, const ExampleDatabaseTopology & topology, const uint8_t* message, const uint16_t length, const uint8_t* ipAddress, const uint16_t port, Clock::time_point & covStart) {
+		this->received++;
+		size_t subscribed = this->subscriptions.subscriptions.size();
+		this->replies += ::Answer(output, topology, this->subscriptions, message, length, ipAddress, port);
+		if (subscribed == 0 && !this->subscriptions.subscriptions.empty()) {
+			covStart = Clock::now();
+		}
+	}
+
+	int GetWaitMs(ResponderOutput & output) {
+		return output.GetPending() > 0 || (this->covRate > 0 && !this->subscriptions.subscriptions.empty()) ? 1 : MAIN_LOOP_IDLE_WAIT_MS;
+	}
+};
+
+// Answers the messages of one shard on its own thread
+static void RunShardWorker(CSimpleUDP & udp, ExampleDispatcher & dispatcher, const uint32_t shard, const ExampleDatabaseTopology & topology, const std::atomic<bool> & stop, ResponderLoop & loop, uint64_t & dropped)
+{
+	ResponderOutput output(udp, true);
+	Clock::time_point covStart = Clock::now();
+	uint8_t message[CSimpleUDPPacket::MAX_LENGTH];
+	while (!stop.load(std::memory_order_relaxed)) {
+		uint8_t ipAddress[4];
+		uint16_t port = 0;
+		uint16_t length = dispatcher.GetShardMessage(shard, message, sizeof(message), ipAddress, &port);
+		if (length > 0) {
+			loop.Answer(output, topology, message, length, ipAddress, port, covStart);
+		}
+		SendNotifications(output, loop.subscriptions, loop.covRate, covStart);
+		output.Flush();
+		dispatcher.WaitForShardMessage(shard, loop.GetWaitMs(output));
+	}
+	output.Flush();
+	dropped = output.dropped;
+}
+
+int RunResponder(const BenchmarkOptions & options)
+{
+	CSimpleUDP udp;
+	ExampleDispatcher dispatcher;
+	bool eventMode = options.receiveMode == "event";
+	if (eventMode) {
+		udp.SetEventMode(true, UDP_RECEIVE_RING_SIZE);
+	}
+	if (!udp.Connect(options.port)) {
+		std::cerr << "Failed to connect to UDP Resource" << std::endl;
+		return -1;
+	}
+	udp.SetSendQueueSize(UDP_SEND_QUEUE_SIZE);
+
+	if (options.shards > 0) {
+		std::vector<uint16_t> virtualNetworks;
+		for (uint32_t networkIndex = 0; networkIndex < options.topology.numberOfNetworks; networkIndex++) {
+			virtualNetworks.push_back((uint16_t)options.topology.GetNetwork(networkIndex));
+		}
+		dispatcher.shardCount = options.shards;
+		dispatcher.queueSize = options.shardQueueSize;
+		if (!dispatcher.Start(&udp, virtualNetworks)) {
+			std::cerr << "Sharded receive needs the event receive mode" << std::endl;
+			return -1;
+		}
+	}
+	bool shardWorkers = options.shardWorkers && dispatcher.IsRunning(); // Without shards there is only the main loop
+	std::cout << "FYI: Responding on port=[" << options.port << "], receiveMode=[" << options.receiveMode << "], shards=[" << options.shards << "], shardWorkers=[" << shardWorkers << "], devices=[" << options.topology.GetNumberOfDevices() << "]" << std::endl;
+
+	signal(SIGINT, HandleStopSignal);
+	signal(SIGTERM, HandleStopSignal);
+	Clock::time_point start = Clock::now();
+	uint64_t startUserUs, startSystemUs;
+	GetProcessCpuTimeUs(&startUserUs, &startSystemUs);
+	Clock::time_point endTime = options.durationSeconds > 0 ? start + std::chrono::seconds(options.durationSeconds) : Clock::time_point::max();
+
+	// One loop, or one per shard worker. The COV rate is split over the workers.
+	std::vector<ResponderLoop> loops(shardWorkers ? options.shards : 1);
+	for (size_t offset = 0; offset < loops.size(); offset++) {
+		loops[offset].covRate = options.covRate / (uint32_t)loops.size() + (offset < options.covRate % loops.size() ? 1 : 0);
+	}
+	uint64_t outputDropped = 0;
+
+	if (shardWorkers) {
+		std::atomic<bool> stop(false);
+		std::vector<uint64_t> workerDropped(loops.size(), 0);
+		std::vector<std::thread> workers;
+		for (uint32_t shard = 0; shard < options.shards; shard++) {
+			workers.push_back(std::thread(RunShardWorker, std::ref(udp), std::ref(dispatcher), shard, std::cref(options.topology), std::cref(stop), std::ref(loops[shard]), std::ref(workerDropped[shard])));
+		}
+		while (!g_stop && Clock::now() < endTime) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(MAIN_LOOP_IDLE_WAIT_MS));
+		}
+		stop.store(true);
+		for (size_t offset = 0; offset < workers.size(); offset++) {
+			workers[offset].join();
+			outputDropped += workerDropped[offset];
+		}
+	}
+	else {
+		// The server's main loop, with the fpLoop() call replaced by answering one message
+		ResponderLoop & loop = loops[0];
+		ResponderOutput output(udp, false);
+		Clock::time_point covStart = start;
+		uint8_t message[CSimpleUDPPacket::MAX_LENGTH];
+		while (!g_stop && Clock::now() < endTime) {
+			uint8_t ipAddress[4];
+			uint16_t port = 0;
+			int length;
+			if (dispatcher.IsRunning()) {
+				length = dispatcher.GetMessage(message, sizeof(message), ipAddress, &port);
+			}
+			else {
+				char ipAddressText[32];
+				length = udp.GetMessage(message, sizeof(message), ipAddressText, &port);
+				port = ntohs(port);
+				if (length > 0 && inet_pton(AF_INET, ipAddressText, ipAddress) != 1) {
+					length = 0;
+				}
+			}
+			if (length > 0) {
+				loop.Answer(output, options.topology, message, (uint16_t)length, ipAddress, port, covStart);
+			}
+			SendNotifications(output, loop.subscriptions, loop.covRate, covStart);
+
+			output.Flush();
+
+			// Wait like the server, the poll mode already blocked in recvfrom
+			int waitMs = loop.GetWaitMs(output);
+			if (dispatcher.IsRunning()) {
+				dispatcher.WaitForMessage(waitMs);
+			}
+			else if (eventMode) {
+				udp.WaitForMessage(waitMs);
+			}
+		}
+	}
+	dispatcher.Stop();
+
+	uint64_t received = 0;
+	uint64_t replies = 0;
+	size_t subscriptions = 0;
+	uint64_t notifications = 0;
+	for (size_t offset = 0; offset < loops.size(); offset++) {
+		received += loops[offset].received;
+		replies += loops[offset].replies;
+		subscriptions += loops[offset].subscriptions.subscriptions.size();
+		notifications += loops[offset].subscriptions.notifications;
+	}
+	unsigned long long queued, sent, dropped;
+	udp.GetSendCounters(&queued, &sent, &dropped);
+	double seconds = (double)GetElapsedNs(start, Clock::now()) / 1e9;
+	std::cout << "FYI: Received " << received << " messages in " << seconds << " s, replies=[" << replies << "], subscriptions=[" << subscriptions << "], notifications=[" << notifications << "], sent=[" << sent << "], dropped=[" << (dropped + outputDropped) << "]" << std::endl;
+	for (uint32_t shard = 0; shard < options.shards; shard++) {
+		ExampleDispatcherShardStats stats = dispatcher.GetShardStats(shard);
+		std::cout << "  Shard " << shard << ": networks=[" << stats.networks << "], received=[" << stats.received << "], dropped=[" << stats.dropped << "], processed=[" << stats.processed << "]";
+		if (shardWorkers) {
+			std::cout << ", answered=[" << loops[shard].received << "]";
+		}
+		std::cout << std::endl;
+	}
+
+	// Same line as the server, used by make bench-cov
+	uint64_t userUs, systemUs;
+	GetProcessCpuTimeUs(&userUs, &systemUs);
+	std::cout << "FYI: Main loop CPU time. user=[" << (userUs - startUserUs) / 1000 << " ms], system=[" << (systemUs - startSystemUs) / 1000 << " ms]" << std::endl;
+	return 0;
+}
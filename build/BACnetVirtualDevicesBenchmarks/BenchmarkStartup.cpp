@@ -0,0 +1,148 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * BenchmarkStartup.cpp
+ *
+ * Time and resident memory to build the virtual devices at 1k, 10k and 100k
+ * devices, with the ExampleDatabase and with the database the server used
+ * before the topology was configurable. Each build runs in its own child
+ * process so the memory of one does not hide in the heap of another.
+ *
+ * The calls that add the devices to the CAS BACnet Stack are not included.
+ * The server prints the whole startup time and resident memory when it
+ * starts, see "Virtual devices ready" in its output.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#include "Benchmarks.h"
+#include "BenchmarkOldDatabase.h"
+
+// Shared with the server
+#include "CASBACnetStackExampleDatabase.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h> // strtoul()
+#include <string.h>
+#include <iostream>
+#include <iomanip>
+
+// Topologies that are measured, packed like the object index benchmark
+struct StartupSize {
+	uint32_t numberOfNetworks;
+	uint32_t devicesPerNetwork;
+};
+static const StartupSize STARTUP_SIZES[] = {
+	{ 10, 100 },
+	{ 10, 1000 },
+	{ 100, 1000 }
+};
+
+// Sent from the child process to the parent
+struct StartupResult {
+	uint64_t setupNs;
+	uint64_t residentMemoryKB; // Growth of the resident memory during the setup
+};
+
+// Returns the resident memory of this process in KB, or zero if it is not known.
+static size_t GetResidentMemoryKB()
+{
+	FILE* file = fopen("/proc/self/status", "r");
+	if (file == NULL) {
+		return 0;
+	}
+	char line[256];
+	size_t residentMemory = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (strncmp(line, "VmRSS:", 6) == 0) {
+			residentMemory = (size_t)strtoul(line + 6, NULL, 10);
+			break;
+		}
+	}
+	fclose(file);
+	return residentMemory;
+}
+
+// Builds the database in a child process. Returns false if the child failed.
+static bool MeasureStartup(const ExampleDatabaseTopology & topology, const bool oldDatabase, StartupResult & result)
+{
+	int pipeEnds[2];
+	if (pipe(pipeEnds) != 0) {
+		return false;
+	}
+	pid_t child = fork();
+	if (child < 0) {
+		close(pipeEnds[0]);
+		close(pipeEnds[1]);
+		return false;
+	}
+
+	if (child == 0) {
+		close(pipeEnds[0]);
+		StartupResult childResult;
+		if (oldDatabase) {
+			BenchmarkOldDatabase database;
+			size_t residentMemoryBefore = GetResidentMemoryKB();
+			Clock::time_point start = Clock::now();
+			database.Setup(topology);
+			childResult.setupNs = GetElapsedNs(start, Clock::now());
+			childResult.residentMemoryKB = GetResidentMemoryKB() - residentMemoryBefore;
+		}
+		else {
+			ExampleDatabase database;
+			size_t residentMemoryBefore = GetResidentMemoryKB();
+			Clock::time_point start = Clock::now();
+			database.topology = topology;
+			database.Setup();
+			childResult.setupNs = GetElapsedNs(start, Clock::now());
+			childResult.residentMemoryKB = GetResidentMemoryKB() - residentMemoryBefore;
+		}
+		ssize_t written = write(pipeEnds[1], &childResult, sizeof(childResult));
+		_exit(written == (ssize_t)sizeof(childResult) ? 0 : 1);
+	}
+
+	close(pipeEnds[1]);
+	ssize_t length = read(pipeEnds[0], &result, sizeof(result));
+	close(pipeEnds[0]);
+	int status = 0;
+	waitpid(child, &status, 0);
+	return length == (ssize_t)sizeof(result) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int RunStartup(const BenchmarkOptions &)
+{
+	std::cout << "FYI: Time and resident memory to build the virtual devices, one Analog Input per device" << std::endl;
+	std::cout << std::setw(10) << "devices"
+		<< std::setw(12) << "old ms" << std::setw(12) << "new ms"
+		<< std::setw(12) << "old KB" << std::setw(12) << "new KB" << std::endl;
+	std::cout.flush(); // Before the children copy the buffer
+
+	for (size_t sizeOffset = 0; sizeOffset < sizeof(STARTUP_SIZES) / sizeof(STARTUP_SIZES[0]); sizeOffset++) {
+		ExampleDatabaseTopology topology;
+		topology.numberOfNetworks = STARTUP_SIZES[sizeOffset].numberOfNetworks;
+		topology.devicesPerNetwork = STARTUP_SIZES[sizeOffset].devicesPerNetwork;
+		topology.networkOffset = 1;
+		topology.deviceInstanceOffset = topology.devicesPerNetwork;
+		topology.analogInputsPerDevice = 1;
+		topology.analogValuesPerDevice = 0;
+		std::string topologyError;
+		if (!topology.Validate(topologyError)) {
+			std::cerr << "Error - invalid topology for the startup: " << topologyError << std::endl;
+			return -1;
+		}
+
+		StartupResult oldResult;
+		StartupResult newResult;
+		if (!MeasureStartup(topology, true, oldResult) || !MeasureStartup(topology, false, newResult)) {
+			std::cerr << "Error - the startup of " << topology.GetNumberOfDevices() << " devices failed" << std::endl;
+			return -1;
+		}
+
+		std::cout << std::fixed << std::setprecision(1) << std::setw(10) << topology.GetNumberOfDevices()
+			<< std::setw(12) << oldResult.setupNs / 1e6 << std::setw(12) << newResult.setupNs / 1e6
+			<< std::setw(12) << oldResult.residentMemoryKB << std::setw(12) << newResult.residentMemoryKB << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * Benchmarks.h
+ *
+ * Benchmarks of the parts of the server that do not need the CAS BACnet
+ * Stack. Each benchmark is one function that reads its options and prints
+ * its results. Returns zero on success.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#ifndef __Benchmarks_h__
+#define __Benchmarks_h__
+
+#include "CASBACnetStackExampleTopology.h"
+
+#include <stdint.h>
+#include <chrono>
+#include <string>
+
+typedef std::chrono::steady_clock Clock;
+
+class BenchmarkOptions
+{
+public:
+	std::string benchmark;		// responder, object-index, live-values or startup
+	uint16_t port;
+	std::string receiveMode;	// event or poll
+	uint32_t shards;
+	uint32_t shardQueueSize;
+	uint32_t shardWorkers;		// 1 answers each shard on its own thread
+	uint32_t durationSeconds;	// 0 runs until stopped
+	uint32_t covRate;			// Responder COV notifications per second, 0 is off
+	uint32_t writers;			// Live value writer threads
+	uint32_t slots;				// Live Analog Inputs
+	ExampleDatabaseTopology topology; // Same options and defaults as the server
+
+	BenchmarkOptions();
+	bool SetOption(const std::string & name, const std::string & value);
+};
+
+// Answers the load generator the way the server does, without the CAS BACnet Stack. Uses the
+// server's receive path: CSimpleUDP in the event or poll mode, and optionally the dispatcher.
+int RunResponder(const BenchmarkOptions & options);
+
+// Times the device and object lookups of the ExampleDatabase against the map walk the
+// server used before the object index, at 30, 10k and 100k devices.
+int RunObjectIndex(const BenchmarkOptions & options);
+
+// Stress test of the live Analog Input values of the ExampleDatabase: writer threads and
+// one reader. Fails if the reader sees a torn value or a timestamp that goes backwards.
+// Prints the write and read throughput and the read latency.
+int RunLiveValues(const BenchmarkOptions & options);
+
+// Time and resident memory to build the virtual devices at 1k, 10k and 100k devices,
+// old database vs ExampleDatabase. The CAS BACnet Stack calls are not included.
+int RunStartup(const BenchmarkOptions & options);
+
+uint64_t GetElapsedNs(const Clock::time_point start, const Clock::time_point end);
+
+#endif // __Benchmarks_h__
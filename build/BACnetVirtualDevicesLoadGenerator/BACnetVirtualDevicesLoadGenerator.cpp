@@ -0,0 +1,1216 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * BACnetVirtualDevicesLoadGenerator.cpp
+ *
+ * A BACnet/IP client simulator used to benchmark the virtual devices server.
+ * It sends a mix of Who-Is, ReadProperty and ReadPropertyMultiple requests to
+ * the virtual devices, and reports the throughput, latency percentiles and
+ * timeouts as text, CSV or JSON so that releases can be compared. Traffic can
+ * be recorded to a pcap file and replayed later. The announce scenario checks
+ * that the server paces its I-Am replies to the announce options, and the cov
+ * scenario subscribes to the Analog Inputs and counts the notifications so the
+ * bytes on the wire can be compared with polling.
+ *
+ * The virtual device topology options are the same as the server's, so the
+ * load generator knows which devices and Analog Inputs to expect.
+ *
+ * Build and run with "make bench". Linux only.
+ *
+ * Created by: Steven Smethurst
+ */
+
+#if !defined(__GNUC__)
+#error "The load generator uses the epoll receive path of CSimpleUDP and is only built on Linux"
+#endif
+
+#include "LoadGeneratorMessages.h"
+#include "LoadGeneratorResults.h"
+
+// Shared with the server
+#include "CASBACnetStackExampleTopology.h"
+#include "CASBACnetStackExamplePcap.h"
+#include "SimpleUDP.h"
+
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdlib.h> // strtoul(), strtod()
+#include <string.h>
+
+typedef std::chrono::steady_clock Clock;
+
+// Options
+// =======================================
+class LoadGeneratorOptions
+{
+public:
+	std::string server;
+	uint16_t port;
+	std::string scenario;			// cold-start, discovered, rpm-all-ai, announce, cov or replay
+	uint32_t durationSeconds;
+	uint32_t concurrency;			// Requests waiting for a reply at any time
+	uint32_t rate;					// Requests per second, 0 for as fast as the replies come back
+	uint32_t timeoutMs;
+	uint32_t whoIsWeight;			// Request mix of the discovered scenario
+	uint32_t readPropertyWeight;
+	uint32_t readPropertyMultipleWeight;
+	uint32_t rpmObjects;			// Analog Inputs read by one ReadPropertyMultiple
+	uint32_t seed;
+	std::string listenBroadcast;	// Broadcast address to also hear I-Am on, an ip, "auto" or "off"
+	uint32_t discoveryTimeoutSeconds;
+	std::string format;				// text, csv or json
+	std::string output;				// Report file, appended to. Empty for the console.
+	std::string label;
+	std::string record;				// pcap file of everything sent and received
+	std::string replay;				// pcap file of requests to send
+	double replaySpeed;				// 1 is the captured timing, 0 is as fast as possible
+	uint32_t announceRate;			// The server's announce options, checked by the announce scenario
+	uint32_t announceBurst;
+	uint32_t announceJitter;
+
+	LoadGeneratorOptions();
+	bool SetOption(const std::string & name, const std::string & value);
+	bool SetMix(const std::string & value);
+};
+
+// A virtual device the load generator sends requests to
+struct LoadGeneratorDevice
+{
+	uint32_t instance;
+	LoadGeneratorAddress address;
+	bool discovered;
+};
+
+// A request waiting for its reply, by invoke id
+struct LoadGeneratorPendingRequest
+{
+	bool active;
+	LoadGeneratorResults::Operation operation;
+	Clock::time_point sentTime;
+};
+
+// A request read from a capture for replay
+struct LoadGeneratorReplayPacket
+{
+	uint64_t timestampUs;
+	std::vector<uint8_t> data;
+};
+
+// What the request generator of a scenario did
+enum SendResult {
+	SEND_RESULT_SENT,
+	SEND_RESULT_BLOCKED,	// Nothing can be sent right now
+	SEND_RESULT_DONE		// The scenario has nothing more to send
+};
+typedef SendResult(*SendNextFunction)();
+
+// Globals
+// =======================================
+LoadGeneratorOptions g_options;
+ExampleDatabaseTopology g_topology; // Same options and defaults as the server
+CSimpleUDP g_udp; // Requests and replies
+CSimpleUDP g_listener; // Optional, hears the I-Am broadcasts of the server
+ExamplePcapFile g_record; // Optional capture of the traffic
+LoadGeneratorResults g_results;
+std::mt19937 g_random;
+
+uint8_t g_serverIPAddress[4];
+std::vector<LoadGeneratorDevice> g_devices;
+std::map<uint32_t, size_t> g_deviceIndex; // Device instance to offset in g_devices
+size_t g_nextDevice; // Round robin over the devices
+uint32_t g_nextObject; // rpm-all-ai: first Analog Input of the next request
+
+LoadGeneratorPendingRequest g_pending[256];
+std::deque<uint8_t> g_freeInvokeIds; // Timed out ids go to the back so a late reply is not matched to a new request
+std::map<uint32_t, Clock::time_point> g_pendingWhoIs; // Device instance to send time
+uint32_t g_outstanding;
+
+bool g_countNotifications; // cov, after the subscriptions were sent
+bool g_discovering; // Cold start, record the devices found
+Clock::time_point g_discoveryStart;
+std::vector<Clock::time_point> g_discoveryTimes; // When each device was found
+
+std::vector<LoadGeneratorReplayPacket> g_replayPackets;
+size_t g_replayNext;
+Clock::time_point g_replayStart;
+
+// Constants
+// =======================================
+const std::string APPLICATION_VERSION = "0.0.6";  // See CHANGELOG.md for a full list of changes.
+const unsigned short UDP_RECEIVE_RING_SIZE = 1024;
+const unsigned short UDP_SEND_QUEUE_SIZE = 64;
+const uint32_t MAX_CONCURRENCY = 255; // One invoke id each
+const uint32_t WHO_IS_RETRY_MS = 1000; // Cold start, until the server answers
+const int IDLE_WAIT_MS = 1;
+const uint32_t DEFAULT_ANNOUNCE_RATE = 200; // Same defaults as the server
+const uint32_t DEFAULT_ANNOUNCE_BURST = 10;
+const uint32_t DEFAULT_ANNOUNCE_JITTER = 20;
+const double ANNOUNCE_RATE_TOLERANCE = 0.1; // Measured rate can be this much over --announce-rate
+const uint32_t COV_SUBSCRIBER_PROCESS_ID = 1;
+const uint32_t COV_LIFETIME_MARGIN_SECONDS = 60; // The subscriptions last this much longer than --duration
+
+// Helper functions
+bool LoadArguments(int argc, char* argv[]);
+void PrintUsage();
+bool ConnectListener();
+void BuildDevices();
+bool Discover(const bool measure);
+bool CheckAnnounceRate();
+void ReceiveNotifications(const Clock::time_point endTime);
+bool RunLoad(SendNextFunction sendNext, const Clock::time_point endTime, Clock::time_point* sendEndTime);
+void SendMessage(const uint8_t* message, const uint16_t length);
+void ProcessReceived();
+void ProcessMessage(const uint8_t* message, const uint16_t length, const Clock::time_point now);
+void CheckTimeouts(const Clock::time_point now);
+bool AllocateInvokeId(uint8_t* invokeId);
+void TrackRequest(const uint8_t invokeId, const LoadGeneratorResults::Operation operation);
+void RecordPacket(const bool sent, const uint8_t* message, const uint16_t length);
+bool LoadReplay(const std::string & path);
+bool WriteReport();
+uint64_t GetElapsedNs(const Clock::time_point start, const Clock::time_point end);
+
+// Request generators of the scenarios
+SendResult SendNextMixed();
+SendResult SendNextAllAnalogInputs();
+SendResult SendNextObjectName();
+SendResult SendNextSubscribeCOV();
+SendResult SendNextReplay();
+
+int main(int argc, char* argv[])
+{
+	// Print the application version information
+	std::cout << "BACnet Virtual Devices Load Generator v" << APPLICATION_VERSION << std::endl;
+
+	// 0. Load the configuration
+	// ---------------------------------------------------------------------------
+	if (!LoadArguments(argc, argv)) {
+		PrintUsage();
+		return -1;
+	}
+	std::string topologyError;
+	if (!g_topology.Validate(topologyError)) {
+		std::cerr << "Invalid virtual device topology: " << topologyError << std::endl;
+		return -1;
+	}
+	if (g_options.scenario == "replay" && g_options.replay.empty()) {
+		std::cerr << "The replay scenario needs a capture file, see --replay" << std::endl;
+		return -1;
+	}
+	inet_pton(AF_INET, g_options.server.c_str(), g_serverIPAddress);
+	g_random.seed(g_options.seed);
+	g_results.scenario = g_options.scenario;
+	g_results.label = g_options.label;
+
+	// 1. Connect
+	// ---------------------------------------------------------------------------
+	g_udp.SetEventMode(true, UDP_RECEIVE_RING_SIZE);
+	if (!g_udp.Connect(0)) {
+		std::cerr << "Failed to connect to UDP Resource" << std::endl;
+		return -1;
+	}
+	g_udp.SetSendQueueSize(UDP_SEND_QUEUE_SIZE);
+	std::cout << "FYI: Sending to server=[" << g_options.server << ":" << g_options.port << "], scenario=[" << g_options.scenario << "]" << std::endl;
+
+	// The Who-Is are sent unicast, so the server answers them straight to this socket. The I-Am
+	// broadcasts, eg. the startup announcements, can also be heard on a second socket bound to
+	// the broadcast address.
+	if (g_options.scenario != "replay") {
+		ConnectListener();
+	}
+
+	if (!g_options.record.empty()) {
+		if (!g_record.Open(g_options.record)) {
+			std::cerr << "Failed to open the record file [" << g_options.record << "]" << std::endl;
+			return -1;
+		}
+		std::cout << "FYI: Recording to [" << g_options.record << "]" << std::endl;
+	}
+
+	for (uint32_t invokeId = 0; invokeId < 256; invokeId++) {
+		g_pending[invokeId].active = false;
+		g_freeInvokeIds.push_back((uint8_t)invokeId);
+	}
+	g_outstanding = 0;
+
+	// 2. Run the scenario
+	// ---------------------------------------------------------------------------
+	BuildDevices();
+	Clock::time_point start = Clock::now();
+	Clock::time_point sendEnd = start;
+	bool ok = true;
+	bool passed = true; // Checks of the announce scenario, the report is still written when they fail
+	if (g_options.scenario == "cold-start") {
+		// Who-Is until every device answered, then read the name of each device once.
+		// Start the server just before the load generator to include its start up.
+		ok = Discover(true) && RunLoad(SendNextObjectName, Clock::now() + std::chrono::seconds(g_options.durationSeconds), &sendEnd);
+		// The whole run, from the first Who-Is until the last device name was read
+		g_results.durationSeconds = (double)GetElapsedNs(start, Clock::now()) / 1e9;
+	}
+	else if (g_options.scenario == "discovered" || g_options.scenario == "rpm-all-ai") {
+		// Steady state. Discovery is not part of the results.
+		ok = Discover(false);
+		if (ok) {
+			g_results.ResetBytes();
+			start = Clock::now();
+			ok = RunLoad(g_options.scenario == "discovered" ? SendNextMixed : SendNextAllAnalogInputs, start + std::chrono::seconds(g_options.durationSeconds), &sendEnd);
+			g_results.durationSeconds = (double)GetElapsedNs(start, sendEnd) / 1e9;
+		}
+	}
+	else if (g_options.scenario == "announce") {
+		// One Who-Is for every device. The server answers it at its announce rate, check that
+		// the I-Am do not come faster or in larger bursts than the announce options allow.
+		ok = Discover(true);
+		if (ok && !g_discoveryTimes.empty()) {
+			g_results.durationSeconds = (double)GetElapsedNs(g_discoveryStart, g_discoveryTimes.back()) / 1e9;
+		}
+		passed = !ok || CheckAnnounceRate();
+	}
+	else if (g_options.scenario == "cov") {
+		// Subscribe to every Analog Input, then count the notifications for the duration. The
+		// server only sends them when the values change, eg. with --simulate-rate.
+		ok = Discover(false) && RunLoad(SendNextSubscribeCOV, Clock::time_point::max(), &sendEnd);
+		const LoadGeneratorResults::OperationStats & subscriptions = g_results.operations[LoadGeneratorResults::OPERATION_SUBSCRIBE_COV];
+		if (ok && subscriptions.completed == subscriptions.errors) {
+			std::cerr << "No subscription was accepted. Is the server running with --cov on?" << std::endl;
+			ok = false;
+		}
+		if (ok) {
+			g_results.ResetBytes();
+			start = Clock::now();
+			ReceiveNotifications(start + std::chrono::seconds(g_options.durationSeconds));
+			g_results.durationSeconds = (double)GetElapsedNs(start, Clock::now()) / 1e9;
+		}
+	}
+	else if (g_options.scenario == "replay") {
+		ok = LoadReplay(g_options.replay);
+		if (ok) {
+			g_replayNext = 0;
+			g_replayStart = start = Clock::now();
+			ok = RunLoad(SendNextReplay, Clock::time_point::max(), &sendEnd);
+			g_results.durationSeconds = (double)GetElapsedNs(start, sendEnd) / 1e9;
+		}
+	}
+
+	// 3. Report
+	// ---------------------------------------------------------------------------
+	g_record.Close();
+	if (!ok) {
+		return -1;
+	}
+	return WriteReport() && passed ? 0 : -1;
+}
+
+// Helper Functions
+
+LoadGeneratorOptions::LoadGeneratorOptions() {
+	this->server = "127.0.0.1";
+	this->port = 47808;
+	this->scenario = "discovered";
+	this->durationSeconds = 10;
+	this->concurrency = 16;
+	this->rate = 0;
+	this->timeoutMs = 2000;
+	this->whoIsWeight = 0;
+	this->readPropertyWeight = 8;
+	this->readPropertyMultipleWeight = 2;
+	this->rpmObjects = 50;
+	this->seed = 1;
+	this->listenBroadcast = "off";
+	this->discoveryTimeoutSeconds = 60;
+	this->format = "text";
+	this->replaySpeed = 1.0;
+	this->announceRate = DEFAULT_ANNOUNCE_RATE;
+	this->announceBurst = DEFAULT_ANNOUNCE_BURST;
+	this->announceJitter = DEFAULT_ANNOUNCE_JITTER;
+}
+
+bool LoadGeneratorOptions::SetOption(const std::string & name, const std::string & value) {
+	// Numeric options
+	struct NumericOption {
+		const char* name;
+		uint32_t* value;
+		unsigned long min;
+		unsigned long max;
+	};
+	uint32_t port = this->port;
+	const NumericOption numericOptions[] = {
+		{ "port", &port, 1, 65535 },
+		{ "duration", &this->durationSeconds, 1, 86400 },
+		{ "concurrency", &this->concurrency, 1, MAX_CONCURRENCY },
+		{ "rate", &this->rate, 0, 1000000 },
+		{ "timeout-ms", &this->timeoutMs, 1, 60000 },
+		{ "rpm-objects", &this->rpmObjects, 1, 100 },
+		{ "seed", &this->seed, 0, 0xFFFFFFFFUL },
+		{ "discovery-timeout", &this->discoveryTimeoutSeconds, 1, 3600 },
+		{ "announce-rate", &this->announceRate, 0, 0xFFFFFFFFUL },
+		{ "announce-burst", &this->announceBurst, 1, 0xFFFFFFFFUL },
+		{ "announce-jitter", &this->announceJitter, 0, 100 }
+	};
+	for (size_t offset = 0; offset < sizeof(numericOptions) / sizeof(numericOptions[0]); offset++) {
+		if (name != numericOptions[offset].name) {
+			continue;
+		}
+		char* end = NULL;
+		unsigned long number = strtoul(value.c_str(), &end, 10);
+		if (value.empty() || end == NULL || *end != '\0' || number < numericOptions[offset].min || number > numericOptions[offset].max) {
+			return false;
+		}
+		*numericOptions[offset].value = (uint32_t)number;
+		this->port = (uint16_t)port;
+		return true;
+	}
+
+	if (name == "server") {
+		uint8_t address[4];
+		if (inet_pton(AF_INET, value.c_str(), address) != 1) {
+			return false;
+		}
+		this->server = value;
+		return true;
+	}
+	else if (name == "scenario") {
+		if (value != "cold-start" && value != "discovered" && value != "rpm-all-ai" && value != "announce" && value != "cov" && value != "replay") {
+			return false;
+		}
+		this->scenario = value;
+		return true;
+	}
+	else if (name == "mix") {
+		return this->SetMix(value);
+	}
+	else if (name == "listen-broadcast") {
+		uint8_t address[4];
+		if (value != "auto" && value != "off" && inet_pton(AF_INET, value.c_str(), address) != 1) {
+			return false;
+		}
+		this->listenBroadcast = value;
+		return true;
+	}
+	else if (name == "format") {
+		if (value != "text" && value != "csv" && value != "json") {
+			return false;
+		}
+		this->format = value;
+		return true;
+	}
+	else if (name == "output") {
+		this->output = value;
+		return !value.empty();
+	}
+	else if (name == "label") {
+		this->label = value;
+		return true;
+	}
+	else if (name == "record") {
+		this->record = value;
+		return !value.empty();
+	}
+	else if (name == "replay") {
+		this->replay = value;
+		this->scenario = "replay";
+		return !value.empty();
+	}
+	else if (name == "replay-speed") {
+		char* end = NULL;
+		double number = strtod(value.c_str(), &end);
+		if (value.empty() || end == NULL || *end != '\0' || !(number >= 0) || number > 1000) {
+			return false;
+		}
+		this->replaySpeed = number;
+		return true;
+	}
+	return false;
+}
+
+// Parses a request mix, eg. "whois=1,rp=8,rpm=1". Requests are picked at random with these weights.
+bool LoadGeneratorOptions::SetMix(const std::string & value) {
+	uint32_t whoIs = 0, readProperty = 0, readPropertyMultiple = 0;
+	size_t start = 0;
+	while (start < value.size()) {
+		size_t end = value.find(',', start);
+		if (end == std::string::npos) {
+			end = value.size();
+		}
+		std::string item = value.substr(start, end - start);
+		start = end + 1;
+
+		size_t equals = item.find('=');
+		if (equals == std::string::npos) {
+			return false;
+		}
+		std::string name = item.substr(0, equals);
+		std::string weight = item.substr(equals + 1);
+		char* weightEnd = NULL;
+		unsigned long number = strtoul(weight.c_str(), &weightEnd, 10);
+		if (weight.empty() || weightEnd == NULL || *weightEnd != '\0' || number > 1000) {
+			return false;
+		}
+		if (name == "whois") {
+			whoIs = (uint32_t)number;
+		}
+		else if (name == "rp") {
+			readProperty = (uint32_t)number;
+		}
+		else if (name == "rpm") {
+			readPropertyMultiple = (uint32_t)number;
+		}
+		else {
+			return false;
+		}
+	}
+	if (whoIs + readProperty + readPropertyMultiple == 0) {
+		return false;
+	}
+	this->whoIsWeight = whoIs;
+	this->readPropertyWeight = readProperty;
+	this->readPropertyMultipleWeight = readPropertyMultiple;
+	return true;
+}
+
+// Reads the command line. Options are given as --name value or --name=value.
+// The topology options are passed to the same class the server uses.
+bool LoadArguments(int argc, char* argv[])
+{
+	for (int offset = 1; offset < argc; offset++) {
+		std::string argument = argv[offset];
+		if (argument == "-h" || argument == "--help") {
+			return false;
+		}
+		if (argument.compare(0, 2, "--") != 0) {
+			std::cerr << "Unexpected argument [" << argument << "]" << std::endl;
+			return false;
+		}
+
+		std::string name = argument.substr(2);
+		std::string value;
+		size_t equals = name.find('=');
+		if (equals != std::string::npos) {
+			value = name.substr(equals + 1);
+			name = name.substr(0, equals);
+		}
+		else {
+			if (offset + 1 >= argc) {
+				std::cerr << "Missing value for option [" << name << "]" << std::endl;
+				return false;
+			}
+			value = argv[++offset];
+		}
+
+		if (!g_options.SetOption(name, value) && !g_topology.SetOption(name, value)) {
+			std::cerr << "Unknown option or invalid value. " << name << "=[" << value << "]" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+void PrintUsage()
+{
+	std::cout << std::endl;
+	std::cout << "Usage: BACnetVirtualDevicesLoadGenerator [options]" << std::endl;
+	std::cout << "Options are given as --name value or --name=value" << std::endl;
+	std::cout << "  --server <ip>                      Address of the server (default 127.0.0.1)" << std::endl;
+	std::cout << "  --port <port>                      BACnet/IP port of the server (default 47808)" << std::endl;
+	std::cout << "  --scenario <name>                  cold-start, discovered, rpm-all-ai, announce, cov or replay (default discovered)" << std::endl;
+	std::cout << "                                       cold-start: Who-Is until every device answered, then read each device name once" << std::endl;
+	std::cout << "                                       discovered: the --mix of requests to the discovered devices" << std::endl;
+	std::cout << "                                       rpm-all-ai: ReadPropertyMultiple of the present value of every Analog Input" << std::endl;
+	std::cout << "                                       announce: one Who-Is for every device, checks the I-Am replies keep to the announce options" << std::endl;
+	std::cout << "                                       cov: SubscribeCOV to every Analog Input, then count the notifications for --duration" << std::endl;
+	std::cout << "                                       replay: send the requests of a capture, see --replay" << std::endl;
+	std::cout << "  --duration <seconds>               Length of the run (default 10)" << std::endl;
+	std::cout << "  --concurrency <count>              Requests waiting for a reply at any time, max " << MAX_CONCURRENCY << " (default 16)" << std::endl;
+	std::cout << "  --rate <requests/s>                Max request rate, 0 for no limit (default 0)" << std::endl;
+	std::cout << "  --timeout-ms <ms>                  Time to wait for a reply (default 2000)" << std::endl;
+	std::cout << "  --mix <whois=n,rp=n,rpm=n>         Weights of the requests of the discovered scenario (default rp=8,rpm=2)" << std::endl;
+	std::cout << "  --rpm-objects <count>              Analog Inputs read by one ReadPropertyMultiple (default 50)" << std::endl;
+	std::cout << "  --seed <number>                    Seed of the request mix, the same seed sends the same requests (default 1)" << std::endl;
+	std::cout << "  --listen-broadcast <ip|auto|off>   Also hear the I-Am broadcasts on this address (default off)" << std::endl;
+	std::cout << "  --discovery-timeout <seconds>      Time to wait for every device to answer the Who-Is (default 60)" << std::endl;
+	std::cout << "  --format <text|csv|json>           Report format (default text)" << std::endl;
+	std::cout << "  --output <file>                    Append the report to a file instead of the console" << std::endl;
+	std::cout << "  --label <text>                     Copied to the report, eg. the server version" << std::endl;
+	std::cout << "  --record <file>                    Capture all sent and received packets to a pcap file" << std::endl;
+	std::cout << "  --replay <file>                    Send the requests to --port found in a pcap capture" << std::endl;
+	std::cout << "  --replay-speed <factor>            1 keeps the captured timing, 0 sends as fast as --concurrency allows (default 1)" << std::endl;
+	std::cout << "  --announce-rate <packets/s>        The server's announce options, checked by the announce scenario (default " << DEFAULT_ANNOUNCE_RATE << ")" << std::endl;
+	std::cout << "  --announce-burst <count>           (default " << DEFAULT_ANNOUNCE_BURST << ")" << std::endl;
+	std::cout << "  --announce-jitter <percent>        (default " << DEFAULT_ANNOUNCE_JITTER << ")" << std::endl;
+	std::cout << "The topology options of the server (--networks, --devices-per-network, --analog-inputs-per-device, ...)" << std::endl;
+	std::cout << "must match the server." << std::endl;
+	std::cout << std::endl;
+}
+
+// Binds a second socket to the broadcast address so that the I-Am broadcasts of the server are heard
+bool ConnectListener()
+{
+	if (g_options.listenBroadcast == "off") {
+		return false;
+	}
+	std::string address = g_options.listenBroadcast;
+	if (address == "auto") {
+		char broadcastIPAddress[32];
+		if (g_udp.GetBroadcastIPAddress(broadcastIPAddress, sizeof(broadcastIPAddress)) <= 0) {
+			std::cerr << "Could not find the broadcast address, see --listen-broadcast" << std::endl;
+			return false;
+		}
+		address = broadcastIPAddress;
+	}
+
+	g_listener.SetEventMode(true, UDP_RECEIVE_RING_SIZE);
+	if (!g_listener.Connect(g_options.port, true, address.c_str())) {
+		std::cerr << "Failed to listen for I-Am broadcasts on [" << address << ":" << g_options.port << "]" << std::endl;
+		return false;
+	}
+	std::cout << "FYI: Listening for I-Am broadcasts on [" << address << ":" << g_options.port << "]" << std::endl;
+	return true;
+}
+
+// The virtual devices the server has with the same topology options
+void BuildDevices()
+{
+	g_devices.clear();
+	g_deviceIndex.clear();
+	g_devices.reserve(g_topology.GetNumberOfDevices());
+	for (uint32_t networkIndex = 0; networkIndex < g_topology.numberOfNetworks; networkIndex++) {
+		for (uint32_t deviceIndex = 0; deviceIndex < g_topology.devicesPerNetwork; deviceIndex++) {
+			LoadGeneratorDevice device;
+			device.instance = g_topology.GetDeviceInstance(networkIndex, deviceIndex);
+			device.address.network = (uint16_t)g_topology.GetNetwork(networkIndex);
+			device.address.macLength = 0;
+			device.discovered = false;
+			g_deviceIndex[device.instance] = g_devices.size();
+			g_devices.push_back(device);
+		}
+	}
+	g_nextDevice = 0;
+	g_nextObject = 1;
+}
+
+// Sends a global Who-Is and waits for the I-Am of every expected device. When measuring, the
+// time from the first Who-Is to each I-Am is recorded as a discovery.
+bool Discover(const bool measure)
+{
+	size_t expected = g_devices.size();
+	if (measure) {
+		for (size_t offset = 0; offset < expected; offset++) {
+			g_results.RecordSent(LoadGeneratorResults::OPERATION_DISCOVERY);
+		}
+	}
+
+	uint8_t message[LoadGeneratorMessages::MAX_MESSAGE_LENGTH];
+	uint16_t length = LoadGeneratorMessages::EncodeWhoIs(message, sizeof(message), false, 0, 0);
+	g_discovering = measure;
+	g_discoveryStart = Clock::now();
+	Clock::time_point endTime = g_discoveryStart + std::chrono::seconds(g_options.discoveryTimeoutSeconds);
+	Clock::time_point nextWhoIs = g_discoveryStart;
+	size_t discovered = 0;
+	while (discovered < expected) {
+		Clock::time_point now = Clock::now();
+		if (now >= endTime) {
+			break;
+		}
+		// Repeat the Who-Is until the server starts answering, it may still be starting up
+		if (discovered == 0 && now >= nextWhoIs) {
+			SendMessage(message, length);
+			g_udp.FlushMessages();
+			nextWhoIs = now + std::chrono::milliseconds(WHO_IS_RETRY_MS);
+		}
+		g_udp.WaitForMessage(IDLE_WAIT_MS);
+		ProcessReceived();
+
+		discovered = 0;
+		for (size_t offset = 0; offset < expected; offset++) {
+			discovered += g_devices[offset].discovered ? 1 : 0;
+		}
+	}
+	g_discovering = false;
+
+	std::cout << "FYI: Discovered " << discovered << " of " << expected << " virtual devices in " << GetElapsedNs(g_discoveryStart, Clock::now()) / 1000000 << " ms" << std::endl;
+	if (measure) {
+		for (size_t offset = discovered; offset < expected; offset++) {
+			g_results.RecordTimeout(LoadGeneratorResults::OPERATION_DISCOVERY);
+		}
+		return true;
+	}
+	if (discovered == 0) {
+		std::cerr << "No virtual device answered the Who-Is. Is the server running with the same topology options?" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Checks the I-Am found by Discover() against the announce options. The server sends up to
+// --announce-burst back to back after being idle, then one every 1/--announce-rate seconds
+// with each gap shortened or stretched by up to --announce-jitter percent.
+bool CheckAnnounceRate()
+{
+	if (g_options.announceRate == 0) {
+		std::cout << "FYI: The announce rate is not limited, nothing to check" << std::endl;
+		return true;
+	}
+	size_t count = g_discoveryTimes.size();
+	size_t burst = g_options.announceBurst;
+	if (count < burst + 2) {
+		std::cerr << "Only " << count << " I-Am received, at least " << burst + 2 << " are needed to check the announce rate" << std::endl;
+		return false;
+	}
+
+	// Average rate after the first burst
+	double seconds = (double)GetElapsedNs(g_discoveryTimes[burst], g_discoveryTimes[count - 1]) / 1e9;
+	double rate = seconds > 0 ? (double)(count - 1 - burst) / seconds : 0;
+
+	// Largest burst above the fastest allowed rate: the most I-Am received in any time window,
+	// less the number that rate allows in that window
+	double fastestRate = g_options.announceJitter < 100 ? g_options.announceRate / (1.0 - g_options.announceJitter / 100.0) : 0;
+	double largestBurst = 1;
+	if (fastestRate > 0) {
+		double lowest = 0; // Lowest offset - fastestRate * time of the I-Am so far
+		for (size_t offset = 0; offset < count; offset++) {
+			double position = (double)offset - fastestRate * (double)GetElapsedNs(g_discoveryTimes[0], g_discoveryTimes[offset]) / 1e9;
+			if (position < lowest) {
+				lowest = position;
+			}
+			if (position - lowest + 1 > largestBurst) {
+				largestBurst = position - lowest + 1;
+			}
+		}
+	}
+
+	bool rateOk = rate == 0 || rate <= g_options.announceRate * (1.0 + ANNOUNCE_RATE_TOLERANCE);
+	bool burstOk = fastestRate == 0 || largestBurst <= (double)burst + 1; // One more for timing on this side
+	std::cout << "FYI: I-Am rate=[" << rate << "/s], limit=[" << g_options.announceRate << "/s], burst=[" << largestBurst << "], limit=[" << burst << "]" << std::endl;
+	if (!rateOk) {
+		std::cerr << "The I-Am came faster than --announce-rate " << g_options.announceRate << std::endl;
+	}
+	if (!burstOk) {
+		std::cerr << "The I-Am came in larger bursts than --announce-burst " << burst << std::endl;
+	}
+	return rateOk && burstOk;
+}
+
+// cov: takes the notifications until the end time. Nothing is sent.
+void ReceiveNotifications(const Clock::time_point endTime)
+{
+	g_countNotifications = true;
+	while (Clock::now() < endTime) {
+		g_udp.WaitForMessage(IDLE_WAIT_MS);
+		ProcessReceived();
+	}
+	g_countNotifications = false;
+	std::cout << "FYI: Received " << g_results.operations[LoadGeneratorResults::OPERATION_COV_NOTIFICATION].completed << " COV notifications" << std::endl;
+}
+
+// Sends requests from sendNext until the end time or until the scenario is done, then waits
+// for the replies that are still outstanding. sendEndTime is when the sending stopped, the
+// throughput is measured up to then.
+bool RunLoad(SendNextFunction sendNext, const Clock::time_point endTime, Clock::time_point* sendEndTime)
+{
+	std::chrono::nanoseconds interval(g_options.rate > 0 ? 1000000000LL / g_options.rate : 0);
+	Clock::time_point nextSend = Clock::now();
+	bool done = false;
+	for (;;) {
+		Clock::time_point now = Clock::now();
+		ProcessReceived();
+		CheckTimeouts(now);
+		if (done || now >= endTime) {
+			if (!done) {
+				*sendEndTime = now;
+				done = true;
+			}
+			if (g_outstanding == 0) {
+				break;
+			}
+		}
+		else {
+			// Do not make up for time lost while the concurrency limit was reached
+			if (g_options.rate > 0 && nextSend + std::chrono::seconds(1) < now) {
+				nextSend = now;
+			}
+			while (g_outstanding < g_options.concurrency && (g_options.rate == 0 || nextSend <= now)) {
+				SendResult result = sendNext();
+				if (result == SEND_RESULT_DONE) {
+					*sendEndTime = now;
+					done = true;
+					break;
+				}
+				if (result == SEND_RESULT_BLOCKED) {
+					break;
+				}
+				nextSend += interval;
+			}
+			g_udp.FlushMessages();
+		}
+		g_udp.WaitForMessage(IDLE_WAIT_MS);
+	}
+	return true;
+}
+
+// Picks the next discovered device in turn
+LoadGeneratorDevice* GetNextDevice()
+{
+	for (size_t count = 0; count < g_devices.size(); count++) {
+		LoadGeneratorDevice & device = g_devices[g_nextDevice];
+		g_nextDevice = (g_nextDevice + 1) % g_devices.size();
+		if (device.discovered) {
+			return &device;
+		}
+	}
+	return NULL;
+}
+
+// discovered: the request mix, sent to the devices in turn
+SendResult SendNextMixed()
+{
+	LoadGeneratorDevice* device = GetNextDevice();
+	if (device == NULL) {
+		return SEND_RESULT_DONE;
+	}
+
+	uint32_t whoIsWeight = g_options.whoIsWeight;
+	uint32_t totalWeight = whoIsWeight + g_options.readPropertyWeight + g_options.readPropertyMultipleWeight;
+	if (totalWeight == 0) {
+		return SEND_RESULT_DONE;
+	}
+	uint32_t pick = std::uniform_int_distribution<uint32_t>(0, totalWeight - 1)(g_random);
+
+	uint8_t message[LoadGeneratorMessages::MAX_MESSAGE_LENGTH];
+	if (pick < whoIsWeight && g_pendingWhoIs.find(device->instance) == g_pendingWhoIs.end()) {
+		uint16_t length = LoadGeneratorMessages::EncodeWhoIs(message, sizeof(message), true, device->instance, device->instance);
+		SendMessage(message, length);
+		g_pendingWhoIs[device->instance] = Clock::now();
+		g_outstanding++;
+		g_results.RecordSent(LoadGeneratorResults::OPERATION_WHO_IS);
+		return SEND_RESULT_SENT;
+	}
+
+	uint8_t invokeId;
+	if (!AllocateInvokeId(&invokeId)) {
+		return SEND_RESULT_BLOCKED;
+	}
+	uint16_t length;
+	LoadGeneratorResults::Operation operation;
+	uint32_t analogInputs = g_topology.analogInputsPerDevice;
+	if (pick < whoIsWeight + g_options.readPropertyWeight || analogInputs == 0) {
+		// Present value of one Analog Input, or the device name when there are none
+		operation = LoadGeneratorResults::OPERATION_READ_PROPERTY;
+		if (analogInputs > 0) {
+			uint32_t objectInstance = std::uniform_int_distribution<uint32_t>(1, analogInputs)(g_random);
+			length = LoadGeneratorMessages::EncodeReadProperty(message, sizeof(message), device->address, invokeId, LoadGeneratorMessages::OBJECT_TYPE_ANALOG_INPUT, objectInstance, LoadGeneratorMessages::PROPERTY_IDENTIFIER_PRESENT_VALUE);
+		}
+		else {
+			length = LoadGeneratorMessages::EncodeReadProperty(message, sizeof(message), device->address, invokeId, LoadGeneratorMessages::OBJECT_TYPE_DEVICE, device->instance, LoadGeneratorMessages::PROPERTY_IDENTIFIER_OBJECT_NAME);
+		}
+	}
+	else {
+		// Present value of the first Analog Inputs of the device
+		operation = LoadGeneratorResults::OPERATION_READ_PROPERTY_MULTIPLE;
+		uint32_t objectInstances[100];
+		uint32_t objectCount = analogInputs < g_options.rpmObjects ? analogInputs : g_options.rpmObjects;
+		for (uint32_t offset = 0; offset < objectCount; offset++) {
+			objectInstances[offset] = offset + 1;
+		}
+		length = LoadGeneratorMessages::EncodeReadPropertyMultiple(message, sizeof(message), device->address, invokeId, LoadGeneratorMessages::OBJECT_TYPE_ANALOG_INPUT, objectInstances, objectCount, LoadGeneratorMessages::PROPERTY_IDENTIFIER_PRESENT_VALUE);
+	}
+	if (length == 0) {
+		g_freeInvokeIds.push_front(invokeId);
+		return SEND_RESULT_DONE;
+	}
+	SendMessage(message, length);
+	TrackRequest(invokeId, operation);
+	return SEND_RESULT_SENT;
+}
+
+// rpm-all-ai: every Analog Input of every device, --rpm-objects at a time, over and over
+SendResult SendNextAllAnalogInputs()
+{
+	uint32_t analogInputs = g_topology.analogInputsPerDevice;
+	if (analogInputs == 0) {
+		std::cerr << "The rpm-all-ai scenario needs Analog Inputs, see --analog-inputs-per-device" << std::endl;
+		return SEND_RESULT_DONE;
+	}
+	if (g_nextObject == 1 && GetNextDevice() == NULL) {
+		return SEND_RESULT_DONE;
+	}
+	// GetNextDevice() moved on already, the device being read is the one before
+	LoadGeneratorDevice & device = g_devices[(g_nextDevice + g_devices.size() - 1) % g_devices.size()];
+
+	uint8_t invokeId;
+	if (!AllocateInvokeId(&invokeId)) {
+		return SEND_RESULT_BLOCKED;
+	}
+	uint32_t objectInstances[100];
+	uint32_t objectCount = 0;
+	for (; objectCount < g_options.rpmObjects && g_nextObject <= analogInputs; objectCount++) {
+		objectInstances[objectCount] = g_nextObject++;
+	}
+	if (g_nextObject > analogInputs) {
+		g_nextObject = 1;
+	}
+
+	uint8_t message[LoadGeneratorMessages::MAX_MESSAGE_LENGTH];
+	uint16_t length = LoadGeneratorMessages::EncodeReadPropertyMultiple(message, sizeof(message), device.address, invokeId, LoadGeneratorMessages::OBJECT_TYPE_ANALOG_INPUT, objectInstances, objectCount, LoadGeneratorMessages::PROPERTY_IDENTIFIER_PRESENT_VALUE);
+	if (length == 0) {
+		g_freeInvokeIds.push_front(invokeId);
+		return SEND_RESULT_DONE;
+	}
+	SendMessage(message, length);
+	TrackRequest(invokeId, LoadGeneratorResults::OPERATION_READ_PROPERTY_MULTIPLE);
+	return SEND_RESULT_SENT;
+}
+
+// cold-start: the name of each discovered device, once
+SendResult SendNextObjectName()
+{
+	while (g_nextDevice < g_devices.size() && !g_devices[g_nextDevice].discovered) {
+		g_nextDevice++;
+	}
+	if (g_nextDevice >= g_devices.size()) {
+		return SEND_RESULT_DONE;
+	}
+	const LoadGeneratorDevice & device = g_devices[g_nextDevice];
+
+	uint8_t invokeId;
+	if (!AllocateInvokeId(&invokeId)) {
+		return SEND_RESULT_BLOCKED;
+	}
+	uint8_t message[LoadGeneratorMessages::MAX_MESSAGE_LENGTH];
+	uint16_t length = LoadGeneratorMessages::EncodeReadProperty(message, sizeof(message), device.address, invokeId, LoadGeneratorMessages::OBJECT_TYPE_DEVICE, device.instance, LoadGeneratorMessages::PROPERTY_IDENTIFIER_OBJECT_NAME);
+	g_nextDevice++;
+	SendMessage(message, length);
+	TrackRequest(invokeId, LoadGeneratorResults::OPERATION_READ_PROPERTY);
+	return SEND_RESULT_SENT;
+}
+
+// cov: one SubscribeCOV for every Analog Input of every discovered device, once
+SendResult SendNextSubscribeCOV()
+{
+	uint32_t analogInputs = g_topology.analogInputsPerDevice;
+	if (analogInputs == 0) {
+		std::cerr << "The cov scenario needs Analog Inputs, see --analog-inputs-per-device" << std::endl;
+		return SEND_RESULT_DONE;
+	}
+	while (g_nextDevice < g_devices.size() && !g_devices[g_nextDevice].discovered) {
+		g_nextDevice++;
+	}
+	if (g_nextDevice >= g_devices.size()) {
+		return SEND_RESULT_DONE;
+	}
+	const LoadGeneratorDevice & device = g_devices[g_nextDevice];
+
+	uint8_t invokeId;
+	if (!AllocateInvokeId(&invokeId)) {
+		return SEND_RESULT_BLOCKED;
+	}
+	uint8_t message[LoadGeneratorMessages::MAX_MESSAGE_LENGTH];
+	uint16_t length = LoadGeneratorMessages::EncodeSubscribeCOV(message, sizeof(message), device.address, invokeId, COV_SUBSCRIBER_PROCESS_ID, LoadGeneratorMessages::OBJECT_TYPE_ANALOG_INPUT, g_nextObject, g_options.durationSeconds + COV_LIFETIME_MARGIN_SECONDS);
+	if (++g_nextObject > analogInputs) {
+		g_nextObject = 1;
+		g_nextDevice++;
+	}
+	SendMessage(message, length);
+	TrackRequest(invokeId, LoadGeneratorResults::OPERATION_SUBSCRIBE_COV);
+	return SEND_RESULT_SENT;
+}
+
+// replay: the captured requests with their captured timing. Confirmed requests get a new
+// invoke id so that their replies can be timed.
+SendResult SendNextReplay()
+{
+	if (g_replayNext >= g_replayPackets.size()) {
+		return SEND_RESULT_DONE;
+	}
+	LoadGeneratorReplayPacket & packet = g_replayPackets[g_replayNext];
+	if (g_options.replaySpeed > 0) {
+		uint64_t offsetUs = (uint64_t)((double)(packet.timestampUs - g_replayPackets[0].timestampUs) / g_options.replaySpeed);
+		if (Clock::now() < g_replayStart + std::chrono::microseconds(offsetUs)) {
+			return SEND_RESULT_BLOCKED;
+		}
+	}
+
+	uint16_t apduOffset;
+	LoadGeneratorAddress source;
+	bool hasSource;
+	uint8_t* message = &packet.data[0];
+	uint16_t length = (uint16_t)packet.data.size();
+	LoadGeneratorMessages::FindAPDU(message, length, &apduOffset, &source, &hasSource);
+	uint8_t pduType = message[apduOffset] >> 4;
+	if (pduType == LoadGeneratorMessages::APDU_TYPE_CONFIRMED_REQUEST) {
+		uint8_t invokeId;
+		if (!AllocateInvokeId(&invokeId)) {
+			return SEND_RESULT_BLOCKED;
+		}
+		message[apduOffset + 2] = invokeId;
+		uint8_t service = message[apduOffset + 3];
+		LoadGeneratorResults::Operation operation = LoadGeneratorResults::OPERATION_OTHER;
+		if (service == LoadGeneratorMessages::SERVICE_CONFIRMED_READ_PROPERTY) {
+			operation = LoadGeneratorResults::OPERATION_READ_PROPERTY;
+		}
+		else if (service == LoadGeneratorMessages::SERVICE_CONFIRMED_READ_PROPERTY_MULTIPLE) {
+			operation = LoadGeneratorResults::OPERATION_READ_PROPERTY_MULTIPLE;
+		}
+		else if (service == LoadGeneratorMessages::SERVICE_CONFIRMED_SUBSCRIBE_COV) {
+			operation = LoadGeneratorResults::OPERATION_SUBSCRIBE_COV;
+		}
+		SendMessage(message, length);
+		TrackRequest(invokeId, operation);
+	}
+	else {
+		// Unconfirmed requests are counted as sent, there is nothing to time
+		SendMessage(message, length);
+		g_results.RecordSent(message[apduOffset + 1] == LoadGeneratorMessages::SERVICE_UNCONFIRMED_WHO_IS ? LoadGeneratorResults::OPERATION_WHO_IS : LoadGeneratorResults::OPERATION_OTHER);
+	}
+	g_replayNext++;
+	return SEND_RESULT_SENT;
+}
+
+// Reads the requests sent to the server port from a capture. Replies, I-Am and I-Have are left out,
+// as are segmented requests because the load generator does not take part in segmentation.
+bool LoadReplay(const std::string & path)
+{
+	ExamplePcapReader reader;
+	if (!reader.Open(path)) {
+		std::cerr << "Failed to read the capture file [" << path << "]" << std::endl;
+		return false;
+	}
+
+	uint64_t timestampUs;
+	uint8_t sourceAddress[4], destinationAddress[4];
+	uint16_t sourcePort, destinationPort, length;
+	uint8_t data[LoadGeneratorMessages::MAX_MESSAGE_LENGTH];
+	while (reader.Read(&timestampUs, sourceAddress, &sourcePort, destinationAddress, &destinationPort, data, sizeof(data), &length)) {
+		uint16_t apduOffset;
+		LoadGeneratorAddress source;
+		bool hasSource;
+		if (destinationPort != g_options.port || !LoadGeneratorMessages::FindAPDU(data, length, &apduOffset, &source, &hasSource)) {
+			continue;
+		}
+		uint8_t pduType = data[apduOffset] >> 4;
+		if (pduType == LoadGeneratorMessages::APDU_TYPE_CONFIRMED_REQUEST) {
+			if ((data[apduOffset] & 0x08) != 0 || apduOffset + 4 > length) {
+				continue; // Segmented
+			}
+		}
+		else if (pduType == LoadGeneratorMessages::APDU_TYPE_UNCONFIRMED_REQUEST) {
+			if (apduOffset + 2 > length || data[apduOffset + 1] == LoadGeneratorMessages::SERVICE_UNCONFIRMED_I_AM || data[apduOffset + 1] == LoadGeneratorMessages::SERVICE_UNCONFIRMED_I_HAVE) {
+				continue;
+			}
+		}
+		else {
+			continue;
+		}
+
+		LoadGeneratorReplayPacket packet;
+		packet.timestampUs = timestampUs;
+		packet.data.assign(data, data + length);
+		g_replayPackets.push_back(packet);
+	}
+
+	if (g_replayPackets.empty()) {
+		std::cerr << "No requests to port " << g_options.port << " in the capture file [" << path << "]" << std::endl;
+		return false;
+	}
+	std::cout << "FYI: Replaying " << g_replayPackets.size() << " requests from [" << path << "], speed=[" << g_options.replaySpeed << "]" << std::endl;
+	return true;
+}
+
+void SendMessage(const uint8_t* message, const uint16_t length)
+{
+	if (length == 0) {
+		return;
+	}
+	if (!g_udp.QueueMessage(g_serverIPAddress, g_options.port, message, length)) {
+		// The queue is full, send what is queued and try again
+		g_udp.FlushMessages();
+		g_udp.QueueMessage(g_serverIPAddress, g_options.port, message, length);
+	}
+	RecordPacket(true, message, length);
+	g_results.bytesSent += length;
+}
+
+// Takes everything received on both sockets
+void ProcessReceived()
+{
+	uint8_t message[LoadGeneratorMessages::MAX_MESSAGE_LENGTH];
+	int length;
+	while ((length = g_udp.GetMessage(message, sizeof(message), NULL)) > 0) {
+		RecordPacket(false, message, (uint16_t)length);
+		g_results.bytesReceived += (uint64_t)length;
+		ProcessMessage(message, (uint16_t)length, Clock::now());
+	}
+	if (g_listener.IsConnected()) {
+		while ((length = g_listener.GetMessage(message, sizeof(message), NULL)) > 0) {
+			RecordPacket(false, message, (uint16_t)length);
+			g_results.bytesReceived += (uint64_t)length;
+			ProcessMessage(message, (uint16_t)length, Clock::now());
+		}
+	}
+}
+
+void ProcessMessage(const uint8_t* message, const uint16_t length, const Clock::time_point now)
+{
+	LoadGeneratorReply reply;
+	if (!LoadGeneratorMessages::DecodeReply(message, length, &reply)) {
+		return;
+	}
+
+	if (reply.pduType == LoadGeneratorMessages::APDU_TYPE_UNCONFIRMED_REQUEST) {
+		if (reply.service == LoadGeneratorMessages::SERVICE_UNCONFIRMED_COV_NOTIFICATION && g_countNotifications) {
+			g_results.RecordReceived(LoadGeneratorResults::OPERATION_COV_NOTIFICATION);
+			return;
+		}
+		if (reply.service != LoadGeneratorMessages::SERVICE_UNCONFIRMED_I_AM) {
+			return;
+		}
+		std::map<uint32_t, size_t>::const_iterator deviceIt = g_deviceIndex.find(reply.deviceInstance);
+		if (deviceIt == g_deviceIndex.end()) {
+			return; // The main device or a device of another server
+		}
+		LoadGeneratorDevice & device = g_devices[deviceIt->second];
+		if (!device.discovered) {
+			// The I-Am of a virtual device is routed from its virtual network
+			if (reply.hasSource) {
+				device.address = reply.source;
+			}
+			else {
+				device.address.network = 0;
+				device.address.macLength = 0;
+			}
+			device.discovered = true;
+			if (g_discovering) {
+				g_results.RecordCompleted(LoadGeneratorResults::OPERATION_DISCOVERY, GetElapsedNs(g_discoveryStart, now), false);
+				g_discoveryTimes.push_back(now);
+			}
+		}
+		std::map<uint32_t, Clock::time_point>::iterator whoIsIt = g_pendingWhoIs.find(reply.deviceInstance);
+		if (whoIsIt != g_pendingWhoIs.end()) {
+			g_results.RecordCompleted(LoadGeneratorResults::OPERATION_WHO_IS, GetElapsedNs(whoIsIt->second, now), false);
+			g_pendingWhoIs.erase(whoIsIt);
+			g_outstanding--;
+		}
+		return;
+	}
+
+	// Replies to confirmed requests
+	LoadGeneratorPendingRequest & pending = g_pending[reply.invokeId];
+	if (!pending.active) {
+		return; // Late reply to a request that timed out
+	}
+	bool error = reply.pduType == LoadGeneratorMessages::APDU_TYPE_ERROR ||
+		reply.pduType == LoadGeneratorMessages::APDU_TYPE_REJECT ||
+		reply.pduType == LoadGeneratorMessages::APDU_TYPE_ABORT ||
+		reply.segmented;
+	g_results.RecordCompleted(pending.operation, GetElapsedNs(pending.sentTime, now), error);
+	pending.active = false;
+	g_freeInvokeIds.push_back(reply.invokeId);
+	g_outstanding--;
+}
+
+void CheckTimeouts(const Clock::time_point now)
+{
+	std::chrono::milliseconds timeout(g_options.timeoutMs);
+	for (uint32_t invokeId = 0; invokeId < 256; invokeId++) {
+		LoadGeneratorPendingRequest & pending = g_pending[invokeId];
+		if (pending.active && now - pending.sentTime > timeout) {
+			g_results.RecordTimeout(pending.operation);
+			pending.active = false;
+			g_freeInvokeIds.push_back((uint8_t)invokeId);
+			g_outstanding--;
+		}
+	}
+	for (std::map<uint32_t, Clock::time_point>::iterator it = g_pendingWhoIs.begin(); it != g_pendingWhoIs.end();) {
+		if (now - it->second > timeout) {
+			g_results.RecordTimeout(LoadGeneratorResults::OPERATION_WHO_IS);
+			g_pendingWhoIs.erase(it++);
+			g_outstanding--;
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+bool AllocateInvokeId(uint8_t* invokeId)
+{
+	if (g_freeInvokeIds.empty()) {
+		return false;
+	}
+	*invokeId = g_freeInvokeIds.front();
+	g_freeInvokeIds.pop_front();
+	return true;
+}
+
+void TrackRequest(const uint8_t invokeId, const LoadGeneratorResults::Operation operation)
+{
+	LoadGeneratorPendingRequest & pending = g_pending[invokeId];
+	pending.active = true;
+	pending.operation = operation;
+	pending.sentTime = Clock::now();
+	g_outstanding++;
+	g_results.RecordSent(operation);
+}
+
+// The local end is written as 0.0.0.0:0, only the server end of the packets matters for a replay
+void RecordPacket(const bool sent, const uint8_t* message, const uint16_t length)
+{
+	if (!g_record.IsOpen()) {
+		return;
+	}
+	static const uint8_t LOCAL_IP_ADDRESS[4] = { 0, 0, 0, 0 };
+	uint64_t timestampUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	if (sent) {
+		g_record.Write(timestampUs, LOCAL_IP_ADDRESS, 0, g_serverIPAddress, g_options.port, message, length);
+	}
+	else {
+		g_record.Write(timestampUs, g_serverIPAddress, g_options.port, LOCAL_IP_ADDRESS, 0, message, length);
+	}
+}
+
+// Writes the results in the chosen format. Reports written to a file are appended, so a file
+// collects the runs of several releases. The CSV header is only written to a new file.
+bool WriteReport()
+{
+	if (g_options.output.empty()) {
+		if (g_options.format == "csv") {
+			g_results.WriteCSV(std::cout, true);
+		}
+		else if (g_options.format == "json") {
+			g_results.WriteJSON(std::cout);
+		}
+		else {
+			g_results.WriteText(std::cout);
+		}
+		return true;
+	}
+
+	bool isNewFile;
+	{
+		std::ifstream existing(g_options.output.c_str());
+		isNewFile = !existing.is_open() || existing.peek() == std::ifstream::traits_type::eof();
+	}
+	std::ofstream file(g_options.output.c_str(), std::ios::app);
+	if (!file.is_open()) {
+		std::cerr << "Failed to open the report file [" << g_options.output << "]" << std::endl;
+		return false;
+	}
+	if (g_options.format == "csv") {
+		g_results.WriteCSV(file, isNewFile);
+	}
+	else if (g_options.format == "json") {
+		g_results.WriteJSON(file);
+	}
+	else {
+		g_results.WriteText(file);
+	}
+	g_results.WriteText(std::cout);
+	return true;
+}
+
+uint64_t GetElapsedNs(const Clock::time_point start, const Clock::time_point end)
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
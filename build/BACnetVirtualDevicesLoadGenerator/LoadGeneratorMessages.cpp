@@ -0,0 +1,286 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * LoadGeneratorMessages.cpp
+ *
+ * BACnet/IP request encoding and reply decoding for the load generator.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#include "LoadGeneratorMessages.h"
+
+#include <string.h>
+
+static const uint8_t BVLL_TYPE_BACNET_IP = 0x81;
+static const uint8_t BVLL_FUNCTION_FORWARDED_NPDU = 0x04;
+static const uint8_t BVLL_FUNCTION_ORIGINAL_UNICAST_NPDU = 0x0A;
+static const uint8_t BVLL_FUNCTION_ORIGINAL_BROADCAST_NPDU = 0x0B;
+static const uint8_t BVLL_HEADER_LENGTH = 4;
+
+static const uint8_t NPDU_VERSION = 0x01;
+static const uint8_t NPDU_CONTROL_NETWORK_MESSAGE = 0x80;
+static const uint8_t NPDU_CONTROL_DESTINATION = 0x20;
+static const uint8_t NPDU_CONTROL_SOURCE = 0x08;
+static const uint8_t NPDU_CONTROL_EXPECTING_REPLY = 0x04;
+static const uint8_t NPDU_HOP_COUNT = 0xFF;
+
+static const uint8_t APDU_MAX_SEGMENTS_NONE_MAX_APDU_1476 = 0x05;
+static const uint8_t APDU_FLAG_SEGMENTED = 0x08;
+static const uint8_t APPLICATION_TAG_OBJECT_IDENTIFIER = 0xC4;
+static const uint8_t CONTEXT_TAG_2_BOOLEAN_FALSE = 0x29; // One byte long, the value follows
+
+// Writes a context tagged unsigned value with the fewest bytes
+static bool EncodeContextUnsigned(uint8_t* buffer, const uint16_t maxLength, uint16_t* offset, const uint8_t tagNumber, const uint32_t value)
+{
+	uint8_t length = value <= 0xFF ? 1 : value <= 0xFFFF ? 2 : value <= 0xFFFFFF ? 3 : 4;
+	if (*offset + 1 + length > maxLength) {
+		return false;
+	}
+	buffer[(*offset)++] = (uint8_t)((tagNumber << 4) | 0x08 | length);
+	for (int8_t shift = (int8_t)((length - 1) * 8); shift >= 0; shift -= 8) {
+		buffer[(*offset)++] = (uint8_t)(value >> shift);
+	}
+	return true;
+}
+
+static bool EncodeContextObjectIdentifier(uint8_t* buffer, const uint16_t maxLength, uint16_t* offset, const uint8_t tagNumber, const uint16_t objectType, const uint32_t objectInstance)
+{
+	if (*offset + 5 > maxLength) {
+		return false;
+	}
+	uint32_t objectIdentifier = ((uint32_t)objectType << 22) | (objectInstance & LoadGeneratorMessages::MAX_INSTANCE);
+	buffer[(*offset)++] = (uint8_t)((tagNumber << 4) | 0x08 | 4);
+	buffer[(*offset)++] = (uint8_t)(objectIdentifier >> 24);
+	buffer[(*offset)++] = (uint8_t)(objectIdentifier >> 16);
+	buffer[(*offset)++] = (uint8_t)(objectIdentifier >> 8);
+	buffer[(*offset)++] = (uint8_t)objectIdentifier;
+	return true;
+}
+
+// BVLL and NPDU headers. The BVLL length is filled in by FinishMessage().
+static bool EncodeHeaders(uint8_t* buffer, const uint16_t maxLength, uint16_t* offset, const LoadGeneratorAddress* destination, const bool expectingReply)
+{
+	if (maxLength < BVLL_HEADER_LENGTH + 2 + 4 + LOAD_GENERATOR_MAX_MAC_LENGTH) {
+		return false;
+	}
+	buffer[0] = BVLL_TYPE_BACNET_IP;
+	buffer[1] = BVLL_FUNCTION_ORIGINAL_UNICAST_NPDU;
+	*offset = BVLL_HEADER_LENGTH;
+
+	buffer[(*offset)++] = NPDU_VERSION;
+	uint8_t control = expectingReply ? NPDU_CONTROL_EXPECTING_REPLY : 0;
+	if (destination == NULL || destination->network == 0) {
+		buffer[(*offset)++] = control;
+		return true;
+	}
+	buffer[(*offset)++] = control | NPDU_CONTROL_DESTINATION;
+	buffer[(*offset)++] = (uint8_t)(destination->network >> 8);
+	buffer[(*offset)++] = (uint8_t)(destination->network & 0xFF);
+	uint8_t macLength = destination->macLength <= LOAD_GENERATOR_MAX_MAC_LENGTH ? destination->macLength : LOAD_GENERATOR_MAX_MAC_LENGTH;
+	buffer[(*offset)++] = macLength;
+	memcpy(buffer + *offset, destination->mac, macLength);
+	*offset += macLength;
+	buffer[(*offset)++] = NPDU_HOP_COUNT;
+	return true;
+}
+
+static uint16_t FinishMessage(uint8_t* buffer, const uint16_t length)
+{
+	buffer[2] = (uint8_t)(length >> 8);
+	buffer[3] = (uint8_t)(length & 0xFF);
+	return length;
+}
+
+uint16_t LoadGeneratorMessages::EncodeWhoIs(uint8_t* buffer, const uint16_t maxLength, const bool useLimits, const uint32_t lowLimit, const uint32_t highLimit) {
+	LoadGeneratorAddress destination;
+	destination.network = GLOBAL_BROADCAST_NETWORK;
+	destination.macLength = 0;
+
+	uint16_t offset;
+	if (!EncodeHeaders(buffer, maxLength, &offset, &destination, false) || offset + 2 > maxLength) {
+		return 0;
+	}
+	buffer[offset++] = APDU_TYPE_UNCONFIRMED_REQUEST << 4;
+	buffer[offset++] = SERVICE_UNCONFIRMED_WHO_IS;
+	if (useLimits) {
+		if (!EncodeContextUnsigned(buffer, maxLength, &offset, 0, lowLimit) ||
+			!EncodeContextUnsigned(buffer, maxLength, &offset, 1, highLimit)) {
+			return 0;
+		}
+	}
+	return FinishMessage(buffer, offset);
+}
+
+uint16_t LoadGeneratorMessages::EncodeReadProperty(uint8_t* buffer, const uint16_t maxLength, const LoadGeneratorAddress & destination, const uint8_t invokeId, const uint16_t objectType, const uint32_t objectInstance, const uint32_t propertyIdentifier) {
+	uint16_t offset;
+	if (!EncodeHeaders(buffer, maxLength, &offset, &destination, true) || offset + 4 > maxLength) {
+		return 0;
+	}
+	buffer[offset++] = APDU_TYPE_CONFIRMED_REQUEST << 4;
+	buffer[offset++] = APDU_MAX_SEGMENTS_NONE_MAX_APDU_1476;
+	buffer[offset++] = invokeId;
+	buffer[offset++] = SERVICE_CONFIRMED_READ_PROPERTY;
+	if (!EncodeContextObjectIdentifier(buffer, maxLength, &offset, 0, objectType, objectInstance) ||
+		!EncodeContextUnsigned(buffer, maxLength, &offset, 1, propertyIdentifier)) {
+		return 0;
+	}
+	return FinishMessage(buffer, offset);
+}
+
+uint16_t LoadGeneratorMessages::EncodeReadPropertyMultiple(uint8_t* buffer, const uint16_t maxLength, const LoadGeneratorAddress & destination, const uint8_t invokeId, const uint16_t objectType, const uint32_t* objectInstances, const uint32_t objectCount, const uint32_t propertyIdentifier) {
+	uint16_t offset;
+	if (objectInstances == NULL || objectCount == 0) {
+		return 0;
+	}
+	if (!EncodeHeaders(buffer, maxLength, &offset, &destination, true) || offset + 4 > maxLength) {
+		return 0;
+	}
+	buffer[offset++] = APDU_TYPE_CONFIRMED_REQUEST << 4;
+	buffer[offset++] = APDU_MAX_SEGMENTS_NONE_MAX_APDU_1476;
+	buffer[offset++] = invokeId;
+	buffer[offset++] = SERVICE_CONFIRMED_READ_PROPERTY_MULTIPLE;
+	for (uint32_t object = 0; object < objectCount; object++) {
+		// Object identifier, then the list of property references in an opening and closing tag 1
+		if (!EncodeContextObjectIdentifier(buffer, maxLength, &offset, 0, objectType, objectInstances[object]) || offset + 1 > maxLength) {
+			return 0;
+		}
+		buffer[offset++] = 0x1E;
+		if (!EncodeContextUnsigned(buffer, maxLength, &offset, 0, propertyIdentifier) || offset + 1 > maxLength) {
+			return 0;
+		}
+		buffer[offset++] = 0x1F;
+	}
+	return FinishMessage(buffer, offset);
+}
+
+uint16_t LoadGeneratorMessages::EncodeSubscribeCOV(uint8_t* buffer, const uint16_t maxLength, const LoadGeneratorAddress & destination, const uint8_t invokeId, const uint32_t subscriberProcessIdentifier, const uint16_t objectType, const uint32_t objectInstance, const uint32_t lifetimeSeconds) {
+	uint16_t offset;
+	if (!EncodeHeaders(buffer, maxLength, &offset, &destination, true) || offset + 4 > maxLength) {
+		return 0;
+	}
+	buffer[offset++] = APDU_TYPE_CONFIRMED_REQUEST << 4;
+	buffer[offset++] = APDU_MAX_SEGMENTS_NONE_MAX_APDU_1476;
+	buffer[offset++] = invokeId;
+	buffer[offset++] = SERVICE_CONFIRMED_SUBSCRIBE_COV;
+	if (!EncodeContextUnsigned(buffer, maxLength, &offset, 0, subscriberProcessIdentifier) ||
+		!EncodeContextObjectIdentifier(buffer, maxLength, &offset, 1, objectType, objectInstance) ||
+		offset + 2 > maxLength) {
+		return 0;
+	}
+	// Issue confirmed notifications: false
+	buffer[offset++] = CONTEXT_TAG_2_BOOLEAN_FALSE;
+	buffer[offset++] = 0;
+	if (!EncodeContextUnsigned(buffer, maxLength, &offset, 3, lifetimeSeconds)) {
+		return 0;
+	}
+	return FinishMessage(buffer, offset);
+}
+
+bool LoadGeneratorMessages::FindAPDU(const uint8_t* message, const uint16_t length, uint16_t* apduOffset, LoadGeneratorAddress* source, bool* hasSource) {
+	*hasSource = false;
+
+	// BVLL
+	if (message == NULL || length < BVLL_HEADER_LENGTH || message[0] != BVLL_TYPE_BACNET_IP) {
+		return false;
+	}
+	uint16_t offset = BVLL_HEADER_LENGTH;
+	if (message[1] == BVLL_FUNCTION_FORWARDED_NPDU) {
+		offset += 6; // Original source address
+	}
+	else if (message[1] != BVLL_FUNCTION_ORIGINAL_UNICAST_NPDU && message[1] != BVLL_FUNCTION_ORIGINAL_BROADCAST_NPDU) {
+		return false;
+	}
+
+	// NPDU
+	if (offset + 2 > length || message[offset] != NPDU_VERSION) {
+		return false;
+	}
+	uint8_t control = message[offset + 1];
+	offset += 2;
+	if ((control & NPDU_CONTROL_NETWORK_MESSAGE) != 0) {
+		return false;
+	}
+	if ((control & NPDU_CONTROL_DESTINATION) != 0) {
+		if (offset + 3 > length) {
+			return false;
+		}
+		offset += 3 + message[offset + 2];
+	}
+	if ((control & NPDU_CONTROL_SOURCE) != 0) {
+		if (offset + 3 > length || offset + 3 + message[offset + 2] > length) {
+			return false;
+		}
+		uint8_t macLength = message[offset + 2];
+		if (source != NULL && macLength <= LOAD_GENERATOR_MAX_MAC_LENGTH) {
+			source->network = (uint16_t)((message[offset] << 8) | message[offset + 1]);
+			source->macLength = macLength;
+			memcpy(source->mac, message + offset + 3, macLength);
+			*hasSource = true;
+		}
+		offset += 3 + macLength;
+	}
+	if ((control & NPDU_CONTROL_DESTINATION) != 0) {
+		offset += 1; // Hop count
+	}
+	if (offset >= length) {
+		return false;
+	}
+	*apduOffset = offset;
+	return true;
+}
+
+bool LoadGeneratorMessages::DecodeReply(const uint8_t* message, const uint16_t length, LoadGeneratorReply* reply) {
+	uint16_t offset;
+	if (reply == NULL || !FindAPDU(message, length, &offset, &reply->source, &reply->hasSource)) {
+		return false;
+	}
+	reply->pduType = message[offset] >> 4;
+	reply->segmented = false;
+	reply->invokeId = 0;
+	reply->service = 0;
+	reply->deviceInstance = 0;
+
+	switch (reply->pduType) {
+	case APDU_TYPE_UNCONFIRMED_REQUEST:
+		if (offset + 2 > length) {
+			return false;
+		}
+		reply->service = message[offset + 1];
+		if (reply->service == SERVICE_UNCONFIRMED_I_AM) {
+			// The first parameter is the device object identifier
+			offset += 2;
+			if (offset + 5 > length || message[offset] != APPLICATION_TAG_OBJECT_IDENTIFIER) {
+				return false;
+			}
+			uint32_t objectIdentifier = ((uint32_t)message[offset + 1] << 24) | ((uint32_t)message[offset + 2] << 16) | ((uint32_t)message[offset + 3] << 8) | message[offset + 4];
+			reply->deviceInstance = objectIdentifier & MAX_INSTANCE;
+		}
+		return true;
+	case APDU_TYPE_SIMPLE_ACK:
+	case APDU_TYPE_ERROR:
+	case APDU_TYPE_REJECT:
+	case APDU_TYPE_ABORT:
+		if (offset + 3 > length) {
+			return false;
+		}
+		reply->invokeId = message[offset + 1];
+		reply->service = message[offset + 2];
+		return true;
+	case APDU_TYPE_COMPLEX_ACK:
+		reply->segmented = (message[offset] & APDU_FLAG_SEGMENTED) != 0;
+		if (offset + (reply->segmented ? 5 : 3) > length) {
+			return false;
+		}
+		reply->invokeId = message[offset + 1];
+		reply->service = message[offset + (reply->segmented ? 4 : 2)];
+		return true;
+	default:
+		break;
+	}
+	return false;
+}
+
+bool LoadGeneratorMessages::IsSameAddress(const LoadGeneratorAddress & first, const LoadGeneratorAddress & second) {
+	return first.network == second.network && first.macLength == second.macLength && memcmp(first.mac, second.mac, first.macLength) == 0;
+}
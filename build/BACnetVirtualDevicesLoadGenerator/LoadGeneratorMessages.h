@@ -0,0 +1,95 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * LoadGeneratorMessages.h
+ *
+ * Encodes the BACnet/IP requests sent by the load generator (Who-Is,
+ * ReadProperty, ReadPropertyMultiple and SubscribeCOV) and decodes just
+ * enough of the replies to match them to their requests. Requests for the
+ * virtual devices are routed with the destination network and MAC address
+ * of the device.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#ifndef __LoadGeneratorMessages_h__
+#define __LoadGeneratorMessages_h__
+
+#include <stdint.h>
+
+#define LOAD_GENERATOR_MAX_MAC_LENGTH	8
+
+// Where a device is. A network of zero is the local network of the server (no routing).
+struct LoadGeneratorAddress
+{
+	uint16_t network;
+	uint8_t macLength;
+	uint8_t mac[LOAD_GENERATOR_MAX_MAC_LENGTH];
+};
+
+// The parts of a received message the load generator looks at
+struct LoadGeneratorReply
+{
+	uint8_t pduType;		// APDU_TYPE_*
+	uint8_t invokeId;		// Confirmed services only
+	uint8_t service;		// Service choice, or the reason of a reject or abort
+	bool segmented;			// Complex ack that needs more segments
+	bool hasSource;			// Routed from a virtual network
+	LoadGeneratorAddress source;
+	uint32_t deviceInstance;	// I-Am only
+};
+
+class LoadGeneratorMessages
+{
+public:
+	static const uint16_t MAX_MESSAGE_LENGTH = 1536;
+
+	// APDU types
+	static const uint8_t APDU_TYPE_CONFIRMED_REQUEST = 0;
+	static const uint8_t APDU_TYPE_UNCONFIRMED_REQUEST = 1;
+	static const uint8_t APDU_TYPE_SIMPLE_ACK = 2;
+	static const uint8_t APDU_TYPE_COMPLEX_ACK = 3;
+	static const uint8_t APDU_TYPE_SEGMENT_ACK = 4;
+	static const uint8_t APDU_TYPE_ERROR = 5;
+	static const uint8_t APDU_TYPE_REJECT = 6;
+	static const uint8_t APDU_TYPE_ABORT = 7;
+
+	// Services
+	static const uint8_t SERVICE_UNCONFIRMED_I_AM = 0;
+	static const uint8_t SERVICE_UNCONFIRMED_I_HAVE = 1;
+	static const uint8_t SERVICE_UNCONFIRMED_COV_NOTIFICATION = 2;
+	static const uint8_t SERVICE_UNCONFIRMED_WHO_IS = 8;
+	static const uint8_t SERVICE_CONFIRMED_SUBSCRIBE_COV = 5;
+	static const uint8_t SERVICE_CONFIRMED_READ_PROPERTY = 12;
+	static const uint8_t SERVICE_CONFIRMED_READ_PROPERTY_MULTIPLE = 14;
+
+	// Object types and properties used by the scenarios
+	static const uint16_t OBJECT_TYPE_ANALOG_INPUT = 0;
+	static const uint16_t OBJECT_TYPE_DEVICE = 8;
+	static const uint32_t PROPERTY_IDENTIFIER_OBJECT_NAME = 77;
+	static const uint32_t PROPERTY_IDENTIFIER_PRESENT_VALUE = 85;
+
+	static const uint16_t GLOBAL_BROADCAST_NETWORK = 0xFFFF;
+	static const uint32_t MAX_INSTANCE = 4194303;
+
+	// Who-Is sent to all networks. Without limits every device answers.
+	static uint16_t EncodeWhoIs(uint8_t* buffer, const uint16_t maxLength, const bool useLimits, const uint32_t lowLimit, const uint32_t highLimit);
+
+	static uint16_t EncodeReadProperty(uint8_t* buffer, const uint16_t maxLength, const LoadGeneratorAddress & destination, const uint8_t invokeId, const uint16_t objectType, const uint32_t objectInstance, const uint32_t propertyIdentifier);
+
+	// Reads the same property of several objects of one type
+	static uint16_t EncodeReadPropertyMultiple(uint8_t* buffer, const uint16_t maxLength, const LoadGeneratorAddress & destination, const uint8_t invokeId, const uint16_t objectType, const uint32_t* objectInstances, const uint32_t objectCount, const uint32_t propertyIdentifier);
+
+	// Subscribes to unconfirmed COV notifications of one object for lifetimeSeconds
+	static uint16_t EncodeSubscribeCOV(uint8_t* buffer, const uint16_t maxLength, const LoadGeneratorAddress & destination, const uint8_t invokeId, const uint32_t subscriberProcessIdentifier, const uint16_t objectType, const uint32_t objectInstance, const uint32_t lifetimeSeconds);
+
+	// Finds the APDU of a BACnet/IP message. Returns false for network layer messages
+	// and anything that is not BACnet/IP. The source is only set if the message has one.
+	static bool FindAPDU(const uint8_t* message, const uint16_t length, uint16_t* apduOffset, LoadGeneratorAddress* source, bool* hasSource);
+
+	static bool DecodeReply(const uint8_t* message, const uint16_t length, LoadGeneratorReply* reply);
+
+	static bool IsSameAddress(const LoadGeneratorAddress & first, const LoadGeneratorAddress & second);
+};
+
+#endif // __LoadGeneratorMessages_h__
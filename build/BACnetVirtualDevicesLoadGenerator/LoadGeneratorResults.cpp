@@ -0,0 +1,191 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * LoadGeneratorResults.cpp
+ *
+ * Load generator counts, percentiles and reports.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#include "LoadGeneratorResults.h"
+
+#include <algorithm> // std::sort
+#include <stdio.h> // snprintf()
+#include <time.h> // time(), gmtime()
+
+// Time the run finished, ISO 8601 in UTC
+static std::string GetTimestamp()
+{
+	time_t now = time(0);
+	struct tm utc;
+#ifdef _MSC_VER
+	gmtime_s(&utc, &now);
+#else
+	gmtime_r(&now, &utc);
+#endif
+	char buffer[32];
+	strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", &utc);
+	return buffer;
+}
+
+// The label is free text, keep it from breaking the CSV and JSON output
+static std::string Escape(const std::string & text)
+{
+	std::string escaped;
+	for (size_t offset = 0; offset < text.size(); offset++) {
+		char character = text[offset];
+		if (character == '"' || character == '\\') {
+			escaped += '\\';
+		}
+		if (character == ',' || (unsigned char)character < 0x20) {
+			character = ' ';
+		}
+		escaped += character;
+	}
+	return escaped;
+}
+
+LoadGeneratorResults::LoadGeneratorResults() {
+	this->durationSeconds = 0;
+	this->bytesSent = 0;
+	this->bytesReceived = 0;
+	for (size_t operation = 0; operation < OPERATION_COUNT; operation++) {
+		this->operations[operation].sent = 0;
+		this->operations[operation].completed = 0;
+		this->operations[operation].errors = 0;
+		this->operations[operation].timeouts = 0;
+	}
+}
+
+void LoadGeneratorResults::RecordSent(const Operation operation) {
+	this->operations[operation].sent++;
+}
+
+void LoadGeneratorResults::RecordCompleted(const Operation operation, const uint64_t latencyNs, const bool error) {
+	OperationStats & stats = this->operations[operation];
+	stats.completed++;
+	if (error) {
+		stats.errors++;
+	}
+	stats.latenciesNs.push_back(latencyNs);
+}
+
+void LoadGeneratorResults::RecordTimeout(const Operation operation) {
+	this->operations[operation].timeouts++;
+}
+
+// Counts a message that was not requested, eg. a COV notification. It has no latency.
+void LoadGeneratorResults::RecordReceived(const Operation operation) {
+	this->operations[operation].sent++;
+	this->operations[operation].completed++;
+}
+
+// Called when the measured part of a run starts, eg. after the discovery
+void LoadGeneratorResults::ResetBytes() {
+	this->bytesSent = 0;
+	this->bytesReceived = 0;
+}
+
+double LoadGeneratorResults::GetPercentileUs(const std::vector<uint64_t> & sorted, const double percentile) {
+	if (sorted.empty()) {
+		return 0;
+	}
+	// Nearest rank
+	size_t rank = (size_t)(percentile * (double)sorted.size() + 0.999999);
+	if (rank < 1) {
+		rank = 1;
+	}
+	if (rank > sorted.size()) {
+		rank = sorted.size();
+	}
+	return (double)sorted[rank - 1] / 1000.0;
+}
+
+void LoadGeneratorResults::Summarize(const Operation operation, Summary & summary) const {
+	std::vector<uint64_t> sorted(this->operations[operation].latenciesNs);
+	std::sort(sorted.begin(), sorted.end());
+	summary.throughput = this->durationSeconds > 0 ? (double)this->operations[operation].completed / this->durationSeconds : 0;
+	summary.p50Us = GetPercentileUs(sorted, 0.50);
+	summary.p99Us = GetPercentileUs(sorted, 0.99);
+	summary.p999Us = GetPercentileUs(sorted, 0.999);
+	summary.maxUs = sorted.empty() ? 0 : (double)sorted.back() / 1000.0;
+}
+
+void LoadGeneratorResults::WriteCSV(std::ostream & output, const bool header) const {
+	if (header) {
+		output << "timestamp,label,scenario,operation,sent,completed,errors,timeouts,duration_s,throughput_per_s,p50_us,p99_us,p999_us,max_us,bytes_sent,bytes_received" << std::endl;
+	}
+	std::string timestamp = GetTimestamp();
+	for (size_t operation = 0; operation < OPERATION_COUNT; operation++) {
+		const OperationStats & stats = this->operations[operation];
+		if (stats.sent == 0) {
+			continue;
+		}
+		Summary summary;
+		this->Summarize((Operation)operation, summary);
+		char line[512];
+		snprintf(line, sizeof(line), "%s,%s,%s,%s,%llu,%llu,%llu,%llu,%.3f,%.1f,%.1f,%.1f,%.1f,%.1f,%llu,%llu",
+			timestamp.c_str(), Escape(this->label).c_str(), this->scenario.c_str(), GetOperationName((Operation)operation),
+			(unsigned long long)stats.sent, (unsigned long long)stats.completed, (unsigned long long)stats.errors, (unsigned long long)stats.timeouts,
+			this->durationSeconds, summary.throughput, summary.p50Us, summary.p99Us, summary.p999Us, summary.maxUs,
+			(unsigned long long)this->bytesSent, (unsigned long long)this->bytesReceived);
+		output << line << std::endl;
+	}
+}
+
+void LoadGeneratorResults::WriteJSON(std::ostream & output) const {
+	output << "{\"timestamp\":\"" << GetTimestamp() << "\",\"label\":\"" << Escape(this->label) << "\",\"scenario\":\"" << this->scenario << "\",\"duration_s\":" << this->durationSeconds << ",\"bytes_sent\":" << this->bytesSent << ",\"bytes_received\":" << this->bytesReceived << ",\"operations\":[";
+	bool first = true;
+	for (size_t operation = 0; operation < OPERATION_COUNT; operation++) {
+		const OperationStats & stats = this->operations[operation];
+		if (stats.sent == 0) {
+			continue;
+		}
+		Summary summary;
+		this->Summarize((Operation)operation, summary);
+		char line[512];
+		snprintf(line, sizeof(line), "%s{\"operation\":\"%s\",\"sent\":%llu,\"completed\":%llu,\"errors\":%llu,\"timeouts\":%llu,\"throughput_per_s\":%.1f,\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f}",
+			first ? "" : ",", GetOperationName((Operation)operation),
+			(unsigned long long)stats.sent, (unsigned long long)stats.completed, (unsigned long long)stats.errors, (unsigned long long)stats.timeouts,
+			summary.throughput, summary.p50Us, summary.p99Us, summary.p999Us, summary.maxUs);
+		output << line;
+		first = false;
+	}
+	output << "]}" << std::endl;
+}
+
+void LoadGeneratorResults::WriteText(std::ostream & output) const {
+	output << "Scenario: " << this->scenario << ", duration=[" << this->durationSeconds << " s], bytesSent=[" << this->bytesSent << "], bytesReceived=[" << this->bytesReceived << "]" << std::endl;
+	for (size_t operation = 0; operation < OPERATION_COUNT; operation++) {
+		const OperationStats & stats = this->operations[operation];
+		if (stats.sent == 0) {
+			continue;
+		}
+		Summary summary;
+		this->Summarize((Operation)operation, summary);
+		output << "  " << GetOperationName((Operation)operation) << ": sent=[" << stats.sent << "], completed=[" << stats.completed << "], errors=[" << stats.errors << "], timeouts=[" << stats.timeouts << "], throughput=[" << summary.throughput << "/s], p50=[" << summary.p50Us << " us], p99=[" << summary.p99Us << " us], p999=[" << summary.p999Us << " us], max=[" << summary.maxUs << " us]" << std::endl;
+	}
+}
+
+const char* LoadGeneratorResults::GetOperationName(const Operation operation) {
+	switch (operation) {
+	case OPERATION_WHO_IS:
+		return "who_is";
+	case OPERATION_DISCOVERY:
+		return "discovery";
+	case OPERATION_READ_PROPERTY:
+		return "read_property";
+	case OPERATION_READ_PROPERTY_MULTIPLE:
+		return "read_property_multiple";
+	case OPERATION_SUBSCRIBE_COV:
+		return "subscribe_cov";
+	case OPERATION_COV_NOTIFICATION:
+		return "cov_notification";
+	case OPERATION_OTHER:
+		return "other";
+	default:
+		break;
+	}
+	return "unknown";
+}
@@ -0,0 +1,79 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * LoadGeneratorResults.h
+ *
+ * Counts and latencies of one load generator run, and the CSV and JSON
+ * reports. Every latency is kept so the percentiles are exact. The bytes
+ * sent and received are counted for the whole run, so polling and COV can
+ * be compared on the wire.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#ifndef __LoadGeneratorResults_h__
+#define __LoadGeneratorResults_h__
+
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class LoadGeneratorResults
+{
+public:
+	enum Operation {
+		OPERATION_WHO_IS = 0,					// Who-Is for one device, completed by its I-Am
+		OPERATION_DISCOVERY,					// One device found by the cold start Who-Is, latency from the first Who-Is
+		OPERATION_READ_PROPERTY,
+		OPERATION_READ_PROPERTY_MULTIPLE,
+		OPERATION_SUBSCRIBE_COV,
+		OPERATION_COV_NOTIFICATION,				// Received, not requested. Counted but not timed.
+		OPERATION_OTHER,						// Replayed requests of other services
+		OPERATION_COUNT
+	};
+
+	struct OperationStats {
+		uint64_t sent;
+		uint64_t completed;	// Answered, including errors
+		uint64_t errors;	// Error, reject, abort or a segmented reply
+		uint64_t timeouts;
+		std::vector<uint64_t> latenciesNs; // Of the completed operations
+	};
+
+	std::string scenario;
+	std::string label;		// Free text copied to the report, eg. the server version
+	double durationSeconds;
+	OperationStats operations[OPERATION_COUNT];
+	uint64_t bytesSent;		// BACnet/IP bytes of the whole run, without the UDP and IP headers
+	uint64_t bytesReceived;
+
+	LoadGeneratorResults();
+
+	void RecordSent(const Operation operation);
+	void RecordCompleted(const Operation operation, const uint64_t latencyNs, const bool error);
+	void RecordTimeout(const Operation operation);
+	void RecordReceived(const Operation operation);
+	void ResetBytes();
+
+	// One row per operation that was used. The header row is optional so that runs
+	// can be appended to the same file.
+	void WriteCSV(std::ostream & output, const bool header) const;
+	void WriteJSON(std::ostream & output) const;
+	void WriteText(std::ostream & output) const;
+
+	static const char* GetOperationName(const Operation operation);
+
+private:
+	struct Summary {
+		double throughput;	// Completed per second
+		double p50Us;
+		double p99Us;
+		double p999Us;
+		double maxUs;
+	};
+	void Summarize(const Operation operation, Summary & summary) const;
+	static double GetPercentileUs(const std::vector<uint64_t> & sorted, const double percentile);
+};
+
+#endif // __LoadGeneratorResults_h__
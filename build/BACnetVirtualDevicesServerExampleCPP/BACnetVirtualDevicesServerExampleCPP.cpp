@@ -16,6 +16,13 @@
 #include "CASBACnetStackAdapter.h"
 #include "CASBACnetStackExampleConstants.h"
 #include "CASBACnetStackExampleDatabase.h"
+#include "CASBACnetStackExampleAnnouncer.h"
+#include "CASBACnetStackExampleTrace.h"
+#include "CASBACnetStackExampleSimulator.h"
+#include "CASBACnetStackExampleCOV.h"
+#include "CASBACnetStackExampleDispatcher.h"
+#include "CASBACnetStackExampleMetrics.h"
+#include "CASBACnetStackExampleMetricsServer.h"
 #include "CIBuildVersion.h"
 
 // Helpers
@@ -25,10 +32,16 @@
 #include "ChipkinUtilities.h"
 
 #include <iostream>
+#include <fstream>
+#include <chrono>
+#include <signal.h>
 #ifndef __GNUC__ // Windows
 #include <conio.h> // _kbhit
+#include <psapi.h> // GetProcessMemoryInfo
+#pragma comment(lib, "Psapi.lib")
 #else // Linux 
 #include <sys/ioctl.h>
+#include <sys/resource.h> // getrusage
 #include <termios.h>
 bool _kbhit() {
 	termios term;
@@ -36,10 +49,10 @@ bool _kbhit() {
 	termios term2 = term;
 	term2.c_lflag &= ~ICANON;
 	tcsetattr(0, TCSANOW, &term2);
-	int byteswaiting;
-	ioctl(0, FIONREAD, &byteswaiting);
+	int byteswaiting = 0;
+	int result = ioctl(0, FIONREAD, &byteswaiting); // Fails when stdin is not a terminal or pipe, eg. /dev/null
 	tcsetattr(0, TCSANOW, &term);
-	return byteswaiting > 0;
+	return result == 0 && byteswaiting > 0;
 }
 #include <termios.h>
 #include <unistd.h>
@@ -54,11 +67,24 @@ void Sleep(int milliseconds) {
 // =======================================
 CSimpleUDP g_udp; // UDP resource
 ExampleDatabase g_database; // The example database that stores current values.
+ExampleAnnouncer g_announcer; // Paces the I-Am announcements of the virtual devices
+uint8_t g_broadcastConnectionString[6]; // Broadcast address and port used for I-Am announcements
+ExampleTrace g_trace; // Packet trace and capture, rendered on a background thread
+ExampleSimulator g_simulator; // Simulated field drivers that update the Analog Input values
+ExampleCOV g_cov; // Tells the CAS BACnet Stack which Analog Input changes are worth a COV notification
+ExampleDispatcher g_dispatcher; // Optional receive thread that queues incoming messages per shard of virtual networks
+ExampleMetrics g_metrics; // Counters and latency histograms of the message callbacks, GetProperty callbacks and fpLoop()
+ExampleMetricsServer g_metricsServer; // Optional Prometheus endpoint for the metrics
+bool g_receiveEventMode = true; // --receive-mode. Linux only, poll is the blocking receive of earlier versions
+volatile sig_atomic_t g_stopRequested = 0; // Set by SIGINT or SIGTERM, eg. when make bench stops the server
 
 // Constants
 // =======================================
-const std::string APPLICATION_VERSION = "0.0.5";  // See CHANGELOG.md for a full list of changes.
-const uint32_t MAX_XML_RENDER_BUFFER_LENGTH = 1024 * 20;
+const std::string APPLICATION_VERSION = "0.0.6";  // See CHANGELOG.md for a full list of changes.
+const int MAIN_LOOP_IDLE_WAIT_MS = 10; // Max time the main loop waits for a packet before checking timers and user input
+const unsigned short UDP_RECEIVE_RING_SIZE = 256; // Number of datagrams that can be queued between fpLoop() calls
+const unsigned short UDP_SEND_QUEUE_SIZE = 64; // Number of outgoing datagrams sent together in one sendmmsg batch
+const uint32_t CONFIG_MAX_INCLUDE_DEPTH = 8; // How deep config files can include other config files
 
 // Callback Functions to Register to the DLL
 // Message Functions
@@ -75,17 +101,50 @@ bool CallbackGetPropertyOctetString(const uint32_t deviceInstance, const uint16_
 bool CallbackGetPropertyReal(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, const uint32_t propertyIdentifier, float* value, const bool useArrayIndex, const uint32_t propertyArrayIndex);
 bool CallbackGetPropertyUInt(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, const uint32_t propertyIdentifier, uint32_t* value, const bool useArrayIndex, const uint32_t propertyArrayIndex);
 
+// Get Property Functions that record the time spent in the functions above
+bool TimedGetPropertyCharString(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, const uint32_t propertyIdentifier, char* value, uint32_t* valueElementCount, const uint32_t maxElementCount, uint8_t* encodingType, const bool useArrayIndex, const uint32_t propertyArrayIndex);
+bool TimedGetPropertyEnum(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, const uint32_t propertyIdentifier, uint32_t* value, const bool useArrayIndex, const uint32_t propertyArrayIndex);
+bool TimedGetPropertyOctetString(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, const uint32_t propertyIdentifier, uint8_t* value, uint32_t* valueElementCount, const uint32_t maxElementCount, const bool useArrayIndex, const uint32_t propertyArrayIndex);
+bool TimedGetPropertyReal(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, const uint32_t propertyIdentifier, float* value, const bool useArrayIndex, const uint32_t propertyArrayIndex);
+bool TimedGetPropertyUInt(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, const uint32_t propertyIdentifier, uint32_t* value, const bool useArrayIndex, const uint32_t propertyArrayIndex);
+
 // Helper functions 
 bool DoUserInput();
 bool GetObjectName(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, char* value, uint32_t* valueElementCount, const uint32_t maxElementCount);
 bool GetDeviceDescription(const uint32_t deviceInstance, char* value, uint32_t* valueElementCount, const uint32_t maxElementCount);
-
-int main()
+bool LoadArguments(int argc, char* argv[]);
+bool LoadConfigFile(const std::string & path, const uint32_t includeDepth);
+bool SetOption(const std::string & name, const std::string & value, const uint32_t includeDepth = 0);
+void PrintUsage();
+size_t GetResidentMemoryKB();
+void GetProcessCpuTimeUs(uint64_t* userUs, uint64_t* systemUs);
+void HandleStopSignal(int);
+bool SendIAm(const uint32_t deviceInstance, const ExampleAnnouncerDestination* destination = NULL);
+uint32_t DecodeAsXML(const uint8_t* message, const uint16_t messageLength, char* buffer, const uint32_t maxBufferLength);
+void ValueUpdated(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, const uint32_t propertyIdentifier);
+void RenderMetrics(std::string & output);
+void PrintStats();
+
+int main(int argc, char* argv[])
 {
 	// Print the application version information 
 	std::cout << "CAS BACnet Stack Virtual Devices Server Example v" << APPLICATION_VERSION << "." << CIBUILDNUMBER << std::endl;
 	std::cout << "https://github.com/chipkin/BACnetVirtualDevicesServerExampleCPP" << std::endl << std::endl;
 
+	// 0. Load the configuration and build the database
+	// ---------------------------------------------------------------------------
+	if (!LoadArguments(argc, argv)) {
+		PrintUsage();
+		return -1;
+	}
+	std::string topologyError;
+	if (!g_database.topology.Validate(topologyError)) {
+		std::cerr << "Invalid virtual device topology: " << topologyError << std::endl;
+		return -1;
+	}
+	std::chrono::steady_clock::time_point startupTime = std::chrono::steady_clock::now();
+	g_database.Setup();
+
 	// 1. Load the CAS BACnet stack functions
 	// ---------------------------------------------------------------------------
 	std::cout << "FYI: Loading CAS BACnet Stack functions... ";
@@ -99,6 +158,13 @@ int main()
 	// 2. Connect the UDP resource to the BACnet Port
 	// ---------------------------------------------------------------------------
 	std::cout << "FYI: Connecting UDP Resource to port=[" << g_database.networkPort.BACnetIPUDPPort << "]... ";
+#ifdef __GNUC__
+	// Use the non-blocking epoll receive path. Datagrams are drained in batches into
+	// a ring and the main loop only sleeps when there is nothing left to process.
+	if (g_receiveEventMode) {
+		g_udp.SetEventMode(true, UDP_RECEIVE_RING_SIZE);
+	}
+#endif // __GNUC__
 	if (!g_udp.Connect(g_database.networkPort.BACnetIPUDPPort)) {
 		std::cerr << "Failed to connect to UDP Resource" << std::endl;
 		std::cerr << "Press any key to exit the application..." << std::endl;
@@ -107,6 +173,24 @@ int main()
 	}
 	std::cout << "OK, Connected to port" << std::endl;
 
+	// Outgoing messages are queued and flushed in batches once per loop
+	g_udp.SetSendQueueSize(UDP_SEND_QUEUE_SIZE);
+
+	// Start the packet trace. When the trace is off the message callbacks do no extra work.
+	g_trace.SetLocalAddress(g_database.networkPort.IPAddress, g_database.networkPort.BACnetIPUDPPort);
+	g_trace.Setup(DecodeAsXML);
+	std::cout << "FYI: Packet trace=[" << ExampleTrace::GetLevelName(g_trace.GetLevel()) << "]" << std::endl;
+
+	// Serve the metrics to a Prometheus scraper. The endpoint is serviced from the main loop.
+	if (g_metricsServer.port > 0) {
+		if (g_metricsServer.Start()) {
+			std::cout << "FYI: Serving metrics on http://" << g_metricsServer.address << ":" << g_metricsServer.port << "/metrics" << std::endl;
+		}
+		else {
+			std::cerr << "Failed to start the metrics endpoint on " << g_metricsServer.address << ":" << g_metricsServer.port << std::endl;
+		}
+	}
+
 	// 3. Setup the callbacks
 	// ---------------------------------------------------------------------------
 	std::cout << "FYI: Registering the callback Functions with the CAS BACnet Stack" << std::endl;
@@ -119,11 +203,11 @@ int main()
 	fpRegisterCallbackGetSystemTime(CallbackGetSystemTime);
 
 	// Get Property Callback Functions
-	fpRegisterCallbackGetPropertyCharacterString(CallbackGetPropertyCharString);
-	fpRegisterCallbackGetPropertyEnumerated(CallbackGetPropertyEnum);
-	fpRegisterCallbackGetPropertyOctetString(CallbackGetPropertyOctetString);
-	fpRegisterCallbackGetPropertyReal(CallbackGetPropertyReal);
-	fpRegisterCallbackGetPropertyUnsignedInteger(CallbackGetPropertyUInt);
+	fpRegisterCallbackGetPropertyCharacterString(TimedGetPropertyCharString);
+	fpRegisterCallbackGetPropertyEnumerated(TimedGetPropertyEnum);
+	fpRegisterCallbackGetPropertyOctetString(TimedGetPropertyOctetString);
+	fpRegisterCallbackGetPropertyReal(TimedGetPropertyReal);
+	fpRegisterCallbackGetPropertyUnsignedInteger(TimedGetPropertyUInt);
 
 	// 4. Setup the BACnet device
 	// ---------------------------------------------------------------------------
@@ -174,117 +258,515 @@ int main()
 	std::cout << "OK" << std::endl;
 
 	// Add Virtual Devices and Objects
-	std::cout << "Adding Virtual Devices and Objects..." << std::endl;
-	std::map<uint16_t, std::vector<ExampleDatabaseDevice> >::iterator it;
-	for (it = g_database.virtualDevices.begin(); it != g_database.virtualDevices.end(); ++it) {
+	// Only errors are logged per device, at 100k+ devices per device logging dominates the startup time.
+	std::cout << "FYI: Adding " << g_database.virtualDevices.size() << " Virtual Devices and their Objects... ";
+	for (size_t networkOffset = 0; networkOffset < g_database.virtualNetworks.size(); networkOffset++) {
 		// Add the Virtual network
-		if (!fpAddVirtualNetwork(g_database.mainDevice.instance, it->first, it->first)) {
-			std::cerr << "Failed to add virtual network " << it->first << std::endl;
+		uint16_t network = g_database.virtualNetworks[networkOffset];
+		if (!fpAddVirtualNetwork(g_database.mainDevice.instance, network, network)) {
+			std::cerr << "Failed to add virtual network " << network << std::endl;
 			return -1;
 		}
+	}
 
-		std::vector<ExampleDatabaseDevice>::iterator devIt;
-		for (devIt = it->second.begin(); devIt != it->second.end(); ++devIt) {
-			// Add the Virtual Device
-			std::cout << "Adding Virtual Device. device.instance=[" << devIt->instance << "] to network=[" << it->first << "]...";
-			if (!fpAddDeviceToVirtualNetwork(devIt->instance, it->first)) {
-				std::cerr << "Failed to add Virtual Device" << std::endl;
-				return -1;
-			}
-			std::cout << "OK" << std::endl;
+	const ExampleDatabaseTopology & topology = g_database.topology;
+	std::vector<ExampleDatabaseVirtualDevice>::iterator devIt;
+	for (devIt = g_database.virtualDevices.begin(); devIt != g_database.virtualDevices.end(); ++devIt) {
+		// Add the Virtual Device
+		if (!fpAddDeviceToVirtualNetwork(devIt->instance, devIt->network)) {
+			std::cerr << "Failed to add Virtual Device. device.instance=[" << devIt->instance << "] to network=[" << devIt->network << "]" << std::endl;
+			return -1;
+		}
 
-			// Enable IAm
-			std::cout << "Enabling IAm... ";
-			if (!fpSetServiceEnabled(devIt->instance, CASBACnetStackExampleConstants::SERVICE_I_AM, true)) {
-				std::cerr << "Failed to enable IAm" << std::endl;
-				return -1;
-			}
-			std::cout << "OK" << std::endl;
+		// Enable IAm
+		if (!fpSetServiceEnabled(devIt->instance, CASBACnetStackExampleConstants::SERVICE_I_AM, true)) {
+			std::cerr << "Failed to enable IAm. device.instance=[" << devIt->instance << "]" << std::endl;
+			return -1;
+		}
 
-			// Enable Read Property Multiple
-			if (!fpSetServiceEnabled(devIt->instance, CASBACnetStackExampleConstants::SERVICE_READ_PROPERTY_MULTIPLE, true)) {
-				std::cerr << "Failed to enable ReadPropertyMultiple" << std::endl;
-				return -1;
-			}
-			std::cout << "OK" << std::endl;
+		// Enable Read Property Multiple
+		if (!fpSetServiceEnabled(devIt->instance, CASBACnetStackExampleConstants::SERVICE_READ_PROPERTY_MULTIPLE, true)) {
+			std::cerr << "Failed to enable ReadPropertyMultiple. device.instance=[" << devIt->instance << "]" << std::endl;
+			return -1;
+		}
 
-			// Add the Analog Input to the Virtual Device
-			std::cout << "Adding Analog Input to Virtual Device. device.instance=[" << devIt->instance << "], analogInput.instance=[" << g_database.analogInputs[devIt->instance].instance << "]...";
-			if (!fpAddObject(devIt->instance, CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_INPUT, g_database.analogInputs[devIt->instance].instance)) {
-				std::cerr << "Failed to add AnalogInput" << std::endl;
+		// Enable Subscribe COV
+		if (g_cov.enabled && !fpSetServiceEnabled(devIt->instance, CASBACnetStackExampleConstants::SERVICE_SUBSCRIBE_COV, true)) {
+			std::cerr << "Failed to enable SubscribeCOV. device.instance=[" << devIt->instance << "]" << std::endl;
+			return -1;
+		}
+
+		// Add the Analog Inputs to the Virtual Device
+		for (uint32_t objectInstance = 1; objectInstance <= topology.analogInputsPerDevice; objectInstance++) {
+			if (!fpAddObject(devIt->instance, CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_INPUT, objectInstance)) {
+				std::cerr << "Failed to add AnalogInput. device.instance=[" << devIt->instance << "], analogInput.instance=[" << objectInstance << "]" << std::endl;
 				return -1;
 			}
-			std::cout << "OK" << std::endl;
-
+		}
+		if (topology.analogInputsPerDevice > 0) {
 			// Enable Reliability property 
 			fpSetPropertyByObjectTypeEnabled(devIt->instance, CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_INPUT, CASBACnetStackExampleConstants::PROPERTY_IDENTIFIER_RELIABILITY, true);
+			if (g_cov.enabled) {
+				// Enable COV Increment property
+				fpSetPropertyByObjectTypeEnabled(devIt->instance, CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_INPUT, CASBACnetStackExampleConstants::PROPERTY_IDENTIFIER_COV_INCREMENT, true);
+			}
+		}
+
+		// Add the Analog Values to the Virtual Device
+		for (uint32_t objectInstance = 1; objectInstance <= topology.analogValuesPerDevice; objectInstance++) {
+			if (!fpAddObject(devIt->instance, CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_VALUE, objectInstance)) {
+				std::cerr << "Failed to add AnalogValue. device.instance=[" << devIt->instance << "], analogValue.instance=[" << objectInstance << "]" << std::endl;
+				return -1;
+			}
 		}
 	}
+	std::cout << "OK" << std::endl;
+
+	// Startup summary
+	long long startupMs = (long long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startupTime).count();
+	std::cout << "FYI: Virtual devices ready. networks=[" << g_database.virtualNetworks.size() <<
+		"], devices=[" << g_database.virtualDevices.size() <<
+		"], analogInputs=[" << g_database.analogInputs.size() <<
+		"], analogValues=[" << g_database.analogValues.size() <<
+		"], startupTime=[" << startupMs << " ms], residentMemory=[" << GetResidentMemoryKB() << " KB]" << std::endl;
 
 	// 5. Send I-Am of this device
 	// ---------------------------------------------------------------------------
 	// To be a good citizen on a BACnet network. We should announce  ourselves when we start up. 
 	std::cout << "FYI: Sending I-AM broadcast" << std::endl;
-	uint8_t connectionString[6]; //= { 0xC0, 0xA8, 0x01, 0xFF, 0xBA, 0xC0 };
-	memcpy(connectionString, g_database.networkPort.BroadcastIPAddress, 4);
-	connectionString[4] = g_database.networkPort.BACnetIPUDPPort / 256;
-	connectionString[5] = g_database.networkPort.BACnetIPUDPPort % 256;
+	memcpy(g_broadcastConnectionString, g_database.networkPort.BroadcastIPAddress, 4);
+	g_broadcastConnectionString[4] = g_database.networkPort.BACnetIPUDPPort / 256;
+	g_broadcastConnectionString[5] = g_database.networkPort.BACnetIPUDPPort % 256;
 
 	// Send IAm for the Main Device
-	if (!fpSendIAm(g_database.mainDevice.instance, connectionString, 6, CASBACnetStackExampleConstants::NETWORK_TYPE_IP, true, 65535, NULL, 0)) {
+	if (!SendIAm(g_database.mainDevice.instance)) {
 		std::cerr << "Unable to send IAm broadcast for mainDevice.instance=[" << g_database.mainDevice.instance << "]" << std::endl;
 		return false;
 	}
 
-	// Send IAm for each virtual device
-	for (it = g_database.virtualDevices.begin(); it != g_database.virtualDevices.end(); ++it) {
-		std::vector<ExampleDatabaseDevice>::iterator devIt;
-		for (devIt = it->second.begin(); devIt != it->second.end(); ++devIt) {
-			if (!fpSendIAm(devIt->instance, connectionString, 6, CASBACnetStackExampleConstants::NETWORK_TYPE_IP, true, 65535, NULL, 0)) {
-				std::cerr << "Unable to send IAm broadcast for virtualDevice.instance=[" << devIt->instance << "]" << std::endl;
-				return false;
-			}
-		}
-	}
-
 	// Send IAmRouterToNetwork
-	if (!fpSendIAmRouterToNetwork(connectionString, 6, CASBACnetStackExampleConstants::NETWORK_TYPE_IP, true, 65535, NULL, 0)) {
+	if (!fpSendIAmRouterToNetwork(g_broadcastConnectionString, 6, CASBACnetStackExampleConstants::NETWORK_TYPE_IP, true, 65535, NULL, 0)) {
 		std::cerr << "Unable to send IAmRouterToNetwork broadcast" << std::endl;
 		return false;
 	}
 
+	// Queue the IAm for each virtual device. They are sent from the main loop at the announce rate
+	// so that thousands of virtual devices do not flood the network in one burst.
+	g_announcer.Setup(&g_database, SendIAm);
+	g_announcer.QueueVirtualDevices();
+	std::cout << "FYI: Queued " << g_announcer.GetPendingCount() << " virtual device IAm broadcasts. rate=[" << g_announcer.packetsPerSecond << " packets/s], jitter=[" << g_announcer.jitterPercent << "%]" << std::endl;
+
+	// Start checking the Analog Inputs for changes. The values set up by the database are the starting point.
+	g_cov.Setup(&g_database, ValueUpdated);
+
+	// Start the simulated field drivers. They update the Analog Input values from their own threads.
+	g_simulator.Start(&g_database);
+	if (g_simulator.IsRunning()) {
+		std::cout << "FYI: Simulating Analog Input updates. rate=[" << g_simulator.updatesPerSecond << " updates/s], threads=[" << g_simulator.threadCount << "]" << std::endl;
+	}
+
+	// Start the sharded receive path. The socket is read on its own thread and messages are
+	// queued per shard of virtual networks, the BACnet thread takes them from the shards in turn.
+	if (g_dispatcher.shardCount > 0) {
+		if (g_dispatcher.Start(&g_udp, g_database.virtualNetworks)) {
+			std::cout << "FYI: Receiving on a separate thread. shards=[" << g_dispatcher.shardCount << "], queueSize=[" << g_dispatcher.queueSize << "]" << std::endl;
+		}
+		else {
+			std::cerr << "Sharded receive needs the epoll event mode (linux only), receiving on the BACnet thread" << std::endl;
+		}
+	}
+
 	// 6. Start the main loop
 	// ---------------------------------------------------------------------------
 	std::cout << "FYI: Entering main loop..." << std::endl;
+	signal(SIGINT, HandleStopSignal);
+	signal(SIGTERM, HandleStopSignal);
+	uint64_t mainLoopUserUs, mainLoopSystemUs;
+	GetProcessCpuTimeUs(&mainLoopUserUs, &mainLoopSystemUs);
+	std::chrono::steady_clock::time_point nextStatsDump = std::chrono::steady_clock::now() + std::chrono::seconds(g_metrics.statsIntervalSeconds);
 	for (;;) {
 		// Call the DLLs loop function which checks for messages and processes them.
+		ExampleMetricsTimer loopTimer;
 		fpLoop();
+		g_metrics.Record(ExampleMetrics::HISTOGRAM_LOOP, loopTimer.GetElapsedNs());
+
+		// Decode the traced packets as XML on this thread, the CAS BACnet Stack is not thread safe
+		g_trace.Loop();
 
 		// Handle any user input.
 		// Note: User input in this example is used for the following:
 		//		h - Display options
 		//		q - Quit
-		if (!DoUserInput()) {
-			// User press 'q' to quit the example application.
+		if (!DoUserInput() || g_stopRequested) {
+			// User press 'q' to quit the example application, or the process was asked to stop.
 			break;
 		}
 
-		// Update values in the example database
+		// Update values in the example database, then tell the stack about the ones that changed
 		g_database.Loop();
+		g_cov.Loop();
+
+		// Send any I-Am announcements that are due, then send everything queued this turn
+		g_announcer.Loop();
+		g_udp.FlushMessages();
+
+		// Answer metric scrapes and print the periodic stats
+		g_metricsServer.Loop(RenderMetrics);
+		if (g_metrics.statsIntervalSeconds > 0 && std::chrono::steady_clock::now() >= nextStatsDump) {
+			nextStatsDump = std::chrono::steady_clock::now() + std::chrono::seconds(g_metrics.statsIntervalSeconds);
+			std::cout << std::endl;
+			PrintStats();
+		}
 
-		// Call Sleep to give some time back to the system
+		// Give some time back to the system
+#ifdef __GNUC__
+		// Wait for the next datagram or announcement. Returns straight away if packets are already queued.
+		int waitMs = g_udp.GetSendQueueCount() > 0 || g_cov.GetPendingCount() > 0 ? 1 : g_announcer.GetWaitTimeMs(MAIN_LOOP_IDLE_WAIT_MS);
+		if (g_dispatcher.IsRunning()) {
+			g_dispatcher.WaitForMessage(waitMs);
+		}
+		else {
+			g_udp.WaitForMessage(waitMs);
+		}
+#else
 		Sleep(0); // Windows 
+#endif // __GNUC__
 	}
 
 	// All done. 
+	g_metricsServer.Stop();
+	g_dispatcher.Stop();
+	g_simulator.Stop();
+	g_trace.Stop();
+
+	// CPU time of the main loop and the threads, without the startup. Used by make bench-cov.
+	uint64_t userUs, systemUs;
+	GetProcessCpuTimeUs(&userUs, &systemUs);
+	std::cout << "FYI: Main loop CPU time. user=[" << (userUs - mainLoopUserUs) / 1000 << " ms], system=[" << (systemUs - mainLoopSystemUs) / 1000 << " ms]" << std::endl;
 	return 0;
 }
 
 // Helper Functions
 
+// Reads the command line. Options are given as --name value or --name=value,
+// see PrintUsage() for the list.
+bool LoadArguments(int argc, char* argv[])
+{
+	for (int offset = 1; offset < argc; offset++) {
+		std::string argument = argv[offset];
+		if (argument == "-h" || argument == "--help") {
+			return false;
+		}
+		if (argument.compare(0, 2, "--") != 0) {
+			std::cerr << "Unexpected argument [" << argument << "]" << std::endl;
+			return false;
+		}
+
+		std::string name, value;
+		size_t equals = argument.find('=');
+		if (equals != std::string::npos) {
+			name = argument.substr(2, equals - 2);
+			value = argument.substr(equals + 1);
+		}
+		else {
+			name = argument.substr(2);
+			if (offset + 1 >= argc) {
+				std::cerr << "Missing value for option [" << name << "]" << std::endl;
+				return false;
+			}
+			value = argv[++offset];
+		}
+
+		if (!SetOption(name, value)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Reads a config file with one "name = value" option per line. Lines starting with # are ignored.
+// includeDepth is the number of config files being read, including this one.
+bool LoadConfigFile(const std::string & path, const uint32_t includeDepth)
+{
+	std::ifstream file(path.c_str());
+	if (!file.is_open()) {
+		std::cerr << "Could not open config file [" << path << "]" << std::endl;
+		return false;
+	}
+
+	const char* whitespace = " \t\r\n";
+	std::string line;
+	size_t lineNumber = 0;
+	while (std::getline(file, line)) {
+		lineNumber++;
+		size_t first = line.find_first_not_of(whitespace);
+		if (first == std::string::npos || line[first] == '#') {
+			continue;
+		}
+
+		size_t equals = line.find('=');
+		if (equals == std::string::npos) {
+			std::cerr << "Config file [" << path << "] line " << lineNumber << ": expected name = value" << std::endl;
+			return false;
+		}
+		std::string name = line.substr(first, equals - first);
+		std::string value = line.substr(equals + 1);
+		name.erase(name.find_last_not_of(whitespace) + 1);
+		value.erase(0, value.find_first_not_of(whitespace));
+		value.erase(value.find_last_not_of(whitespace) + 1);
+
+		if (!SetOption(name, value, includeDepth)) {
+			std::cerr << "Config file [" << path << "] line " << lineNumber << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+// Applies one option from the command line or config file. includeDepth is the number of
+// config files being read, 0 on the command line.
+bool SetOption(const std::string & name, const std::string & value, const uint32_t includeDepth)
+{
+	if (name == "config") {
+		if (includeDepth >= CONFIG_MAX_INCLUDE_DEPTH) {
+			std::cerr << "Config file [" << value << "] is included more than " << CONFIG_MAX_INCLUDE_DEPTH << " deep, does a config file include itself?" << std::endl;
+			return false;
+		}
+		return LoadConfigFile(value, includeDepth + 1);
+	}
+	if (name == "receive-mode" && (value == "event" || value == "poll")) {
+		g_receiveEventMode = value == "event";
+		return true;
+	}
+	if (g_database.topology.SetOption(name, value)) {
+		return true;
+	}
+	if (g_announcer.SetOption(name, value)) {
+		return true;
+	}
+	if (g_trace.SetOption(name, value)) {
+		return true;
+	}
+	if (g_simulator.SetOption(name, value)) {
+		return true;
+	}
+	if (g_cov.SetOption(name, value)) {
+		return true;
+	}
+	if (g_dispatcher.SetOption(name, value)) {
+		return true;
+	}
+	if (g_metrics.SetOption(name, value)) {
+		return true;
+	}
+	if (g_metricsServer.SetOption(name, value)) {
+		return true;
+	}
+	std::cerr << "Unknown option or invalid value. " << name << "=[" << value << "]" << std::endl;
+	return false;
+}
+
+void PrintUsage()
+{
+	std::cout << std::endl;
+	std::cout << "Usage: BACnetVirtualDevicesServerExampleCPP [options]" << std::endl;
+	std::cout << "Options are given as --name value or --name=value" << std::endl;
+	std::cout << "  --config <file>                    Load options from a file, one name = value per line" << std::endl;
+	std::cout << "  --networks <count>                 Number of virtual networks (default " << NUMBER_OF_VIRTUAL_NETWORKS << ")" << std::endl;
+	std::cout << "  --first-network <number>           First virtual network number (default " << STARTING_VIRTUAL_NETWORK << ")" << std::endl;
+	std::cout << "  --network-offset <number>          Gap between virtual network numbers (default " << VIRTUAL_NETWORK_OFFSET << ")" << std::endl;
+	std::cout << "  --devices-per-network <count>      Virtual devices on each network (default " << NUMBER_OF_DEVICES_PER_NETWORK << ")" << std::endl;
+	std::cout << "  --first-device-instance <number>   Instance of the first virtual device (default " << STARTING_DEVICE_INSTANCE << ")" << std::endl;
+	std::cout << "  --device-instance-offset <number>  Gap between the first device instance of each network (default " << DEVICE_INSTANCE_OFFSET << ")" << std::endl;
+	std::cout << "  --analog-inputs-per-device <count> Analog Input objects in each virtual device (default " << NUMBER_OF_ANALOG_INPUTS_PER_DEVICE << ")" << std::endl;
+	std::cout << "  --analog-values-per-device <count> Analog Value objects in each virtual device (default " << NUMBER_OF_ANALOG_VALUES_PER_DEVICE << ")" << std::endl;
+	std::cout << "  --device-name <template>           Virtual device name, {network} {device} and {instance} are replaced" << std::endl;
+	std::cout << "  --analog-input-name <template>     Analog Input name template" << std::endl;
+	std::cout << "  --analog-value-name <template>     Analog Value name template" << std::endl;
+	std::cout << "  --announce-rate <packets/s>        Max rate of virtual device I-Am broadcasts, 0 for no limit (default " << ANNOUNCE_PACKETS_PER_SECOND << ")" << std::endl;
+	std::cout << "  --announce-jitter <percent>        Random variation of the gap between I-Am broadcasts (default " << ANNOUNCE_JITTER_PERCENT << ")" << std::endl;
+	std::cout << "  --announce-burst <count>           I-Am broadcasts that can be sent back to back after an idle period (default " << ANNOUNCE_MAX_BURST << ")" << std::endl;
+	std::cout << "  --trace <off|summary|xml>          Packet trace written to the console (default off)" << std::endl;
+	std::cout << "  --pcap <file>                      Capture all sent and received packets to a pcap file" << std::endl;
+	std::cout << "  --cov <on|off>                     SubscribeCOV on the virtual devices (default on)" << std::endl;
+	std::cout << "  --cov-increment <value>            COV increment of the Analog Inputs (default " << ANALOG_INPUT_COV_INCREMENT << ")" << std::endl;
+	std::cout << "  --cov-updates-per-loop <count>     Changed values checked for COV per main loop (default " << COV_MAX_UPDATES_PER_LOOP << ")" << std::endl;
+	std::cout << "  --receive-mode <event|poll>        event waits on epoll, poll blocks in recvfrom for up to 1 s like earlier versions (default event, linux only)" << std::endl;
+	std::cout << "  --shards <count>                   Read the socket on its own thread and queue messages per shard of virtual networks, 0 is off (default 0, linux only)" << std::endl;
+	std::cout << "  --shard-queue-size <count>         Messages each shard can queue, a power of two (default " << DISPATCHER_QUEUE_SIZE << ")" << std::endl;
+	std::cout << "  --simulate-rate <count>            Simulated Analog Input updates per second, 0 is off (default 0)" << std::endl;
+	std::cout << "  --simulate-threads <count>         Simulated field driver threads (default 1)" << std::endl;
+	std::cout << "  --stats-interval <seconds>         Print the stats every few seconds, 0 is off (default 0)" << std::endl;
+	std::cout << "  --metrics-port <port>              Serve Prometheus metrics on http://<address>:<port>/metrics, 0 is off (default 0)" << std::endl;
+	std::cout << "  --metrics-address <ip>             Address the metrics endpoint listens on (default " << METRICS_SERVER_ADDRESS << ")" << std::endl;
+	std::cout << std::endl;
+}
+
+// Sends an I-Am for one device, as a broadcast or to the device that sent the Who-Is. Used by the announcer.
+bool SendIAm(const uint32_t deviceInstance, const ExampleAnnouncerDestination* destination)
+{
+	if (destination == NULL) {
+		return fpSendIAm(deviceInstance, g_broadcastConnectionString, 6, CASBACnetStackExampleConstants::NETWORK_TYPE_IP, true, 65535, NULL, 0);
+	}
+	return fpSendIAm(deviceInstance, destination->connectionString, 6, CASBACnetStackExampleConstants::NETWORK_TYPE_IP, false, destination->network,
+		destination->addressLength > 0 ? destination->address : NULL, destination->addressLength);
+}
+
+// Tells the CAS BACnet Stack that a value changed, it sends COV notifications to the subscribers.
+void ValueUpdated(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, const uint32_t propertyIdentifier)
+{
+	fpValueUpdated(deviceInstance, objectType, objectInstance, propertyIdentifier);
+}
+
+// Renders a message as XML for the packet trace. Called from the main loop by ExampleTrace::Loop().
+uint32_t DecodeAsXML(const uint8_t* message, const uint16_t messageLength, char* buffer, const uint32_t maxBufferLength)
+{
+	return fpDecodeAsXML((char*)message, messageLength, buffer, maxBufferLength);
+}
+
+// Prints a snapshot of the stats. Used by the 'h' command and the periodic stats dump.
+void PrintStats()
+{
+	unsigned long long queued, sent, dropped;
+	g_udp.GetSendCounters(&queued, &sent, &dropped);
+	std::cout << "Send queue: queued=[" << queued << "], sent=[" << sent << "], dropped=[" << dropped << "], disconnects=[" << g_udp.GetSendDisconnectCount() << "]" << std::endl;
+	std::cout << "Announcements: pending=[" << g_announcer.GetPendingCount() << "], sent=[" << g_announcer.announcementsSent << "], failed=[" << g_announcer.announcementsFailed << "], whoIsHandled=[" << g_announcer.whoIsHandled << "], whoIsReplying=[" << g_announcer.GetWhoIsReplyCount() << "], whoIsDropped=[" << g_announcer.whoIsDropped << "]" << std::endl;
+	std::cout << "Value updates: applied=[" << g_database.valueUpdatesApplied.load() << "], stale=[" << g_database.valueUpdatesStale.load() << "], unknown=[" << g_database.valueUpdatesUnknown.load() << "]" << std::endl;
+	std::cout << "COV: collected=[" << g_cov.changesCollected << "], reported=[" << g_cov.valuesReported << "], suppressed=[" << g_cov.changesSuppressed << "], pending=[" << g_cov.GetPendingCount() << "]" << std::endl;
+	for (uint32_t shard = 0; g_dispatcher.IsRunning() && shard < g_dispatcher.shardCount; shard++) {
+		ExampleDispatcherShardStats stats = g_dispatcher.GetShardStats(shard);
+		std::cout << "Shard " << shard << ": networks=[" << stats.networks << "], received=[" << stats.received << "], dropped=[" << stats.dropped << "], processed=[" << stats.processed << "], queued=[" << stats.queued << "]" << std::endl;
+	}
+	std::cout << "Packet trace: level=[" << ExampleTrace::GetLevelName(g_trace.GetLevel()) << "], dropped=[" << g_trace.GetDroppedCount() << "]" << std::endl;
+	std::cout << "Metrics endpoint: running=[" << (g_metricsServer.IsRunning() ? "yes" : "no") << "], requests=[" << g_metricsServer.requestsServed << "]" << std::endl;
+	uint64_t userUs, systemUs;
+	GetProcessCpuTimeUs(&userUs, &systemUs);
+	std::cout << "Process CPU time: user=[" << userUs / 1000 << " ms], system=[" << systemUs / 1000 << " ms]" << std::endl;
+
+	ExampleMetrics::Snapshot snapshot;
+	g_metrics.GetSnapshot(snapshot);
+	ExampleMetrics::WriteSummary(snapshot, std::cout);
+}
+
+// Renders all the metrics in the Prometheus text format. Called by the metrics endpoint from the main loop.
+void RenderMetrics(std::string & output)
+{
+	ExampleMetrics::Snapshot snapshot;
+	g_metrics.GetSnapshot(snapshot);
+	ExampleMetrics::WritePrometheus(snapshot, output);
+
+	unsigned long long queued, sent, dropped;
+	g_udp.GetSendCounters(&queued, &sent, &dropped);
+	ExampleMetrics::AppendCounter(output, "udp_queued_total", "Datagrams queued for sending", queued);
+	ExampleMetrics::AppendCounter(output, "udp_sent_total", "Datagrams written to the socket", sent);
+	ExampleMetrics::AppendCounter(output, "udp_dropped_total", "Queued datagrams that could not be sent", dropped);
+	ExampleMetrics::AppendCounter(output, "udp_send_disconnects_total", "Send failures that disconnected the socket", g_udp.GetSendDisconnectCount());
+	ExampleMetrics::AppendGauge(output, "udp_send_queue", "Datagrams waiting in the send queue", g_udp.GetSendQueueCount());
+
+	ExampleMetrics::AppendGauge(output, "announcements_pending", "I-Am broadcasts waiting to be sent", g_announcer.GetPendingCount());
+	ExampleMetrics::AppendCounter(output, "announcements_sent_total", "I-Am broadcasts sent", g_announcer.announcementsSent);
+	ExampleMetrics::AppendCounter(output, "announcements_failed_total", "I-Am broadcasts that failed", g_announcer.announcementsFailed);
+	ExampleMetrics::AppendCounter(output, "who_is_handled_total", "Who-Is requests answered by the announcer", g_announcer.whoIsHandled);
+	ExampleMetrics::AppendGauge(output, "who_is_replying", "Who-Is requests still being answered", g_announcer.GetWhoIsReplyCount());
+	ExampleMetrics::AppendCounter(output, "who_is_dropped_total", "Who-Is requests not answered because too many were queued", g_announcer.whoIsDropped);
+
+	ExampleMetrics::AppendCounter(output, "value_updates_applied_total", "Analog Input value updates applied", g_database.valueUpdatesApplied.load());
+	ExampleMetrics::AppendCounter(output, "value_updates_stale_total", "Analog Input value updates older than the current value", g_database.valueUpdatesStale.load());
+	ExampleMetrics::AppendCounter(output, "value_updates_unknown_total", "Value updates for objects that do not exist", g_database.valueUpdatesUnknown.load());
+
+	ExampleMetrics::AppendCounter(output, "cov_changes_collected_total", "Changed Analog Inputs checked for COV", g_cov.changesCollected);
+	ExampleMetrics::AppendCounter(output, "cov_values_reported_total", "Changes reported to the CAS BACnet Stack", g_cov.valuesReported);
+	ExampleMetrics::AppendCounter(output, "cov_changes_suppressed_total", "Changes smaller than the COV increment", g_cov.changesSuppressed);
+	ExampleMetrics::AppendGauge(output, "cov_pending", "Changed Analog Inputs waiting to be checked", g_cov.GetPendingCount());
+
+	ExampleMetrics::AppendCounter(output, "trace_dropped_total", "Packets the trace thread could not keep up with", g_trace.GetDroppedCount());
+
+	uint64_t userUs, systemUs;
+	GetProcessCpuTimeUs(&userUs, &systemUs);
+	ExampleMetrics::AppendCounter(output, "cpu_user_microseconds_total", "CPU time of the process in user mode, all threads", userUs);
+	ExampleMetrics::AppendCounter(output, "cpu_system_microseconds_total", "CPU time of the process in kernel mode, all threads", systemUs);
+
+	if (g_dispatcher.IsRunning()) {
+		static const char* SHARD_SERIES[4][3] = {
+			{ "shard_received_total", "Messages queued on the shard", "counter" },
+			{ "shard_dropped_total", "Messages dropped because the shard queue was full", "counter" },
+			{ "shard_processed_total", "Messages taken from the shard by the BACnet thread", "counter" },
+			{ "shard_queued", "Messages waiting in the shard queue", "gauge" }
+		};
+		for (size_t series = 0; series < 4; series++) {
+			char line[256];
+			snprintf(line, sizeof(line), "# HELP bacnet_server_%s %s\n# TYPE bacnet_server_%s %s\n", SHARD_SERIES[series][0], SHARD_SERIES[series][1], SHARD_SERIES[series][0], SHARD_SERIES[series][2]);
+			output += line;
+			for (uint32_t shard = 0; shard < g_dispatcher.shardCount; shard++) {
+				ExampleDispatcherShardStats stats = g_dispatcher.GetShardStats(shard);
+				unsigned long long values[4] = { (unsigned long long)stats.received, (unsigned long long)stats.dropped, (unsigned long long)stats.processed, (unsigned long long)stats.queued };
+				snprintf(line, sizeof(line), "bacnet_server_%s{shard=\"%u\"} %llu\n", SHARD_SERIES[series][0], shard, values[series]);
+				output += line;
+			}
+		}
+	}
+}
+
+// Returns the resident memory of this process in KB, or zero if it is not known.
+size_t GetResidentMemoryKB()
+{
+#ifdef __GNUC__
+	FILE* file = fopen("/proc/self/status", "r");
+	if (file == NULL) {
+		return 0;
+	}
+	char line[256];
+	size_t residentMemory = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (strncmp(line, "VmRSS:", 6) == 0) {
+			residentMemory = (size_t)strtoul(line + 6, NULL, 10);
+			break;
+		}
+	}
+	fclose(file);
+	return residentMemory;
+#else
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return 0;
+	}
+	return counters.WorkingSetSize / 1024;
+#endif // __GNUC__
+}
+
+// Returns the CPU time this process has used so far, all threads, in microseconds.
+void GetProcessCpuTimeUs(uint64_t* userUs, uint64_t* systemUs)
+{
+	*userUs = 0;
+	*systemUs = 0;
+#ifdef __GNUC__
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return;
+	}
+	*userUs = (uint64_t)usage.ru_utime.tv_sec * 1000000 + (uint64_t)usage.ru_utime.tv_usec;
+	*systemUs = (uint64_t)usage.ru_stime.tv_sec * 1000000 + (uint64_t)usage.ru_stime.tv_usec;
+#else
+	FILETIME creationTime, exitTime, kernelTime, userTime;
+	if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+		return;
+	}
+	// In 100 ns units
+	*userUs = ((((uint64_t)userTime.dwHighDateTime) << 32) | userTime.dwLowDateTime) / 10;
+	*systemUs = ((((uint64_t)kernelTime.dwHighDateTime) << 32) | kernelTime.dwLowDateTime) / 10;
+#endif // __GNUC__
+}
+
+// Asks the main loop to stop, so the threads are stopped and the CPU time is printed
+void HandleStopSignal(int)
+{
+	g_stopRequested = 1;
+}
+
 // Handle any user input.
 // Note: User input in this example is used for the following:
 //		h - Display options
+//		t - Cycle the trace level
 //		q - Quit
 bool DoUserInput()
 {
@@ -303,6 +785,13 @@ bool DoUserInput()
 	case 'q': {
 		return false;
 	}
+	// Cycle the trace level
+	case 't': {
+		ExampleTrace::Level level = (ExampleTrace::Level)((g_trace.GetLevel() + 1) % (ExampleTrace::LEVEL_XML + 1));
+		g_trace.SetLevel(level);
+		std::cout << std::endl << "FYI: Packet trace=[" << ExampleTrace::GetLevelName(level) << "]" << std::endl;
+		break;
+	}
 	case 'h':
 	default: {
 		// Print the Help
@@ -313,8 +802,12 @@ bool DoUserInput()
 
 		std::cout << "Help:" << std::endl;
 		std::cout << "h - (h)elp" << std::endl;
+		std::cout << "t - cycle the packet (t)race level: off, summary, xml" << std::endl;
 		std::cout << "q - (q)uit" << std::endl;
 		std::cout << std::endl;
+
+		PrintStats();
+		std::cout << std::endl;
 		break;
 	}
 	}
@@ -339,19 +832,31 @@ uint16_t CallbackReceiveMessage(uint8_t* message, const uint16_t maxMessageLengt
 		return 0;
 	}
 
-	char ipAddress[32];
 	uint16_t port = 0;
 
 	// Attempt to read bytes
-	int bytesRead = g_udp.GetMessage(message, maxMessageLength, ipAddress, &port);
-	if (bytesRead > 0) {
-		ChipkinCommon::CEndianness::ToBigEndian(&port, sizeof(uint16_t));
-		std::cout << std::endl << "FYI: Received message from [" << ipAddress << ":" << port << "], length [" << bytesRead << "]" << std::endl;
-
-		// Convert the IP Address to the connection string
-		if (!ChipkinCommon::ChipkinConvert::IPAddressToBytes(ipAddress, receivedConnectionString, maxConnectionStringLength)) {
-			std::cerr << "Failed to convert the ip address into a connectionString" << std::endl;
-			return 0;
+	for (;;) {
+		int bytesRead;
+		if (g_dispatcher.IsRunning()) {
+			// Already read from the socket by the receive thread, the address is in bytes
+			bytesRead = g_dispatcher.GetMessage(message, maxMessageLength, receivedConnectionString, &port);
+		}
+		else {
+			char ipAddress[32];
+			bytesRead = g_udp.GetMessage(message, maxMessageLength, ipAddress, &port);
+			if (bytesRead > 0) {
+				ChipkinCommon::CEndianness::ToBigEndian(&port, sizeof(uint16_t));
+
+				// Convert the IP Address to the connection string
+				if (!ChipkinCommon::ChipkinConvert::IPAddressToBytes(ipAddress, receivedConnectionString, maxConnectionStringLength)) {
+					std::cerr << "Failed to convert the ip address into a connectionString" << std::endl;
+					g_metrics.Add(ExampleMetrics::COUNTER_RECEIVE_ERRORS);
+					return 0;
+				}
+			}
+		}
+		if (bytesRead <= 0) {
+			break;
 		}
 		receivedConnectionString[4] = port / 256;
 		receivedConnectionString[5] = port % 256;
@@ -359,15 +864,23 @@ uint16_t CallbackReceiveMessage(uint8_t* message, const uint16_t maxMessageLengt
 		*receivedConnectionStringLength = 6;
 		*networkType = CASBACnetStackExampleConstants::NETWORK_TYPE_IP;
 
-		// Process the message as XML
-		static char xmlRenderBuffer[MAX_XML_RENDER_BUFFER_LENGTH];
-		if (fpDecodeAsXML((char*)message, bytesRead, xmlRenderBuffer, MAX_XML_RENDER_BUFFER_LENGTH) > 0) {
-			std::cout << xmlRenderBuffer << std::endl;
-			memset(xmlRenderBuffer, 0, MAX_XML_RENDER_BUFFER_LENGTH);
+		g_metrics.Add(ExampleMetrics::COUNTER_RECEIVED_PACKETS);
+		g_metrics.Add(ExampleMetrics::COUNTER_RECEIVED_BYTES, (uint64_t)bytesRead);
+
+		// Hand the message to the trace thread
+		if (g_trace.IsEnabled()) {
+			g_trace.Capture(false, message, (uint16_t)bytesRead, receivedConnectionString, port);
+		}
+
+		// Who-Is requests for the virtual devices are answered by the announcer at the announce
+		// rate. Move on to the next message instead of passing it to the stack.
+		if (g_announcer.HandleWhoIs(message, (uint16_t)bytesRead, receivedConnectionString, 6)) {
+			continue;
 		}
+		return bytesRead;
 	}
 
-	return bytesRead;
+	return 0;
 }
 
 // Callback used by the BACnet Stack to send a BACnet message
@@ -389,16 +902,9 @@ uint16_t CallbackSendMessage(const uint8_t* message, const uint16_t messageLengt
 	}
 
 	// Prepare the IP Address
-	char ipAddress[32];
-	if (broadcast) {
-		snprintf(ipAddress, 32, "%hhu.%hhu.%hhu.%hhu",
-			connectionString[0] | ~g_database.networkPort.IPSubnetMask[0],
-			connectionString[1] | ~g_database.networkPort.IPSubnetMask[1],
-			connectionString[2] | ~g_database.networkPort.IPSubnetMask[2],
-			connectionString[3] | ~g_database.networkPort.IPSubnetMask[3]);
-	}
-	else {
-		snprintf(ipAddress, 32, "%u.%u.%u.%u", connectionString[0], connectionString[1], connectionString[2], connectionString[3]);
+	uint8_t ipAddress[4];
+	for (size_t offset = 0; offset < 4; offset++) {
+		ipAddress[offset] = broadcast ? (uint8_t)(connectionString[offset] | ~g_database.networkPort.IPSubnetMask[offset]) : connectionString[offset];
 	}
 
 	// Get the port
@@ -406,19 +912,18 @@ uint16_t CallbackSendMessage(const uint8_t* message, const uint16_t messageLengt
 	port += connectionString[4] * 256;
 	port += connectionString[5];
 
-	std::cout << std::endl << "FYI: Sending message to [" << ipAddress << ":" << port << "] length [" << messageLength << "]" << std::endl;
-
-	// Send the message
-	if (!g_udp.SendMessage(ipAddress, port, (unsigned char*)message, messageLength)) {
+	// Queue the message, the queue is flushed once per loop
+	if (!g_udp.QueueMessage(ipAddress, port, message, messageLength)) {
 		std::cout << "Failed to send message" << std::endl;
+		g_metrics.Add(ExampleMetrics::COUNTER_SEND_ERRORS);
 		return 0;
 	}
+	g_metrics.Add(ExampleMetrics::COUNTER_SENT_PACKETS);
+	g_metrics.Add(ExampleMetrics::COUNTER_SENT_BYTES, messageLength);
 
-	// Get the XML rendered version of the just sent message
-	static char xmlRenderBuffer[MAX_XML_RENDER_BUFFER_LENGTH];
-	if (fpDecodeAsXML((char*)message, messageLength, xmlRenderBuffer, MAX_XML_RENDER_BUFFER_LENGTH) > 0) {
-		std::cout << xmlRenderBuffer << std::endl;
-		memset(xmlRenderBuffer, 0, MAX_XML_RENDER_BUFFER_LENGTH);
+	// Hand the message to the trace thread
+	if (g_trace.IsEnabled()) {
+		g_trace.Capture(true, message, messageLength, ipAddress, port);
 	}
 
 	return messageLength;
@@ -430,6 +935,48 @@ time_t CallbackGetSystemTime()
 	return time(0);
 }
 
+// Timed wrappers of the GetProperty callbacks. The CAS BACnet Stack calls these, they record
+// the time spent in the callback by object type and property.
+bool TimedGetPropertyCharString(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, const uint32_t propertyIdentifier, char* value, uint32_t* valueElementCount, const uint32_t maxElementCount, uint8_t* encodingType, const bool useArrayIndex, const uint32_t propertyArrayIndex)
+{
+	ExampleMetricsTimer timer;
+	bool found = CallbackGetPropertyCharString(deviceInstance, objectType, objectInstance, propertyIdentifier, value, valueElementCount, maxElementCount, encodingType, useArrayIndex, propertyArrayIndex);
+	g_metrics.RecordGetProperty(ExampleMetrics::GET_PROPERTY_CHARACTER_STRING, objectType, propertyIdentifier, found, timer.GetElapsedNs());
+	return found;
+}
+
+bool TimedGetPropertyEnum(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, const uint32_t propertyIdentifier, uint32_t* value, const bool useArrayIndex, const uint32_t propertyArrayIndex)
+{
+	ExampleMetricsTimer timer;
+	bool found = CallbackGetPropertyEnum(deviceInstance, objectType, objectInstance, propertyIdentifier, value, useArrayIndex, propertyArrayIndex);
+	g_metrics.RecordGetProperty(ExampleMetrics::GET_PROPERTY_ENUMERATED, objectType, propertyIdentifier, found, timer.GetElapsedNs());
+	return found;
+}
+
+bool TimedGetPropertyOctetString(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, const uint32_t propertyIdentifier, uint8_t* value, uint32_t* valueElementCount, const uint32_t maxElementCount, const bool useArrayIndex, const uint32_t propertyArrayIndex)
+{
+	ExampleMetricsTimer timer;
+	bool found = CallbackGetPropertyOctetString(deviceInstance, objectType, objectInstance, propertyIdentifier, value, valueElementCount, maxElementCount, useArrayIndex, propertyArrayIndex);
+	g_metrics.RecordGetProperty(ExampleMetrics::GET_PROPERTY_OCTET_STRING, objectType, propertyIdentifier, found, timer.GetElapsedNs());
+	return found;
+}
+
+bool TimedGetPropertyReal(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, const uint32_t propertyIdentifier, float* value, const bool useArrayIndex, const uint32_t propertyArrayIndex)
+{
+	ExampleMetricsTimer timer;
+	bool found = CallbackGetPropertyReal(deviceInstance, objectType, objectInstance, propertyIdentifier, value, useArrayIndex, propertyArrayIndex);
+	g_metrics.RecordGetProperty(ExampleMetrics::GET_PROPERTY_REAL, objectType, propertyIdentifier, found, timer.GetElapsedNs());
+	return found;
+}
+
+bool TimedGetPropertyUInt(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, const uint32_t propertyIdentifier, uint32_t* value, const bool useArrayIndex, const uint32_t propertyArrayIndex)
+{
+	ExampleMetricsTimer timer;
+	bool found = CallbackGetPropertyUInt(deviceInstance, objectType, objectInstance, propertyIdentifier, value, useArrayIndex, propertyArrayIndex);
+	g_metrics.RecordGetProperty(ExampleMetrics::GET_PROPERTY_UNSIGNED_INTEGER, objectType, propertyIdentifier, found, timer.GetElapsedNs());
+	return found;
+}
+
 // Callback used by the BACnet Stack to get Character String property values from the user
 bool CallbackGetPropertyCharString(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, const uint32_t propertyIdentifier, char* value, uint32_t* valueElementCount, const uint32_t maxElementCount, uint8_t* encodingType, const bool useArrayIndex, const uint32_t propertyArrayIndex)
 {
@@ -450,11 +997,8 @@ bool CallbackGetPropertyEnum(uint32_t deviceInstance, uint16_t objectType, uint3
 	// Example of Analog Inputs Reliability Property
 	if (propertyIdentifier == CASBACnetStackExampleConstants::PROPERTY_IDENTIFIER_RELIABILITY) {
 		if (objectType == CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_INPUT) {
-			if (g_database.analogInputs.count(deviceInstance) > 0 && g_database.analogInputs[deviceInstance].instance == objectInstance) {
-				*value = g_database.analogInputs[deviceInstance].reliability;
-				return true;
-			}
-			return false;
+			// Live value, may be updated by a field driver on another thread
+			return g_database.GetAnalogInputValue(deviceInstance, objectInstance, NULL, value);
 		}
 	}
 
@@ -467,16 +1011,10 @@ bool CallbackGetPropertyEnum(uint32_t deviceInstance, uint16_t objectType, uint3
 			return true;
 		}
 		else {
-			std::map<uint16_t, std::vector<ExampleDatabaseDevice> >::iterator it;
-			for (it = g_database.virtualDevices.begin(); it != g_database.virtualDevices.end(); ++it) {
-				std::vector<ExampleDatabaseDevice>::iterator devIt;
-				for (devIt = it->second.begin(); devIt != it->second.end(); ++devIt) {
-
-					if (objectType == devIt->instance) {
-						*value = devIt->systemStatus;
-						return true;
-					}
-				}
+			ExampleDatabaseVirtualDevice* device = g_database.GetVirtualDevice(objectInstance);
+			if (device != NULL) {
+				*value = device->systemStatus;
+				return true;
 			}
 			return false;
 		}
@@ -535,8 +1073,24 @@ bool CallbackGetPropertyReal(uint32_t deviceInstance, uint16_t objectType, uint3
 	// Example of Analog Input / Value Object Present Value property
 	if (propertyIdentifier == CASBACnetStackExampleConstants::PROPERTY_IDENTIFIER_PRESENT_VALUE) {
 		if (objectType == CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_INPUT) {
-			if (g_database.analogInputs.count(deviceInstance) > 0 && g_database.analogInputs[deviceInstance].instance == objectInstance) {
-				*value = g_database.analogInputs[deviceInstance].presentValue;
+			// Live value, may be updated by a field driver on another thread
+			return g_database.GetAnalogInputValue(deviceInstance, objectInstance, value, NULL);
+		}
+		else if (objectType == CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_VALUE) {
+			ExampleDatabaseAnalogValue* analogValue = g_database.GetAnalogValue(deviceInstance, objectInstance);
+			if (analogValue != NULL) {
+				*value = analogValue->presentValue;
+				return true;
+			}
+			return false;
+		}
+	}
+	// Example of Analog Input COV Increment property
+	else if (propertyIdentifier == CASBACnetStackExampleConstants::PROPERTY_IDENTIFIER_COV_INCREMENT) {
+		if (objectType == CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_INPUT) {
+			ExampleDatabaseAnalogInput* analogInput = g_database.GetAnalogInput(deviceInstance, objectInstance);
+			if (analogInput != NULL) {
+				*value = analogInput->covIncrement;
 				return true;
 			}
 			return false;
@@ -597,37 +1151,11 @@ bool GetObjectName(const uint32_t deviceInstance, const uint16_t objectType, con
 		*valueElementCount = (uint32_t)stringSize;
 		return true;
 	}
-	else if (objectType == CASBACnetStackExampleConstants::OBJECT_TYPE_DEVICE) {
-		// Get the name of a virtual device
-		std::map<uint16_t, std::vector<ExampleDatabaseDevice> >::iterator it;
-		for (it = g_database.virtualDevices.begin(); it != g_database.virtualDevices.end(); ++it) {
-			std::vector<ExampleDatabaseDevice>::iterator devIt;
-			for (devIt = it->second.begin(); devIt != it->second.end(); ++devIt) {
-				if (objectInstance == devIt->instance) {
-					stringSize = devIt->objectName.size();
-					if (stringSize > maxElementCount) {
-						std::cerr << "Error - not enough space to store full name of objectType=[" << objectType << "], objectInstance=[" << objectInstance << " ]" << std::endl;
-						return false;
-					}
-					memcpy(value, devIt->objectName.c_str(), stringSize);
-					*valueElementCount = (uint32_t)stringSize;
-					return true;
-				}
-			}
-		}
-	}
-	else if (objectType == CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_INPUT) {
-		// Get the name of an analog input
-		if (g_database.analogInputs.count(deviceInstance) > 0 && g_database.analogInputs[deviceInstance].instance == objectInstance) {
-			stringSize = g_database.analogInputs[deviceInstance].objectName.size();
-			if (stringSize > maxElementCount) {
-				std::cerr << "Error - not enough space to store full name of objectType=[" << objectType << "], objectInstance=[" << objectInstance << " ]" << std::endl;
-				return false;
-			}
-			memcpy(value, g_database.analogInputs[deviceInstance].objectName.c_str(), stringSize);
-			*valueElementCount = (uint32_t)stringSize;
-			return true;
-		}
+	else if (objectType == CASBACnetStackExampleConstants::OBJECT_TYPE_DEVICE ||
+		objectType == CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_INPUT ||
+		objectType == CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_VALUE) {
+		// Get the name of a virtual device or one of its objects. The name is built from the topology name template.
+		return g_database.GetVirtualObjectName(deviceInstance, objectType, objectInstance, value, valueElementCount, maxElementCount);
 	}
 	else if (objectType == CASBACnetStackExampleConstants::OBJECT_TYPE_NETWORK_PORT) {
 		// Get the name of a virtual network port object
@@ -663,22 +1191,8 @@ bool GetDeviceDescription(const uint32_t deviceInstance, char* value, uint32_t*
 		return true;
 	}
 	else {
-		std::map<uint16_t, std::vector<ExampleDatabaseDevice> >::iterator it;
-		for (it = g_database.virtualDevices.begin(); it != g_database.virtualDevices.end(); ++it) {
-			std::vector<ExampleDatabaseDevice>::iterator devIt;
-			for (devIt = it->second.begin(); devIt != it->second.end(); ++devIt) {
-				if (deviceInstance == devIt->instance) {
-					stringSize = devIt->objectName.size();
-					if (stringSize > maxElementCount) {
-						std::cerr << "Error - not enough space to store full description for deviceInstance=[" << deviceInstance << " ]" << std::endl;
-						return false;
-					}
-					memcpy(value, devIt->objectName.c_str(), stringSize);
-					*valueElementCount = (uint32_t)stringSize;
-					return true;
-				}
-			}
-		}
+		// Virtual devices use their name as the description
+		return g_database.GetVirtualObjectName(deviceInstance, CASBACnetStackExampleConstants::OBJECT_TYPE_DEVICE, deviceInstance, value, valueElementCount, maxElementCount);
 	}
 
 	return false;
@@ -0,0 +1,341 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * CASBACnetStackExampleAnnouncer.cpp
+ *
+ * Paced I-Am announcements for the virtual devices.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#include "CASBACnetStackExampleAnnouncer.h"
+
+#include <algorithm> // std::lower_bound, std::binary_search
+#include <stdlib.h> // strtoul()
+#include <string.h> // memcpy(), memset()
+#include <time.h> // time()
+
+// BACnet encoding
+static const uint8_t BVLL_TYPE_BACNET_IP = 0x81;
+static const uint8_t BVLL_FUNCTION_FORWARDED_NPDU = 0x04;
+static const uint8_t BVLL_FUNCTION_ORIGINAL_UNICAST_NPDU = 0x0A;
+static const uint8_t BVLL_FUNCTION_ORIGINAL_BROADCAST_NPDU = 0x0B;
+static const uint8_t NPDU_VERSION = 0x01;
+static const uint8_t NPDU_CONTROL_NETWORK_MESSAGE = 0x80;
+static const uint8_t NPDU_CONTROL_DESTINATION = 0x20;
+static const uint8_t NPDU_CONTROL_SOURCE = 0x08;
+static const uint8_t APDU_TYPE_UNCONFIRMED_REQUEST = 0x10;
+static const uint8_t SERVICE_UNCONFIRMED_WHO_IS = 8;
+static const uint16_t GLOBAL_BROADCAST_NETWORK = 0xFFFF;
+
+// Decodes an unsigned integer with the given context tag number. Advances offset past it.
+static bool DecodeContextUnsigned(const uint8_t* message, const uint16_t length, uint16_t* offset, const uint8_t tagNumber, uint32_t* value)
+{
+	if (*offset >= length) {
+		return false;
+	}
+	uint8_t tag = message[*offset];
+	uint8_t valueLength = tag & 0x07;
+	if ((tag >> 4) != tagNumber || (tag & 0x08) == 0 || valueLength == 0 || valueLength > 4 || *offset + 1 + valueLength > length) {
+		return false;
+	}
+
+	*value = 0;
+	for (uint8_t index = 0; index < valueLength; index++) {
+		*value = (*value << 8) | message[*offset + 1 + index];
+	}
+	*offset += 1 + valueLength;
+	return true;
+}
+
+// Used to search the virtual devices, they are sorted by instance
+static bool CompareDeviceInstance(const ExampleDatabaseVirtualDevice & device, const uint32_t instance)
+{
+	return device.instance < instance;
+}
+
+ExampleAnnouncer::ExampleAnnouncer() {
+	this->packetsPerSecond = ANNOUNCE_PACKETS_PER_SECOND;
+	this->jitterPercent = ANNOUNCE_JITTER_PERCENT;
+	this->maxBurst = ANNOUNCE_MAX_BURST;
+
+	this->announcementsQueued = 0;
+	this->announcementsSent = 0;
+	this->announcementsFailed = 0;
+	this->whoIsHandled = 0;
+	this->whoIsDropped = 0;
+
+	this->database = NULL;
+	this->sendIAm = NULL;
+	this->random.seed((unsigned int)time(0));
+}
+
+bool ExampleAnnouncer::SetOption(const std::string & name, const std::string & value) {
+	uint32_t* option = NULL;
+	uint32_t minimum = 0;
+	uint32_t maximum = 0xFFFFFFFF;
+	if (name == "announce-rate") {
+		option = &this->packetsPerSecond;
+	}
+	else if (name == "announce-jitter") {
+		option = &this->jitterPercent;
+		maximum = 100;
+	}
+	else if (name == "announce-burst") {
+		option = &this->maxBurst;
+		minimum = 1;
+	}
+	if (option == NULL || value.empty()) {
+		return false;
+	}
+
+	char* end = NULL;
+	unsigned long number = strtoul(value.c_str(), &end, 10);
+	if (end == NULL || *end != '\0' || number < minimum || number > maximum) {
+		return false;
+	}
+	*option = (uint32_t)number;
+	return true;
+}
+
+void ExampleAnnouncer::Setup(ExampleDatabase* database, SendIAmFunction sendIAm) {
+	this->database = database;
+	this->sendIAm = sendIAm;
+	this->pending.clear();
+	this->replies.clear();
+	this->isPending.assign(database->virtualDevices.size() + 1, 0);
+	this->nextSendTime = std::chrono::steady_clock::now();
+}
+
+void ExampleAnnouncer::QueueVirtualDevices() {
+	if (this->database == NULL) {
+		return;
+	}
+	for (size_t slot = 0; slot < this->database->virtualDevices.size(); slot++) {
+		this->QueueSlot(slot);
+	}
+}
+
+bool ExampleAnnouncer::HandleWhoIs(const uint8_t* message, const uint16_t length, const uint8_t* connectionString, const uint8_t connectionStringLength) {
+	if (this->database == NULL || this->sendIAm == NULL || message == NULL) {
+		return false;
+	}
+
+	// BVLL
+	if (length < 4 || message[0] != BVLL_TYPE_BACNET_IP) {
+		return false;
+	}
+	uint16_t offset = 4;
+	const uint8_t* sourceAddress = connectionStringLength >= 6 ? connectionString : NULL;
+	bool unicast = message[1] == BVLL_FUNCTION_ORIGINAL_UNICAST_NPDU;
+	if (message[1] == BVLL_FUNCTION_FORWARDED_NPDU) {
+		if (length < 10) {
+			return false;
+		}
+		sourceAddress = message + 4; // Original source address, the BBMD only forwarded it
+		offset += 6;
+	}
+	else if (message[1] != BVLL_FUNCTION_ORIGINAL_UNICAST_NPDU && message[1] != BVLL_FUNCTION_ORIGINAL_BROADCAST_NPDU) {
+		return false;
+	}
+
+	// NPDU. Only Who-Is sent to all networks or to one of the virtual networks are
+	// handled here, everything else is left to the CAS BACnet Stack.
+	if (offset + 2 > length || message[offset] != NPDU_VERSION) {
+		return false;
+	}
+	uint8_t control = message[offset + 1];
+	offset += 2;
+	if ((control & NPDU_CONTROL_NETWORK_MESSAGE) != 0 || (control & NPDU_CONTROL_DESTINATION) == 0) {
+		return false;
+	}
+	if (offset + 3 > length) {
+		return false;
+	}
+	uint16_t network = (uint16_t)((message[offset] << 8) | message[offset + 1]);
+	if (message[offset + 2] != 0) {
+		return false; // Sent to one device address, not a broadcast
+	}
+	offset += 3;
+	uint16_t sourceNetwork = 0;
+	const uint8_t* sourceNetworkAddress = NULL;
+	uint8_t sourceNetworkAddressLength = 0;
+	if ((control & NPDU_CONTROL_SOURCE) != 0) {
+		if (offset + 3 > length) {
+			return false;
+		}
+		sourceNetwork = (uint16_t)((message[offset] << 8) | message[offset + 1]);
+		sourceNetworkAddressLength = message[offset + 2];
+		if (sourceNetworkAddressLength > sizeof(ExampleAnnouncerDestination::address) || offset + 3 + sourceNetworkAddressLength > length) {
+			return false;
+		}
+		sourceNetworkAddress = message + offset + 3;
+		offset += 3 + sourceNetworkAddressLength;
+	}
+	offset += 1; // Hop count
+
+	// APDU
+	if (offset + 2 > length || (message[offset] & 0xF0) != APDU_TYPE_UNCONFIRMED_REQUEST || message[offset + 1] != SERVICE_UNCONFIRMED_WHO_IS) {
+		return false;
+	}
+	offset += 2;
+
+	uint32_t lowLimit = 0;
+	uint32_t highLimit = MAX_INSTANCE;
+	if (offset < length) {
+		// Both limits must be present. Anything malformed is left for the stack to reject.
+		if (!DecodeContextUnsigned(message, length, &offset, 0, &lowLimit) ||
+			!DecodeContextUnsigned(message, length, &offset, 1, &highLimit) ||
+			offset != length || lowLimit > highLimit) {
+			return false;
+		}
+	}
+
+	bool global = network == GLOBAL_BROADCAST_NETWORK;
+	if (!global && !std::binary_search(this->database->virtualNetworks.begin(), this->database->virtualNetworks.end(), network)) {
+		return false;
+	}
+
+	this->whoIsHandled++;
+
+	WhoIsReply reply;
+	reply.lowLimit = lowLimit;
+	reply.highLimit = highLimit;
+	reply.anyNetwork = global;
+	reply.network = network;
+	reply.mainDevice = global && this->database->mainDevice.instance >= lowLimit && this->database->mainDevice.instance <= highLimit;
+	std::vector<ExampleDatabaseVirtualDevice> & devices = this->database->virtualDevices;
+	reply.nextDevice = std::lower_bound(devices.begin(), devices.end(), lowLimit, CompareDeviceInstance) - devices.begin();
+
+	// A Who-Is for one device, or one sent straight to us, is answered to the requester only.
+	// Everything else is answered with broadcasts, like the stack does.
+	reply.directed = (unicast || lowLimit == highLimit) && sourceAddress != NULL;
+	memset(&reply.destination, 0, sizeof(reply.destination));
+	if (reply.directed) {
+		memcpy(reply.destination.connectionString, sourceAddress, 6);
+		reply.destination.network = sourceNetwork;
+		if (sourceNetworkAddressLength > 0) {
+			memcpy(reply.destination.address, sourceNetworkAddress, sourceNetworkAddressLength);
+		}
+		reply.destination.addressLength = sourceNetworkAddressLength;
+	}
+	else {
+		// The same broadcast Who-Is that has not been started on yet is already answered by that one
+		for (std::deque<WhoIsReply>::const_iterator it = this->replies.begin(); it != this->replies.end(); ++it) {
+			if (!it->directed && it->lowLimit == reply.lowLimit && it->highLimit == reply.highLimit && it->anyNetwork == reply.anyNetwork &&
+				it->network == reply.network && it->mainDevice == reply.mainDevice && it->nextDevice == reply.nextDevice) {
+				return true;
+			}
+		}
+	}
+
+	if (this->replies.size() >= ANNOUNCE_MAX_WHO_IS_REPLIES) {
+		this->whoIsDropped++;
+		return true;
+	}
+	this->replies.push_back(reply);
+	return true;
+}
+
+void ExampleAnnouncer::Loop() {
+	if (this->pending.empty() && this->replies.empty()) {
+		return;
+	}
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (this->packetsPerSecond > 0) {
+		// Do not let an idle period build up more than maxBurst announcements
+		std::chrono::steady_clock::duration interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / this->packetsPerSecond));
+		std::chrono::steady_clock::time_point earliest = now - interval * (this->maxBurst - 1);
+		if (this->nextSendTime < earliest) {
+			this->nextSendTime = earliest;
+		}
+	}
+
+	while ((!this->replies.empty() || !this->pending.empty()) && (this->packetsPerSecond == 0 || this->nextSendTime <= now)) {
+		if (!this->replies.empty()) {
+			// Who-Is replies go first, each Who-Is being answered takes its turn
+			WhoIsReply reply = this->replies.front();
+			this->replies.pop_front();
+			uint32_t deviceInstance = 0;
+			if (!this->GetNextReplyDevice(reply, &deviceInstance)) {
+				continue; // Fully answered
+			}
+			this->Send(deviceInstance, reply.directed ? &reply.destination : NULL);
+			this->replies.push_back(reply);
+		}
+		else {
+			uint32_t slot = this->pending.front();
+			this->pending.pop_front();
+			this->isPending[slot] = 0;
+
+			uint32_t deviceInstance = slot < this->database->virtualDevices.size() ? this->database->virtualDevices[slot].instance : this->database->mainDevice.instance;
+			this->Send(deviceInstance, NULL);
+		}
+
+		if (this->packetsPerSecond > 0) {
+			this->nextSendTime += this->GetNextInterval();
+		}
+	}
+}
+
+int ExampleAnnouncer::GetWaitTimeMs(const int maxWaitMs) const {
+	if (this->pending.empty() && this->replies.empty()) {
+		return maxWaitMs;
+	}
+	if (this->packetsPerSecond == 0) {
+		return 0;
+	}
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (this->nextSendTime <= now) {
+		return 0;
+	}
+	long long waitMs = (long long)std::chrono::duration_cast<std::chrono::milliseconds>(this->nextSendTime - now).count() + 1;
+	return waitMs < maxWaitMs ? (int)waitMs : maxWaitMs;
+}
+
+void ExampleAnnouncer::QueueSlot(const size_t slot) {
+	if (slot >= this->isPending.size() || this->isPending[slot]) {
+		return;
+	}
+	this->isPending[slot] = 1;
+	this->pending.push_back((uint32_t)slot);
+	this->announcementsQueued++;
+}
+
+bool ExampleAnnouncer::GetNextReplyDevice(WhoIsReply & reply, uint32_t* deviceInstance) {
+	if (reply.mainDevice) {
+		reply.mainDevice = false;
+		*deviceInstance = this->database->mainDevice.instance;
+		return true;
+	}
+
+	const std::vector<ExampleDatabaseVirtualDevice> & devices = this->database->virtualDevices;
+	while (reply.nextDevice < devices.size() && devices[reply.nextDevice].instance <= reply.highLimit) {
+		const ExampleDatabaseVirtualDevice & device = devices[reply.nextDevice++];
+		if (reply.anyNetwork || device.network == reply.network) {
+			*deviceInstance = device.instance;
+			return true;
+		}
+	}
+	return false;
+}
+
+void ExampleAnnouncer::Send(const uint32_t deviceInstance, const ExampleAnnouncerDestination* destination) {
+	if (this->sendIAm(deviceInstance, destination)) {
+		this->announcementsSent++;
+	}
+	else {
+		this->announcementsFailed++;
+	}
+}
+
+std::chrono::steady_clock::duration ExampleAnnouncer::GetNextInterval() {
+	double seconds = 1.0 / this->packetsPerSecond;
+	if (this->jitterPercent > 0) {
+		std::uniform_real_distribution<double> jitter(-(double)this->jitterPercent / 100.0, (double)this->jitterPercent / 100.0);
+		seconds *= 1.0 + jitter(this->random);
+	}
+	return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+}
@@ -0,0 +1,117 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * CASBACnetStackExampleAnnouncer.h
+ *
+ * Paces the I-Am announcements of the virtual devices. With thousands of virtual
+ * devices sending every I-Am at once floods the subnet broadcast, so the
+ * announcements are queued and sent at a limited rate with some jitter. Who-Is
+ * requests for the virtual devices are answered at the same rate, from their own
+ * queue that is sent before the startup announcements. A Who-Is for one device,
+ * or one sent unicast, is answered straight to the requester.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#ifndef __CASBACnetStackExampleAnnouncer_h__
+#define __CASBACnetStackExampleAnnouncer_h__
+
+#include "CASBACnetStackExampleDatabase.h"
+
+#include <chrono>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+// Default pacing
+#define ANNOUNCE_PACKETS_PER_SECOND		200
+#define ANNOUNCE_JITTER_PERCENT			20
+#define ANNOUNCE_MAX_BURST				10
+#define ANNOUNCE_MAX_WHO_IS_REPLIES		64		// Who-Is requests being answered at once, more are dropped
+
+// Where a directed I-Am is sent, back to the device that sent the Who-Is
+struct ExampleAnnouncerDestination {
+	uint8_t connectionString[6];	// IP address and port
+	uint16_t network;				// Source network of the requester behind a router, zero if local
+	uint8_t address[6];				// Address of the requester on that network
+	uint8_t addressLength;
+};
+
+class ExampleAnnouncer
+{
+public:
+	// Sends the I-Am for one device. A NULL destination is a broadcast. Provided by the application.
+	typedef bool (*SendIAmFunction)(const uint32_t deviceInstance, const ExampleAnnouncerDestination* destination);
+
+	// Options
+	uint32_t packetsPerSecond;	// Zero sends everything straight away
+	uint32_t jitterPercent;		// Each gap between announcements is randomly stretched or shrunk by up to this much
+	uint32_t maxBurst;			// Announcements that can be sent back to back after an idle period
+
+	// Counters
+	uint64_t announcementsQueued;
+	uint64_t announcementsSent;
+	uint64_t announcementsFailed;
+	uint64_t whoIsHandled;
+	uint64_t whoIsDropped;		// Not answered, too many Who-Is were already being answered
+
+	ExampleAnnouncer();
+
+	// Sets one option by name, eg. "announce-rate". Returns false if the
+	// option is unknown or the value is invalid.
+	bool SetOption(const std::string & name, const std::string & value);
+
+	void Setup(ExampleDatabase* database, SendIAmFunction sendIAm);
+
+	// Queues an I-Am for every virtual device
+	void QueueVirtualDevices();
+
+	// Checks if message is a Who-Is that is answered by the virtual devices. If it is,
+	// the reply is queued and true is returned. The message should not be passed on to
+	// the CAS BACnet Stack. connectionString is the 6 byte address it was received from.
+	bool HandleWhoIs(const uint8_t* message, const uint16_t length, const uint8_t* connectionString, const uint8_t connectionStringLength);
+
+	// Sends the announcements that are due
+	void Loop();
+
+	size_t GetPendingCount() const { return this->pending.size(); }
+	size_t GetWhoIsReplyCount() const { return this->replies.size(); }
+
+	// Returns how long the main loop can wait before the next announcement is due
+	int GetWaitTimeMs(const int maxWaitMs) const;
+
+private:
+	// A Who-Is being answered. The matching devices are found as the replies are sent, so
+	// a Who-Is for every device does not queue an entry per device.
+	struct WhoIsReply {
+		uint32_t lowLimit;
+		uint32_t highLimit;
+		bool anyNetwork;
+		uint16_t network;
+		bool mainDevice;				// The main device has still to answer
+		size_t nextDevice;				// Next virtual device to check
+		bool directed;
+		ExampleAnnouncerDestination destination;
+	};
+
+	// Finds the next device that answers the reply. Returns false when there are none left.
+	bool GetNextReplyDevice(WhoIsReply & reply, uint32_t* deviceInstance);
+	void Send(const uint32_t deviceInstance, const ExampleAnnouncerDestination* destination);
+
+	// Slots 0 to N-1 are the virtual devices, slot N is the main device
+	void QueueSlot(const size_t slot);
+	std::chrono::steady_clock::duration GetNextInterval();
+
+	ExampleDatabase* database;
+	SendIAmFunction sendIAm;
+
+	std::deque<uint32_t> pending;
+	std::vector<uint8_t> isPending;	// One flag per slot so a device is only queued once
+	std::deque<WhoIsReply> replies;	// Answered in turn, before the pending announcements
+
+	std::chrono::steady_clock::time_point nextSendTime;
+	std::minstd_rand random;
+};
+
+#endif // __CASBACnetStackExampleAnnouncer_h__
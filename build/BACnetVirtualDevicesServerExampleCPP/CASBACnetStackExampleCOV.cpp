@@ -0,0 +1,111 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * CASBACnetStackExampleCOV.cpp
+ *
+ * Change of value reporting for the virtual device Analog Inputs.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#include "CASBACnetStackExampleCOV.h"
+#include "CASBACnetStackExampleConstants.h"
+
+#include <math.h> // fabs()
+#include <stdlib.h> // strtoul()
+
+ExampleCOV::ExampleCOV() {
+	this->enabled = true;
+	this->maxUpdatesPerLoop = COV_MAX_UPDATES_PER_LOOP;
+
+	this->changesCollected = 0;
+	this->valuesReported = 0;
+	this->changesSuppressed = 0;
+
+	this->database = NULL;
+	this->valueUpdated = NULL;
+	this->changedOffset = 0;
+}
+
+bool ExampleCOV::SetOption(const std::string & name, const std::string & value) {
+	if (name == "cov") {
+		if (value == "on") {
+			this->enabled = true;
+		}
+		else if (value == "off") {
+			this->enabled = false;
+		}
+		else {
+			return false;
+		}
+		return true;
+	}
+	else if (name == "cov-updates-per-loop") {
+		char* end = NULL;
+		unsigned long number = strtoul(value.c_str(), &end, 10);
+		if (value.empty() || end == NULL || *end != '\0' || number == 0) {
+			return false;
+		}
+		this->maxUpdatesPerLoop = (uint32_t)number;
+		return true;
+	}
+	return false;
+}
+
+void ExampleCOV::Setup(ExampleDatabase* database, ValueUpdatedFunction valueUpdated) {
+	this->database = database;
+	this->valueUpdated = valueUpdated;
+	this->changed.clear();
+	this->changedOffset = 0;
+
+	size_t count = database->analogInputs.size();
+	this->reportedValues.resize(count);
+	this->reportedReliability.resize(count);
+	for (size_t slot = 0; slot < count; slot++) {
+		database->analogInputValues.Read(slot, &this->reportedValues[slot], &this->reportedReliability[slot]);
+	}
+}
+
+void ExampleCOV::Loop() {
+	if (!this->enabled || this->database == NULL || this->valueUpdated == NULL) {
+		return;
+	}
+
+	// Only collect more changes once the last ones have been checked. Values written
+	// again in the mean time are collected once, which coalesces bursts of updates.
+	if (this->changedOffset >= this->changed.size()) {
+		this->changed.clear();
+		this->changedOffset = 0;
+		this->changesCollected += this->database->analogInputValues.CollectChanged(this->changed);
+	}
+
+	// Limit the work per loop so incoming requests are not held up
+	size_t end = this->changed.size();
+	if (end - this->changedOffset > this->maxUpdatesPerLoop) {
+		end = this->changedOffset + this->maxUpdatesPerLoop;
+	}
+
+	for (; this->changedOffset < end; this->changedOffset++) {
+		uint32_t slot = this->changed[this->changedOffset];
+		float presentValue = 0.0f;
+		uint32_t reliability = 0;
+		this->database->analogInputValues.Read(slot, &presentValue, &reliability);
+
+		// The stack compares against the value each subscriber was last sent. Values
+		// that have not moved by the COV increment since the last report can not
+		// trigger a notification, so the stack is not asked to look at them.
+		const ExampleDatabaseAnalogInput & analogInput = this->database->analogInputs[slot];
+		float change = (float)fabs(presentValue - this->reportedValues[slot]);
+		bool crossedIncrement = change > 0.0f && change >= analogInput.covIncrement;
+		if (!crossedIncrement && reliability == this->reportedReliability[slot]) {
+			this->changesSuppressed++;
+			continue;
+		}
+
+		// The notification carries both the present value and the status flags
+		this->reportedValues[slot] = presentValue;
+		this->reportedReliability[slot] = reliability;
+		this->valueUpdated(analogInput.deviceInstance, CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_INPUT, analogInput.instance, CASBACnetStackExampleConstants::PROPERTY_IDENTIFIER_PRESENT_VALUE);
+		this->valuesReported++;
+	}
+}
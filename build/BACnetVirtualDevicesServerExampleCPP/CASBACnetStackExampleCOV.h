@@ -0,0 +1,69 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * CASBACnetStackExampleCOV.h
+ *
+ * Change of value reporting for the virtual device Analog Inputs. The CAS
+ * BACnet Stack keeps the SubscribeCOV subscriptions, their lifetimes and
+ * sends the notifications. This class decides when the stack is told that a
+ * value changed: the live values written since the last loop are collected,
+ * and only values that moved by at least the COV increment since they were
+ * last reported, or whose reliability changed, are passed on.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#ifndef __CASBACnetStackExampleCOV_h__
+#define __CASBACnetStackExampleCOV_h__
+
+#include "CASBACnetStackExampleDatabase.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define COV_MAX_UPDATES_PER_LOOP	1000	// Changed values checked per main loop
+
+class ExampleCOV
+{
+public:
+	// Tells the CAS BACnet Stack that a property changed. Provided by the application.
+	typedef void (*ValueUpdatedFunction)(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, const uint32_t propertyIdentifier);
+
+	// Options
+	bool enabled;
+	uint32_t maxUpdatesPerLoop;
+
+	// Counters
+	uint64_t changesCollected;	// Values written by the field drivers, each value counted once per loop
+	uint64_t valuesReported;	// Passed on to the CAS BACnet Stack
+	uint64_t changesSuppressed;	// Smaller than the COV increment
+
+	ExampleCOV();
+
+	// Sets one option by name, eg. "cov". Returns false if the option is unknown
+	// or the value is invalid.
+	bool SetOption(const std::string & name, const std::string & value);
+
+	// Called after ExampleDatabase::Setup(). The current values are the starting point.
+	void Setup(ExampleDatabase* database, ValueUpdatedFunction valueUpdated);
+
+	// Checks the values that changed since the last loop. Must be called from the BACnet thread.
+	void Loop();
+
+	// Changed values that were collected but not checked yet
+	size_t GetPendingCount() const { return this->changed.size() - this->changedOffset; }
+
+private:
+	ExampleDatabase* database;
+	ValueUpdatedFunction valueUpdated;
+
+	// Last value reported to the stack for each Analog Input slot
+	std::vector<float> reportedValues;
+	std::vector<uint32_t> reportedReliability;
+
+	std::vector<uint32_t> changed;
+	size_t changedOffset;
+};
+
+#endif // __CASBACnetStackExampleCOV_h__
@@ -12,7 +12,7 @@
 #ifndef __ExampleConstants_h__
 #define __ExampleConstants_h__
 
-#include "datatypes.h"
+#include <stdint.h>
 
 class CASBACnetStackExampleConstants {
 public:
@@ -26,10 +26,12 @@ public:
 
 	// Object Types
 	static const uint16_t OBJECT_TYPE_ANALOG_INPUT = 0;
+	static const uint16_t OBJECT_TYPE_ANALOG_VALUE = 2;
 	static const uint16_t OBJECT_TYPE_DEVICE = 8;
 	static const uint16_t OBJECT_TYPE_NETWORK_PORT = 56;
 	
 	// Property Identifiers
+	static const uint32_t PROPERTY_IDENTIFIER_COV_INCREMENT = 22;
 	static const uint32_t PROPERTY_IDENTIFIER_DESCRIPTION = 28;
 	static const uint32_t PROPERTY_IDENTIFIER_OBJECT_NAME = 77;
 	static const uint32_t PROPERTY_IDENTIFIER_PRESENT_VALUE = 85;
@@ -46,6 +48,7 @@ public:
 	static const uint32_t PROPERTY_IDENTIFIER_MAC_ADDRESS = 423;
 
 	// Services Supported
+	static const uint8_t SERVICE_SUBSCRIBE_COV = 5;
 	static const uint8_t SERVICE_READ_PROPERTY_MULTIPLE = 14;
 	static const uint8_t SERVICE_I_AM = 26;
 	
@@ -3,14 +3,16 @@
  * ----------------------------------------------------------------------------
  * CASBACnetStackExampleDatabase.cpp
  *
- * Sets up virtual devices and in the database.
+ * Sets up virtual devices and their objects in the database.
  *
  * Created by: Steven Smethurst
 */
 
 #include "CASBACnetStackExampleDatabase.h"
+#include "CASBACnetStackExampleConstants.h"
 
 #include <time.h> // time()
+#include <stdio.h> // snprintf()
 #ifdef _WIN32 
 #include <winsock2.h>
 #include <iphlpapi.h>
@@ -19,8 +21,30 @@
 #define MALLOC(x) HeapAlloc(GetProcessHeap(), 0, (x))
 #define FREE(x) HeapFree(GetProcessHeap(), 0, (x))
 #endif // _WIN32 
+#ifdef _MSC_VER
+#include <intrin.h> // _BitScanForward64()
+#endif // _MSC_VER
+
+// Index of the lowest set bit. value must not be zero.
+static inline size_t CountTrailingZeros(uint64_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return index;
+#elif defined(__GNUC__)
+	return (size_t)__builtin_ctzll(value);
+#else
+	size_t index = 0;
+	while ((value & 1) == 0) {
+		value >>= 1;
+		index++;
+	}
+	return index;
+#endif
+}
 
-ExampleDatabase::ExampleDatabase() {
+ExampleDatabase::ExampleDatabase() : valueUpdatesApplied(0), valueUpdatesStale(0), valueUpdatesUnknown(0) {
 	this->Setup();
 }
 
@@ -28,47 +52,67 @@ ExampleDatabase::~ExampleDatabase() {
 	this->Setup();
 }
 
-const std::string ExampleDatabase::GetColorName() {
-	static uint16_t offset = 0;
-	static const std::vector<std::string> colors = {
-	"Amber", "Bronze", "Chartreuse", "Diamond", "Emerald", "Fuchsia", "Gold", "Hot Pink", "Indigo",
-	"Kiwi", "Lilac", "Magenta", "Nickel", "Onyx", "Purple", "Quartz", "Red", "Silver", "Turquoise",
-	"Umber", "Vermilion", "White", "Xanadu", "Yellow", "Zebra White", "Apricot", "Blueberry", "Carrot", 
-	"Date", "Eggplant", "Fig", "Grapefruit", "Honeydew"  };
-
-	++offset;
-	return colors.at(offset % colors.size());
-}
-
 void ExampleDatabase::Setup() {
-	this->mainDevice.instance = 389999;
+	this->mainDevice.instance = MAIN_DEVICE_INSTANCE;
 	this->mainDevice.objectName = "Virtual Devices Container";
 	this->mainDevice.description = "Chipkin test BACnet IP Virtual Devices Server device";
 	this->mainDevice.systemStatus = 0;	// operational (0), non-operational (4)
 
-	for (size_t networkIndex = 0; networkIndex < NUMBER_OF_VIRTUAL_NETWORKS; networkIndex++) {
-		for (size_t deviceIndex = 0; deviceIndex < NUMBER_OF_DEVICES_PER_NETWORK; deviceIndex++) {
-			ExampleDatabaseDevice device;
-			device.instance = STARTING_DEVICE_INSTANCE + (networkIndex * STARTING_DEVICE_INSTANCE) + deviceIndex;
-			std::string color = ExampleDatabase::GetColorName();
-			device.objectName = "Virtual Device " + color;
-			device.description = "Example virtual device";
+	this->virtualNetworks.clear();
+	this->virtualDevices.clear();
+	this->analogInputs.clear();
+	this->analogValues.clear();
+	this->objectIndex.Clear();
+
+	// Size the tables up front so they are never reallocated
+	const uint32_t numberOfDevices = this->topology.GetNumberOfDevices();
+	this->virtualNetworks.reserve(this->topology.numberOfNetworks);
+	this->virtualDevices.reserve(numberOfDevices);
+	this->analogInputs.reserve((size_t)numberOfDevices * this->topology.analogInputsPerDevice);
+	this->analogValues.reserve((size_t)numberOfDevices * this->topology.analogValuesPerDevice);
+	this->objectIndex.Reserve(this->virtualDevices.capacity() + this->analogInputs.capacity() + this->analogValues.capacity());
+	this->analogInputValues.Resize(this->analogInputs.capacity());
+
+	for (uint32_t networkIndex = 0; networkIndex < this->topology.numberOfNetworks; networkIndex++) {
+		uint16_t network = (uint16_t)this->topology.GetNetwork(networkIndex);
+		this->virtualNetworks.push_back(network);
+
+		for (uint32_t deviceIndex = 0; deviceIndex < this->topology.devicesPerNetwork; deviceIndex++) {
+			ExampleDatabaseVirtualDevice device;
+			device.instance = this->topology.GetDeviceInstance(networkIndex, deviceIndex);
 			device.systemStatus = 0;	// operational (0), non-operational (4)
+			device.network = network;
 
-			// Create the object
+			// Create the objects
 			ExampleDatabaseAnalogInput analogInput;
-			analogInput.instance = 1;
-			analogInput.presentValue = (networkIndex * 100) + deviceIndex + 1;
-			analogInput.objectName = "Analog Input " + color;
-			analogInput.reliability = 0;  // no-fault-detected (0), unreliable-other (7)
-			this->analogInputs[device.instance] = analogInput;
+			analogInput.deviceInstance = device.instance;
+			analogInput.covIncrement = this->topology.analogInputCOVIncrement;
+			for (uint32_t objectInstance = 1; objectInstance <= this->topology.analogInputsPerDevice; objectInstance++) {
+				analogInput.instance = objectInstance;
+				// reliability: no-fault-detected (0), unreliable-other (7)
+				this->analogInputValues.Write(this->analogInputs.size(), (float)((networkIndex * 100) + deviceIndex + objectInstance), 0, 0);
+				this->objectIndex.Insert(device.instance, CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_INPUT, objectInstance, (uint32_t)this->analogInputs.size());
+				this->analogInputs.push_back(analogInput);
+			}
+
+			ExampleDatabaseAnalogValue analogValue;
+			analogValue.deviceInstance = device.instance;
+			for (uint32_t objectInstance = 1; objectInstance <= this->topology.analogValuesPerDevice; objectInstance++) {
+				analogValue.instance = objectInstance;
+				analogValue.presentValue = 0.0f;
+				this->objectIndex.Insert(device.instance, CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_VALUE, objectInstance, (uint32_t)this->analogValues.size());
+				this->analogValues.push_back(analogValue);
+			}
 
 			// Add the device
-			uint16_t network = STARTING_VIRTUAL_NETWORK + (networkIndex * VIRTUAL_NETWORK_OFFSET);
-			this->virtualDevices[network].push_back(device);
+			this->objectIndex.Insert(device.instance, CASBACnetStackExampleConstants::OBJECT_TYPE_DEVICE, device.instance, (uint32_t)this->virtualDevices.size());
+			this->virtualDevices.push_back(device);
 		}
 	}
 
+	// The default values are not changes
+	this->analogInputValues.ClearChanged();
+
 	this->networkPort.instance = 1;
 	this->networkPort.objectName = "Network Port for Ipv4";
 	this->LoadNetworkPortProperties();
@@ -196,4 +240,362 @@ void ExampleDatabase::LoadNetworkPortProperties() {
 }
 
 void ExampleDatabase::Loop() {
-}
\ No newline at end of file
+}
+
+ExampleDatabaseVirtualDevice* ExampleDatabase::GetVirtualDevice(const uint32_t deviceInstance) {
+	uint32_t slot = this->objectIndex.Find(deviceInstance, CASBACnetStackExampleConstants::OBJECT_TYPE_DEVICE, deviceInstance);
+	if (slot == ExampleDatabaseObjectIndex::NOT_FOUND) {
+		return NULL;
+	}
+	return &this->virtualDevices[slot];
+}
+
+ExampleDatabaseAnalogInput* ExampleDatabase::GetAnalogInput(const uint32_t deviceInstance, const uint32_t objectInstance) {
+	uint32_t slot = this->objectIndex.Find(deviceInstance, CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_INPUT, objectInstance);
+	if (slot == ExampleDatabaseObjectIndex::NOT_FOUND) {
+		return NULL;
+	}
+	return &this->analogInputs[slot];
+}
+
+ExampleDatabaseAnalogValue* ExampleDatabase::GetAnalogValue(const uint32_t deviceInstance, const uint32_t objectInstance) {
+	uint32_t slot = this->objectIndex.Find(deviceInstance, CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_VALUE, objectInstance);
+	if (slot == ExampleDatabaseObjectIndex::NOT_FOUND) {
+		return NULL;
+	}
+	return &this->analogValues[slot];
+}
+
+size_t ExampleDatabase::UpdateAnalogInputs(const ExampleDatabaseValueUpdate* updates, const size_t count) {
+	// The index and the object tables do not change after Setup(), so they can be
+	// read from any thread. Counters are only touched once per batch.
+	size_t applied = 0;
+	size_t stale = 0;
+	size_t unknown = 0;
+	for (size_t offset = 0; offset < count; offset++) {
+		const ExampleDatabaseValueUpdate & update = updates[offset];
+		uint32_t slot = this->objectIndex.Find(update.deviceInstance, CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_INPUT, update.objectInstance);
+		if (slot == ExampleDatabaseObjectIndex::NOT_FOUND) {
+			unknown++;
+		}
+		else if (this->analogInputValues.Write(slot, update.presentValue, update.reliability, update.timestamp)) {
+			applied++;
+		}
+		else {
+			stale++;
+		}
+	}
+
+	if (applied > 0) {
+		this->valueUpdatesApplied.fetch_add(applied, std::memory_order_relaxed);
+	}
+	if (stale > 0) {
+		this->valueUpdatesStale.fetch_add(stale, std::memory_order_relaxed);
+	}
+	if (unknown > 0) {
+		this->valueUpdatesUnknown.fetch_add(unknown, std::memory_order_relaxed);
+	}
+	return applied;
+}
+
+bool ExampleDatabase::UpdateAnalogInput(const uint32_t deviceInstance, const uint32_t objectInstance, const float presentValue, const uint32_t reliability, const uint64_t timestamp) {
+	ExampleDatabaseValueUpdate update;
+	update.deviceInstance = deviceInstance;
+	update.objectInstance = objectInstance;
+	update.presentValue = presentValue;
+	update.reliability = reliability;
+	update.timestamp = timestamp;
+	return this->UpdateAnalogInputs(&update, 1) == 1;
+}
+
+bool ExampleDatabase::GetAnalogInputValue(const uint32_t deviceInstance, const uint32_t objectInstance, float* presentValue, uint32_t* reliability) {
+	uint32_t slot = this->objectIndex.Find(deviceInstance, CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_INPUT, objectInstance);
+	if (slot == ExampleDatabaseObjectIndex::NOT_FOUND) {
+		return false;
+	}
+	this->analogInputValues.Read(slot, presentValue, reliability);
+	return true;
+}
+
+bool ExampleDatabase::GetVirtualObjectName(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, char* value, uint32_t* valueElementCount, const uint32_t maxElementCount) {
+	ExampleDatabaseVirtualDevice* device = this->GetVirtualDevice(deviceInstance);
+	if (device == NULL) {
+		return false;
+	}
+
+	switch (objectType) {
+	case CASBACnetStackExampleConstants::OBJECT_TYPE_DEVICE:
+		if (objectInstance != deviceInstance) {
+			return false;
+		}
+		return FormatName(this->topology.deviceNameTemplate, device->network, deviceInstance, objectInstance, value, valueElementCount, maxElementCount);
+	case CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_INPUT:
+		if (this->GetAnalogInput(deviceInstance, objectInstance) == NULL) {
+			return false;
+		}
+		return FormatName(this->topology.analogInputNameTemplate, device->network, deviceInstance, objectInstance, value, valueElementCount, maxElementCount);
+	case CASBACnetStackExampleConstants::OBJECT_TYPE_ANALOG_VALUE:
+		if (this->GetAnalogValue(deviceInstance, objectInstance) == NULL) {
+			return false;
+		}
+		return FormatName(this->topology.analogValueNameTemplate, device->network, deviceInstance, objectInstance, value, valueElementCount, maxElementCount);
+	}
+	return false;
+}
+
+bool ExampleDatabase::FormatName(const std::string & nameTemplate, const uint32_t network, const uint32_t deviceInstance, const uint32_t objectInstance, char* value, uint32_t* valueElementCount, const uint32_t maxElementCount) {
+	// Expand the template directly into the callers buffer, no heap allocations
+	uint32_t length = 0;
+	for (size_t offset = 0; offset < nameTemplate.size(); offset++) {
+		const char* token = NULL;
+		uint32_t number = 0;
+		if (nameTemplate[offset] == '{') {
+			if (nameTemplate.compare(offset, 9, "{network}") == 0) {
+				token = "{network}";
+				number = network;
+			}
+			else if (nameTemplate.compare(offset, 8, "{device}") == 0) {
+				token = "{device}";
+				number = deviceInstance;
+			}
+			else if (nameTemplate.compare(offset, 10, "{instance}") == 0) {
+				token = "{instance}";
+				number = objectInstance;
+			}
+		}
+
+		if (token == NULL) {
+			if (length >= maxElementCount) {
+				return false;
+			}
+			value[length++] = nameTemplate[offset];
+			continue;
+		}
+
+		char digits[16];
+		int digitsLength = snprintf(digits, sizeof(digits), "%u", number);
+		if (digitsLength < 0 || length + (uint32_t)digitsLength > maxElementCount) {
+			return false;
+		}
+		memcpy(value + length, digits, digitsLength);
+		length += digitsLength;
+		offset += strlen(token) - 1;
+	}
+	*valueElementCount = length;
+	return true;
+}
+
+ExampleDatabaseObjectIndex::ExampleDatabaseObjectIndex() {
+	this->mask = 0;
+	this->count = 0;
+}
+
+void ExampleDatabaseObjectIndex::Clear() {
+	this->entries.clear();
+	this->mask = 0;
+	this->count = 0;
+}
+
+void ExampleDatabaseObjectIndex::Reserve(size_t objectCount) {
+	// Keep the load factor at or below 50% so probe sequences stay short
+	size_t capacity = 16;
+	while (capacity < objectCount * 2) {
+		capacity *= 2;
+	}
+	if (capacity > this->entries.size()) {
+		this->Resize(capacity);
+	}
+}
+
+void ExampleDatabaseObjectIndex::Insert(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, const uint32_t slot) {
+	if ((this->count + 1) * 2 > this->entries.size()) {
+		this->Resize(this->entries.size() < 16 ? 16 : this->entries.size() * 2);
+	}
+
+	uint64_t key = MakeKey(deviceInstance, objectType, objectInstance);
+	size_t offset = Hash(key) & this->mask;
+	while (this->entries[offset].key != EMPTY_KEY) {
+		if (this->entries[offset].key == key) {
+			// Already indexed, point it at the new slot
+			this->entries[offset].slot = slot;
+			return;
+		}
+		offset = (offset + 1) & this->mask;
+	}
+	this->entries[offset].key = key;
+	this->entries[offset].slot = slot;
+	this->count++;
+}
+
+uint32_t ExampleDatabaseObjectIndex::Find(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance) const {
+	if (this->count == 0) {
+		return NOT_FOUND;
+	}
+
+	uint64_t key = MakeKey(deviceInstance, objectType, objectInstance);
+	size_t offset = Hash(key) & this->mask;
+	while (this->entries[offset].key != EMPTY_KEY) {
+		if (this->entries[offset].key == key) {
+			return this->entries[offset].slot;
+		}
+		offset = (offset + 1) & this->mask;
+	}
+	return NOT_FOUND;
+}
+
+size_t ExampleDatabaseObjectIndex::Hash(uint64_t key) {
+	// splitmix64 finalizer. Device instances are often sequential so the bits need mixing.
+	key ^= key >> 30;
+	key *= 0xBF58476D1CE4E5B9ULL;
+	key ^= key >> 27;
+	key *= 0x94D049BB133111EBULL;
+	key ^= key >> 31;
+	return (size_t)key;
+}
+
+void ExampleDatabaseObjectIndex::Resize(size_t capacity) {
+	std::vector<Entry> old;
+	old.swap(this->entries);
+
+	Entry empty;
+	empty.key = EMPTY_KEY;
+	empty.slot = NOT_FOUND;
+	this->entries.assign(capacity, empty);
+	this->mask = capacity - 1;
+
+	for (size_t offset = 0; offset < old.size(); offset++) {
+		if (old[offset].key == EMPTY_KEY) {
+			continue;
+		}
+		size_t target = Hash(old[offset].key) & this->mask;
+		while (this->entries[target].key != EMPTY_KEY) {
+			target = (target + 1) & this->mask;
+		}
+		this->entries[target] = old[offset];
+	}
+}
+
+ExampleDatabaseLiveValueTable::ExampleDatabaseLiveValueTable() {
+	this->count = 0;
+	this->changedSlotsLength = 0;
+	this->changedWordsLength = 0;
+}
+
+void ExampleDatabaseLiveValueTable::Resize(const size_t count) {
+	this->values.reset(count > 0 ? new Value[count] : NULL);
+	this->count = count;
+	for (size_t slot = 0; slot < count; slot++) {
+		this->values[slot].sequence.store(0, std::memory_order_relaxed);
+		this->values[slot].presentValue.store(0, std::memory_order_relaxed);
+		this->values[slot].reliability.store(0, std::memory_order_relaxed);
+		this->values[slot].timestamp.store(0, std::memory_order_relaxed);
+	}
+
+	this->changedSlotsLength = (count + 63) / 64;
+	this->changedWordsLength = (this->changedSlotsLength + 63) / 64;
+	this->changedSlots.reset(this->changedSlotsLength > 0 ? new std::atomic<uint64_t>[this->changedSlotsLength] : NULL);
+	this->changedWords.reset(this->changedWordsLength > 0 ? new std::atomic<uint64_t>[this->changedWordsLength] : NULL);
+	this->ClearChanged();
+}
+
+bool ExampleDatabaseLiveValueTable::Write(const size_t slot, const float presentValue, const uint32_t reliability, const uint64_t timestamp) {
+	if (slot >= this->count) {
+		return false;
+	}
+	Value & value = this->values[slot];
+
+	// Take the write lock by making the sequence odd. Two drivers writing the
+	// same point at the same time is rare, so spinning is fine.
+	uint32_t sequence = value.sequence.load(std::memory_order_relaxed);
+	for (;;) {
+		if ((sequence & 1) == 0 && value.sequence.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+			break;
+		}
+		sequence = value.sequence.load(std::memory_order_relaxed);
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+
+	if (timestamp < value.timestamp.load(std::memory_order_relaxed)) {
+		// Nothing was written, unlock by putting the sequence back
+		value.sequence.store(sequence, std::memory_order_release);
+		return false;
+	}
+
+	uint32_t bits;
+	memcpy(&bits, &presentValue, sizeof(bits));
+	value.presentValue.store(bits, std::memory_order_relaxed);
+	value.reliability.store(reliability, std::memory_order_relaxed);
+	value.timestamp.store(timestamp, std::memory_order_relaxed);
+	value.sequence.store(sequence + 2, std::memory_order_release);
+	this->MarkChanged(slot);
+	return true;
+}
+
+uint32_t ExampleDatabaseLiveValueTable::Read(const size_t slot, float* presentValue, uint32_t* reliability, uint64_t* timestamp) const {
+	if (slot >= this->count) {
+		return 0;
+	}
+	const Value & value = this->values[slot];
+
+	for (;;) {
+		uint32_t sequence = value.sequence.load(std::memory_order_acquire);
+		if ((sequence & 1) != 0) {
+			continue; // A writer is part way through
+		}
+		uint32_t bits = value.presentValue.load(std::memory_order_relaxed);
+		uint32_t reliabilityValue = value.reliability.load(std::memory_order_relaxed);
+		uint64_t timestampValue = value.timestamp.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (value.sequence.load(std::memory_order_relaxed) != sequence) {
+			continue;
+		}
+
+		if (presentValue != NULL) {
+			memcpy(presentValue, &bits, sizeof(bits));
+		}
+		if (reliability != NULL) {
+			*reliability = reliabilityValue;
+		}
+		if (timestamp != NULL) {
+			*timestamp = timestampValue;
+		}
+		return sequence;
+	}
+}
+
+void ExampleDatabaseLiveValueTable::MarkChanged(const size_t slot) {
+	// Only the writer that makes a word non zero has to flag it in changedWords
+	size_t word = slot / 64;
+	uint64_t previous = this->changedSlots[word].fetch_or(1ULL << (slot % 64), std::memory_order_release);
+	if (previous == 0) {
+		this->changedWords[word / 64].fetch_or(1ULL << (word % 64), std::memory_order_release);
+	}
+}
+
+size_t ExampleDatabaseLiveValueTable::CollectChanged(std::vector<uint32_t> & changed) {
+	size_t found = 0;
+	for (size_t summary = 0; summary < this->changedWordsLength; summary++) {
+		uint64_t words = this->changedWords[summary].exchange(0, std::memory_order_acquire);
+		while (words != 0) {
+			size_t word = summary * 64 + CountTrailingZeros(words);
+			words &= words - 1;
+
+			uint64_t bits = this->changedSlots[word].exchange(0, std::memory_order_acquire);
+			while (bits != 0) {
+				changed.push_back((uint32_t)(word * 64 + CountTrailingZeros(bits)));
+				bits &= bits - 1;
+				found++;
+			}
+		}
+	}
+	return found;
+}
+
+void ExampleDatabaseLiveValueTable::ClearChanged() {
+	for (size_t word = 0; word < this->changedSlotsLength; word++) {
+		this->changedSlots[word].store(0, std::memory_order_relaxed);
+	}
+	for (size_t word = 0; word < this->changedWordsLength; word++) {
+		this->changedWords[word].store(0, std::memory_order_relaxed);
+	}
+}
@@ -5,8 +5,8 @@
  *
  * Data storage that contains the example data used in the BACnet Virtual 
  * Devices Server Example. This data is represented by BACnet objects for this
- * example. The database will contain multiple virtual devices that have one 
- * object each.
+ * example. The database will contain multiple virtual devices, the number of
+ * networks, devices and objects is set by the ExampleDatabaseTopology.
  *
  * Created by: Steven Smethurst
 */
@@ -14,17 +14,14 @@
 #ifndef __CASBACnetStackExampleDatabase_h__
 #define __CASBACnetStackExampleDatabase_h__
 
+#include "CASBACnetStackExampleTopology.h"
+
 #include <string>
 #include <string.h>
-#include <map>
+#include <stdint.h>
 #include <vector>
-
-// Constants
-#define NUMBER_OF_VIRTUAL_NETWORKS		3
-#define STARTING_VIRTUAL_NETWORK		1000
-#define VIRTUAL_NETWORK_OFFSET			1000
-#define NUMBER_OF_DEVICES_PER_NETWORK	10
-#define STARTING_DEVICE_INSTANCE		100000
+#include <atomic>
+#include <memory>
 
 // Base class for all object types. 
 class ExampleDatabaseBaseObject
@@ -38,18 +35,42 @@ public:
 	uint32_t instance;
 };
 
-class ExampleDatabaseAnalogInput : public ExampleDatabaseBaseObject
+class ExampleDatabaseDevice : public ExampleDatabaseBaseObject
 {
 public:
-	float presentValue;
-	uint32_t reliability;
+	std::string description;
+	uint32_t systemStatus;
 };
 
-class ExampleDatabaseDevice : public ExampleDatabaseBaseObject
+// Objects in the virtual devices. There can be 100k+ of these so they do not
+// store a name. Names are built on request from the templates in the topology.
+class ExampleDatabaseVirtualDevice
 {
 public:
-	std::string description;
+	uint32_t instance;
 	uint32_t systemStatus;
+	uint16_t network; // The virtual network this device is on
+};
+
+class ExampleDatabaseVirtualObject
+{
+public:
+	uint32_t instance;
+	uint32_t deviceInstance; // The virtual device that owns this object
+};
+
+// The present value and reliability are updated by field drivers on other threads,
+// they are stored in ExampleDatabase::analogInputValues
+class ExampleDatabaseAnalogInput : public ExampleDatabaseVirtualObject
+{
+public:
+	float covIncrement; // Smallest change of the present value that is reported to COV subscribers
+};
+
+class ExampleDatabaseAnalogValue : public ExampleDatabaseVirtualObject
+{
+public:
+	float presentValue;
 };
 
 class ExampleDatabaseNetworkPort : public ExampleDatabaseBaseObject
@@ -69,6 +90,102 @@ public:
 	uint8_t BroadcastIPAddress[4];
 };
 
+// Flat hash index from (deviceInstance, objectType, objectInstance) to a slot in
+// one of the dense object tables of the ExampleDatabase. Uses open addressing with
+// linear probing so a lookup is normally a single cache line.
+class ExampleDatabaseObjectIndex
+{
+public:
+	static const uint32_t NOT_FOUND = 0xFFFFFFFF;
+
+	ExampleDatabaseObjectIndex();
+
+	void Clear();
+	void Reserve(size_t objectCount);
+	void Insert(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, const uint32_t slot);
+	uint32_t Find(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance) const;
+	size_t Size() const { return this->count; }
+
+private:
+	// An unused device instance (4194303 is the largest valid one) marks an empty entry
+	static const uint64_t EMPTY_KEY = 0xFFFFFFFFFFFFFFFFULL;
+
+	struct Entry {
+		uint64_t key;
+		uint32_t slot;
+	};
+
+	// The key is the device instance followed by the BACnet object identifier
+	// (10 bit object type, 22 bit instance)
+	static uint64_t MakeKey(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance) {
+		return ((uint64_t)deviceInstance << 32) | ((uint64_t)(objectType & 0x3FF) << 22) | (objectInstance & 0x3FFFFF);
+	}
+	static size_t Hash(uint64_t key);
+	void Resize(size_t capacity);
+
+	std::vector<Entry> entries;
+	size_t mask;
+	size_t count;
+};
+
+// One live value from a field driver. timestamp is microseconds since the epoch,
+// updates older than the stored value are discarded.
+struct ExampleDatabaseValueUpdate
+{
+	uint32_t deviceInstance;
+	uint32_t objectInstance;
+	float presentValue;
+	uint32_t reliability;
+	uint64_t timestamp;
+};
+
+// Table of live values that can be written from any thread while the BACnet thread
+// reads them. Each value is protected by a sequence lock: writers make the sequence
+// odd while they update the value, readers retry if the sequence was odd or changed
+// while they were reading. Readers never block writers and never see a torn value.
+class ExampleDatabaseLiveValueTable
+{
+public:
+	ExampleDatabaseLiveValueTable();
+
+	// Not thread safe, only called from ExampleDatabase::Setup()
+	void Resize(const size_t count);
+	size_t Size() const { return this->count; }
+
+	// Thread safe. Returns false if the value has a newer timestamp than this update.
+	bool Write(const size_t slot, const float presentValue, const uint32_t reliability, const uint64_t timestamp);
+
+	// Thread safe. Returns the sequence number of the value that was read, it
+	// changes every time the value is written.
+	uint32_t Read(const size_t slot, float* presentValue, uint32_t* reliability, uint64_t* timestamp = NULL) const;
+
+	// Appends the slots written since the last call to changed, in slot order, and
+	// forgets them. A slot written many times is only listed once. Only one thread
+	// may collect the changes.
+	size_t CollectChanged(std::vector<uint32_t> & changed);
+	void ClearChanged();
+
+private:
+	struct Value {
+		std::atomic<uint32_t> sequence;
+		std::atomic<uint32_t> presentValue; // float bits
+		std::atomic<uint32_t> reliability;
+		std::atomic<uint64_t> timestamp;
+	};
+
+	void MarkChanged(const size_t slot);
+
+	std::unique_ptr<Value[]> values;
+	size_t count;
+
+	// Two level bitmap of written slots. changedWords has one bit for every word
+	// of changedSlots that is not zero, so collecting a few changes out of a large
+	// table does not scan the whole bitmap.
+	std::unique_ptr<std::atomic<uint64_t>[]> changedSlots;
+	std::unique_ptr<std::atomic<uint64_t>[]> changedWords;
+	size_t changedSlotsLength;
+	size_t changedWordsLength;
+};
 
 class ExampleDatabase {
 public:
@@ -76,14 +193,32 @@ public:
 	ExampleDatabaseDevice mainDevice;
 	ExampleDatabaseNetworkPort networkPort;
 
-	std::map<uint16_t, std::vector<ExampleDatabaseDevice> > virtualDevices;
-	std::map<uint32_t, ExampleDatabaseAnalogInput> analogInputs;
+	ExampleDatabaseTopology topology;
+
+	// Dense object tables. Virtual devices are stored grouped by network in the
+	// same order as virtualNetworks, objects are grouped by device.
+	std::vector<uint16_t> virtualNetworks;
+	std::vector<ExampleDatabaseVirtualDevice> virtualDevices;
+	std::vector<ExampleDatabaseAnalogInput> analogInputs;
+	std::vector<ExampleDatabaseAnalogValue> analogValues;
+
+	// Index into the tables above, built in Setup()
+	ExampleDatabaseObjectIndex objectIndex;
+
+	// Live values of the analogInputs, same slots
+	ExampleDatabaseLiveValueTable analogInputValues;
+
+	// Ingestion counters
+	std::atomic<uint64_t> valueUpdatesApplied;
+	std::atomic<uint64_t> valueUpdatesStale;	// Older than the stored value
+	std::atomic<uint64_t> valueUpdatesUnknown;	// No such object
 
 	// Constructor/Deconstructor
 	ExampleDatabase();
 	~ExampleDatabase();
 
-	// Set all the objects to have a default value
+	// Builds all the objects from the topology and sets them to a default value.
+	// Must not be called while values are being updated.
 	void Setup();
 
 	// Update the values as needed
@@ -92,11 +227,25 @@ public:
 	// Helper functions
 	void LoadNetworkPortProperties();
 
-private:
-	const std::string GetColorName();
+	// Object lookups. Returns NULL if the object does not exist.
+	ExampleDatabaseVirtualDevice* GetVirtualDevice(const uint32_t deviceInstance);
+	ExampleDatabaseAnalogInput* GetAnalogInput(const uint32_t deviceInstance, const uint32_t objectInstance);
+	ExampleDatabaseAnalogValue* GetAnalogValue(const uint32_t deviceInstance, const uint32_t objectInstance);
+
+	// Live value ingestion. Can be called from any thread at any time after Setup(),
+	// never blocks the BACnet thread. Returns the number of updates applied.
+	size_t UpdateAnalogInputs(const ExampleDatabaseValueUpdate* updates, const size_t count);
+	bool UpdateAnalogInput(const uint32_t deviceInstance, const uint32_t objectInstance, const float presentValue, const uint32_t reliability, const uint64_t timestamp);
 
+	// Reads the live value of an Analog Input. Returns false if the object does not exist.
+	bool GetAnalogInputValue(const uint32_t deviceInstance, const uint32_t objectInstance, float* presentValue, uint32_t* reliability);
 
+	// Writes the name of a virtual object into value using the topology name templates.
+	// Returns false if the object does not exist or the name does not fit.
+	bool GetVirtualObjectName(const uint32_t deviceInstance, const uint16_t objectType, const uint32_t objectInstance, char* value, uint32_t* valueElementCount, const uint32_t maxElementCount);
 
+private:
+	static bool FormatName(const std::string & nameTemplate, const uint32_t network, const uint32_t deviceInstance, const uint32_t objectInstance, char* value, uint32_t* valueElementCount, const uint32_t maxElementCount);
 };
 
 #endif // __CASBACnetStackExampleDatabase_h__
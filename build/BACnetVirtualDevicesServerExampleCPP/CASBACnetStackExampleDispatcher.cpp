@@ -0,0 +1,289 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * CASBACnetStackExampleDispatcher.cpp
+ *
+ * Routes incoming datagrams to per shard queues by destination network.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#include "CASBACnetStackExampleDispatcher.h"
+
+#include <chrono>
+#include <stdlib.h> // strtoul()
+#include <string.h>
+
+// BACnet encoding
+static const uint8_t BVLL_TYPE_BACNET_IP = 0x81;
+static const uint8_t BVLL_FUNCTION_FORWARDED_NPDU = 0x04;
+static const uint8_t NPDU_VERSION = 0x01;
+static const uint8_t NPDU_CONTROL_DESTINATION = 0x20;
+
+static const int DISPATCHER_WAIT_MS = 100; // How often the receive thread checks if it should stop
+
+ExampleDispatcher::ExampleDispatcher() : running(false), waiting(0) {
+	this->shardCount = 0;
+	this->queueSize = DISPATCHER_QUEUE_SIZE;
+	this->udp = NULL;
+	this->nextShard = 0;
+}
+
+ExampleDispatcher::~ExampleDispatcher() {
+	this->Stop();
+}
+
+bool ExampleDispatcher::SetOption(const std::string & name, const std::string & value) {
+	uint32_t* option = NULL;
+	uint32_t minimum = 0;
+	uint32_t maximum = 0xFFFFFFFF;
+	if (name == "shards") {
+		option = &this->shardCount;
+		maximum = DISPATCHER_MAX_SHARDS;
+	}
+	else if (name == "shard-queue-size") {
+		option = &this->queueSize;
+		minimum = 1;
+		maximum = 65536;
+	}
+	if (option == NULL || value.empty()) {
+		return false;
+	}
+
+	char* end = NULL;
+	unsigned long number = strtoul(value.c_str(), &end, 10);
+	if (end == NULL || *end != '\0' || number < minimum || number > maximum) {
+		return false;
+	}
+	if (option == &this->queueSize && (number & (number - 1)) != 0) {
+		return false; // Must be a power of two
+	}
+	*option = (uint32_t)number;
+	return true;
+}
+
+bool ExampleDispatcher::Start(CSimpleUDP* udp, const std::vector<uint16_t> & virtualNetworks) {
+	if (this->IsRunning() || this->shardCount == 0 || udp == NULL || !udp->IsEventMode()) {
+		return false;
+	}
+	this->udp = udp;
+
+	// From here the receive thread opens and closes the socket, the BACnet thread only sends
+	this->udp->SetSharedSocket(true);
+
+	this->shards.reset(new Shard[this->shardCount]);
+	for (uint32_t shard = 0; shard < this->shardCount; shard++) {
+		this->shards[shard].queue.reset(new CSimpleUDPPacket[this->queueSize]);
+		this->shards[shard].head.store(0);
+		this->shards[shard].tail.store(0);
+		this->shards[shard].received.store(0);
+		this->shards[shard].dropped.store(0);
+		this->shards[shard].processed.store(0);
+		this->shards[shard].networks = 0;
+	}
+
+	// Spread the virtual networks over the shards in turn
+	this->networkShards.assign(0x10000, 0);
+	for (size_t offset = 0; offset < virtualNetworks.size(); offset++) {
+		uint32_t shard = (uint32_t)(offset % this->shardCount);
+		this->networkShards[virtualNetworks[offset]] = (uint8_t)shard;
+		this->shards[shard].networks++;
+	}
+	this->nextShard = 0;
+
+	this->running.store(true);
+	this->thread = std::thread(&ExampleDispatcher::ThreadLoop, this);
+	return true;
+}
+
+void ExampleDispatcher::Stop() {
+	if (this->thread.joinable()) {
+		this->running.store(false);
+		this->thread.join();
+	}
+	if (this->udp != NULL) {
+		this->udp->SetSharedSocket(false);
+	}
+}
+
+uint16_t ExampleDispatcher::GetMessage(uint8_t* buffer, const uint16_t maxLength, uint8_t* ipAddress, uint16_t* port) {
+	if (!this->shards) {
+		return 0;
+	}
+
+	for (uint32_t visited = 0; visited < this->shardCount; visited++) {
+		Shard & shard = this->shards[this->nextShard];
+		if (++this->nextShard >= this->shardCount) {
+			this->nextShard = 0;
+		}
+
+		bool taken = false;
+		uint16_t length = this->TakeMessage(shard, buffer, maxLength, ipAddress, port, taken);
+		if (length > 0) {
+			return length;
+		}
+	}
+	return 0;
+}
+
+bool ExampleDispatcher::WaitForMessage(const int timeoutMs) {
+	if (this->HasMessage()) {
+		return true;
+	}
+
+	std::unique_lock<std::mutex> lock(this->waitMutex);
+	this->waiting.fetch_add(1);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	bool found = this->waitCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return this->HasMessage(); });
+	this->waiting.fetch_sub(1);
+	return found;
+}
+
+uint16_t ExampleDispatcher::GetShardMessage(const uint32_t shard, uint8_t* buffer, const uint16_t maxLength, uint8_t* ipAddress, uint16_t* port) {
+	if (!this->shards || shard >= this->shardCount) {
+		return 0;
+	}
+
+	// Skip over any messages that are too large
+	bool taken = true;
+	while (taken) {
+		uint16_t length = this->TakeMessage(this->shards[shard], buffer, maxLength, ipAddress, port, taken);
+		if (length > 0) {
+			return length;
+		}
+	}
+	return 0;
+}
+
+bool ExampleDispatcher::WaitForShardMessage(const uint32_t shard, const int timeoutMs) {
+	if (!this->shards || shard >= this->shardCount) {
+		return false;
+	}
+	const Shard & owner = this->shards[shard];
+	if (this->HasShardMessage(owner)) {
+		return true;
+	}
+
+	std::unique_lock<std::mutex> lock(this->waitMutex);
+	this->waiting.fetch_add(1);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	bool found = this->waitCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this, &owner] { return this->HasShardMessage(owner); });
+	this->waiting.fetch_sub(1);
+	return found;
+}
+
+ExampleDispatcherShardStats ExampleDispatcher::GetShardStats(const uint32_t shard) const {
+	ExampleDispatcherShardStats stats;
+	memset(&stats, 0, sizeof(stats));
+	if (!this->shards || shard >= this->shardCount) {
+		return stats;
+	}
+	const Shard & owner = this->shards[shard];
+	stats.networks = owner.networks;
+	stats.received = owner.received.load(std::memory_order_relaxed);
+	stats.dropped = owner.dropped.load(std::memory_order_relaxed);
+	stats.processed = owner.processed.load(std::memory_order_relaxed);
+	stats.queued = owner.tail.load(std::memory_order_relaxed) - owner.head.load(std::memory_order_relaxed);
+	return stats;
+}
+
+bool ExampleDispatcher::HasMessage() const {
+	for (uint32_t shard = 0; shard < this->shardCount; shard++) {
+		if (this->HasShardMessage(this->shards[shard])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ExampleDispatcher::HasShardMessage(const Shard & shard) const {
+	return shard.head.load(std::memory_order_relaxed) != shard.tail.load(std::memory_order_acquire);
+}
+
+uint16_t ExampleDispatcher::TakeMessage(Shard & shard, uint8_t* buffer, const uint16_t maxLength, uint8_t* ipAddress, uint16_t* port, bool & taken) {
+	size_t head = shard.head.load(std::memory_order_relaxed);
+	if (head == shard.tail.load(std::memory_order_acquire)) {
+		taken = false;
+		return 0;
+	}
+
+	const CSimpleUDPPacket & packet = shard.queue[head & (this->queueSize - 1)];
+	uint16_t length = packet.length <= maxLength ? packet.length : 0; // Too large messages are skipped
+	if (length > 0) {
+		memcpy(buffer, packet.data, length);
+		memcpy(ipAddress, &packet.address.sin_addr, 4);
+		*port = ntohs(packet.address.sin_port);
+	}
+	shard.head.store(head + 1, std::memory_order_release);
+	shard.processed.fetch_add(1, std::memory_order_relaxed);
+	taken = true;
+	return length;
+}
+
+void ExampleDispatcher::ThreadLoop() {
+	std::unique_ptr<CSimpleUDPPacket[]> batch(new CSimpleUDPPacket[DISPATCHER_RECEIVE_BATCH]);
+
+	while (this->running.load(std::memory_order_relaxed)) {
+		if (this->udp->NeedsReConnect()) {
+			// This thread owns the socket, a failed send only asks for the reconnect. Done here
+			// so that the server keeps receiving even when it has nothing to send.
+			if (!this->udp->ReConnectShared()) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(DISPATCHER_WAIT_MS));
+				continue;
+			}
+		}
+		if (!this->udp->WaitForMessage(DISPATCHER_WAIT_MS)) {
+			continue;
+		}
+		int count = this->udp->ReceiveMessages(batch.get(), DISPATCHER_RECEIVE_BATCH);
+		if (count < 0) {
+			this->udp->RequestReConnect();
+			continue;
+		}
+		if (count == 0) {
+			continue;
+		}
+
+		for (int offset = 0; offset < count; offset++) {
+			const CSimpleUDPPacket & packet = batch[offset];
+			if (packet.length == 0) {
+				continue; // Truncated
+			}
+
+			Shard & shard = this->shards[this->Route(packet.data, packet.length)];
+			shard.received.fetch_add(1, std::memory_order_relaxed);
+			size_t tail = shard.tail.load(std::memory_order_relaxed);
+			if (tail - shard.head.load(std::memory_order_acquire) >= this->queueSize) {
+				// This shard is behind, drop rather than hold up the other shards
+				shard.dropped.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+
+			CSimpleUDPPacket & queued = shard.queue[tail & (this->queueSize - 1)];
+			memcpy(queued.data, packet.data, packet.length);
+			queued.length = packet.length;
+			queued.address = packet.address;
+			shard.tail.store(tail + 1, std::memory_order_release);
+		}
+
+		// Wake the BACnet thread or the shard workers if they are waiting
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (this->waiting.load() > 0) {
+			std::lock_guard<std::mutex> lock(this->waitMutex);
+			this->waitCondition.notify_all();
+		}
+	}
+}
+
+uint32_t ExampleDispatcher::Route(const uint8_t* message, const uint16_t length) const {
+	// Anything that is not a routed NPDU for one of the virtual networks goes to shard 0
+	if (length < 6 || message[0] != BVLL_TYPE_BACNET_IP) {
+		return 0;
+	}
+	uint16_t offset = message[1] == BVLL_FUNCTION_FORWARDED_NPDU ? 10 : 4;
+	if (offset + 4 > length || message[offset] != NPDU_VERSION || (message[offset + 1] & NPDU_CONTROL_DESTINATION) == 0) {
+		return 0;
+	}
+	uint16_t network = (uint16_t)((message[offset + 2] << 8) | message[offset + 3]);
+	return this->networkShards[network];
+}
@@ -0,0 +1,122 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * CASBACnetStackExampleDispatcher.h
+ *
+ * Sharded receive path. A receive thread reads the BACnet/IP socket in
+ * batches and routes each datagram by its destination network number into
+ * the queue of the shard that owns that virtual network. Each shard has a
+ * lock free single producer / single consumer queue. The BACnet thread takes
+ * messages from the shards in turn, so a flood of requests to one virtual
+ * network only fills that shard's queue and can not starve the others.
+ *
+ * The CAS BACnet Stack is not thread safe, so the server still processes the
+ * requests on the BACnet thread. A program that can answer in parallel gives
+ * each shard its own worker with GetShardMessage(), see the responder in
+ * BACnetVirtualDevicesBenchmarks.
+ *
+ * While the dispatcher runs the receive thread owns the socket. The BACnet
+ * thread still sends on it, but only the receive thread closes and reopens it.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#ifndef __CASBACnetStackExampleDispatcher_h__
+#define __CASBACnetStackExampleDispatcher_h__
+
+#include "SimpleUDP.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define DISPATCHER_MAX_SHARDS		64
+#define DISPATCHER_QUEUE_SIZE		1024	// Datagrams per shard, must be a power of two
+#define DISPATCHER_RECEIVE_BATCH	64		// Datagrams read from the socket in one call
+
+struct ExampleDispatcherShardStats
+{
+	uint32_t networks;	// Virtual networks owned by the shard
+	uint64_t received;	// Routed to the shard
+	uint64_t dropped;	// Queue was full
+	uint64_t processed;	// Taken by the BACnet thread or the shard's worker
+	size_t queued;
+};
+
+class ExampleDispatcher
+{
+public:
+	// Options
+	uint32_t shardCount;	// 0 turns the dispatcher off
+	uint32_t queueSize;
+
+	ExampleDispatcher();
+	~ExampleDispatcher();
+
+	// Sets one option by name, eg. "shards". Returns false if the option is unknown
+	// or the value is invalid.
+	bool SetOption(const std::string & name, const std::string & value);
+
+	// Assigns the virtual networks to the shards and starts the receive thread. Shard 0
+	// also gets everything that is not sent to a virtual network. udp must be connected
+	// in event mode. Returns false if the dispatcher is off or can not be used.
+	bool Start(CSimpleUDP* udp, const std::vector<uint16_t> & virtualNetworks);
+	void Stop();
+	bool IsRunning() const { return this->thread.joinable(); }
+
+	// Takes the next message, visiting the shards in turn. Must only be called from the
+	// BACnet thread. ipAddress is the 4 byte IPv4 address in network order. Returns the
+	// length of the message, or 0 if every queue is empty.
+	uint16_t GetMessage(uint8_t* buffer, const uint16_t maxLength, uint8_t* ipAddress, uint16_t* port);
+
+	// Blocks the BACnet thread until a message is queued or timeoutMs has passed.
+	// Returns true if there is something to read.
+	bool WaitForMessage(const int timeoutMs);
+
+	// The same for one shard, for a worker thread that owns the shard. A shard must only
+	// have one reader, so GetMessage() can not be used at the same time.
+	uint16_t GetShardMessage(const uint32_t shard, uint8_t* buffer, const uint16_t maxLength, uint8_t* ipAddress, uint16_t* port);
+	bool WaitForShardMessage(const uint32_t shard, const int timeoutMs);
+
+	ExampleDispatcherShardStats GetShardStats(const uint32_t shard) const;
+
+private:
+	struct Shard {
+		std::unique_ptr<CSimpleUDPPacket[]> queue;
+		std::atomic<size_t> head;	// Only written by the reader of the shard
+		std::atomic<size_t> tail;	// Only written by the receive thread
+		std::atomic<uint64_t> received;
+		std::atomic<uint64_t> dropped;
+		std::atomic<uint64_t> processed;
+		uint32_t networks;
+	};
+
+	void ThreadLoop();
+	uint32_t Route(const uint8_t* message, const uint16_t length) const;
+	bool HasMessage() const;
+	bool HasShardMessage(const Shard & shard) const;
+
+	// Takes the oldest message of the shard. Returns its length, 0 if the queue is empty or
+	// the message was too large and skipped. taken is false if the queue was empty.
+	uint16_t TakeMessage(Shard & shard, uint8_t* buffer, const uint16_t maxLength, uint8_t* ipAddress, uint16_t* port, bool & taken);
+
+	CSimpleUDP* udp;
+	std::unique_ptr<Shard[]> shards;
+	std::vector<uint8_t> networkShards; // Shard of each network number
+	uint32_t nextShard;
+
+	std::atomic<bool> running;
+	std::thread thread;
+
+	// Wakes the BACnet thread or the shard workers when they are waiting for messages
+	std::mutex waitMutex;
+	std::condition_variable waitCondition;
+	std::atomic<uint32_t> waiting;
+};
+
+#endif // __CASBACnetStackExampleDispatcher_h__
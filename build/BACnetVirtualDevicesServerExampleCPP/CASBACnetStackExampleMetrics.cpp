@@ -0,0 +1,300 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * CASBACnetStackExampleMetrics.cpp
+ *
+ * Per thread counters and latency histograms.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#include "CASBACnetStackExampleMetrics.h"
+
+#include <algorithm> // std::sort
+#include <map>
+#include <stdio.h> // snprintf()
+#include <stdlib.h> // strtoul()
+#include <string.h>
+
+static const char* METRICS_PREFIX = "bacnet_server_";
+static const size_t METRICS_SUMMARY_PROPERTIES = 10; // Busiest properties listed in the summary
+
+// Key of a (callback, object type, property) combination. Never zero.
+static uint64_t MakePropertyKey(const uint8_t callback, const uint16_t objectType, const uint32_t propertyIdentifier)
+{
+	return ((uint64_t)(callback + 1) << 48) | ((uint64_t)objectType << 32) | propertyIdentifier;
+}
+
+static bool CompareByCount(const ExampleMetrics::PropertySnapshot & first, const ExampleMetrics::PropertySnapshot & second)
+{
+	return first.count > second.count;
+}
+
+ExampleMetrics::ExampleMetrics() {
+	this->statsIntervalSeconds = 0;
+}
+
+bool ExampleMetrics::SetOption(const std::string & name, const std::string & value) {
+	if (name != "stats-interval" || value.empty()) {
+		return false;
+	}
+	char* end = NULL;
+	unsigned long number = strtoul(value.c_str(), &end, 10);
+	if (end == NULL || *end != '\0' || number > 86400) {
+		return false;
+	}
+	this->statsIntervalSeconds = (uint32_t)number;
+	return true;
+}
+
+ExampleMetrics::ThreadBlock & ExampleMetrics::GetThreadBlock() {
+	static thread_local const ExampleMetrics* owner = NULL;
+	static thread_local ThreadBlock* block = NULL;
+	if (owner != this) {
+		// First use on this thread. Value initialization zeros all the counters.
+		std::lock_guard<std::mutex> lock(this->blocksMutex);
+		this->blocks.push_back(std::unique_ptr<ThreadBlock>(new ThreadBlock()));
+		block = this->blocks.back().get();
+		owner = this;
+	}
+	return *block;
+}
+
+void ExampleMetrics::Add(const Counter counter, const uint64_t value) {
+	Increment(this->GetThreadBlock().counters[counter], value);
+}
+
+void ExampleMetrics::Record(const Histogram histogram, const uint64_t durationNs) {
+	ThreadHistogram & owner = this->GetThreadBlock().histograms[histogram];
+	size_t bucket = 0;
+	while (bucket < METRICS_HISTOGRAM_BUCKETS - 1 && (durationNs >> bucket) != 0) {
+		bucket++;
+	}
+	Increment(owner.buckets[bucket], 1);
+	Increment(owner.count, 1);
+	Increment(owner.sumNs, durationNs);
+}
+
+void ExampleMetrics::RecordGetProperty(const GetPropertyCallback callback, const uint16_t objectType, const uint32_t propertyIdentifier, const bool found, const uint64_t durationNs) {
+	this->Record((Histogram)(HISTOGRAM_GET_PROPERTY + callback), durationNs);
+
+	// Open addressing with linear probing. Only this thread adds keys to its table.
+	ThreadBlock & block = this->GetThreadBlock();
+	const uint64_t key = MakePropertyKey((uint8_t)callback, objectType, propertyIdentifier);
+	size_t slot = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (METRICS_PROPERTY_TABLE_SIZE - 1);
+	for (size_t probe = 0; probe < METRICS_PROPERTY_TABLE_SIZE; probe++) {
+		ThreadProperty & entry = block.properties[slot];
+		uint64_t entryKey = entry.key.load(std::memory_order_relaxed);
+		if (entryKey == 0) {
+			entry.key.store(key, std::memory_order_release);
+			entryKey = key;
+		}
+		if (entryKey == key) {
+			Increment(entry.count, 1);
+			if (!found) {
+				Increment(entry.failures, 1);
+			}
+			Increment(entry.totalNs, durationNs);
+			return;
+		}
+		slot = (slot + 1) & (METRICS_PROPERTY_TABLE_SIZE - 1);
+	}
+	Increment(block.propertiesNotTracked, 1);
+}
+
+void ExampleMetrics::GetSnapshot(Snapshot & snapshot) const {
+	memset(snapshot.counters, 0, sizeof(snapshot.counters));
+	memset(snapshot.histograms, 0, sizeof(snapshot.histograms));
+	snapshot.properties.clear();
+	snapshot.propertiesNotTracked = 0;
+
+	std::map<uint64_t, PropertySnapshot> properties;
+	std::lock_guard<std::mutex> lock(this->blocksMutex);
+	for (size_t offset = 0; offset < this->blocks.size(); offset++) {
+		const ThreadBlock & block = *this->blocks[offset];
+		for (size_t counter = 0; counter < COUNTER_COUNT; counter++) {
+			snapshot.counters[counter] += block.counters[counter].load(std::memory_order_relaxed);
+		}
+		for (size_t histogram = 0; histogram < HISTOGRAM_COUNT; histogram++) {
+			const ThreadHistogram & source = block.histograms[histogram];
+			HistogramSnapshot & target = snapshot.histograms[histogram];
+			for (size_t bucket = 0; bucket < METRICS_HISTOGRAM_BUCKETS; bucket++) {
+				target.buckets[bucket] += source.buckets[bucket].load(std::memory_order_relaxed);
+			}
+			target.count += source.count.load(std::memory_order_relaxed);
+			target.sumNs += source.sumNs.load(std::memory_order_relaxed);
+		}
+		for (size_t slot = 0; slot < METRICS_PROPERTY_TABLE_SIZE; slot++) {
+			const ThreadProperty & entry = block.properties[slot];
+			uint64_t key = entry.key.load(std::memory_order_acquire);
+			if (key == 0) {
+				continue;
+			}
+			std::map<uint64_t, PropertySnapshot>::iterator it = properties.find(key);
+			if (it == properties.end()) {
+				PropertySnapshot property;
+				property.callback = (uint8_t)((key >> 48) - 1);
+				property.objectType = (uint16_t)(key >> 32);
+				property.propertyIdentifier = (uint32_t)key;
+				property.count = 0;
+				property.failures = 0;
+				property.totalNs = 0;
+				it = properties.insert(std::make_pair(key, property)).first;
+			}
+			it->second.count += entry.count.load(std::memory_order_relaxed);
+			it->second.failures += entry.failures.load(std::memory_order_relaxed);
+			it->second.totalNs += entry.totalNs.load(std::memory_order_relaxed);
+		}
+		snapshot.propertiesNotTracked += block.propertiesNotTracked.load(std::memory_order_relaxed);
+	}
+
+	snapshot.properties.reserve(properties.size());
+	for (std::map<uint64_t, PropertySnapshot>::const_iterator it = properties.begin(); it != properties.end(); ++it) {
+		snapshot.properties.push_back(it->second);
+	}
+}
+
+void ExampleMetrics::AppendCounter(std::string & output, const char* name, const char* help, const uint64_t value) {
+	char line[256];
+	snprintf(line, sizeof(line), "# HELP %s%s %s\n# TYPE %s%s counter\n%s%s %llu\n", METRICS_PREFIX, name, help, METRICS_PREFIX, name, METRICS_PREFIX, name, (unsigned long long)value);
+	output += line;
+}
+
+void ExampleMetrics::AppendGauge(std::string & output, const char* name, const char* help, const uint64_t value) {
+	char line[256];
+	snprintf(line, sizeof(line), "# HELP %s%s %s\n# TYPE %s%s gauge\n%s%s %llu\n", METRICS_PREFIX, name, help, METRICS_PREFIX, name, METRICS_PREFIX, name, (unsigned long long)value);
+	output += line;
+}
+
+// Writes the buckets, sum and count of one histogram. labels is either empty or
+// ends with a comma, eg. callback="real",
+static void AppendHistogramSeries(std::string & output, const char* name, const char* labels, const ExampleMetrics::HistogramSnapshot & histogram)
+{
+	char line[256];
+	uint64_t cumulative = 0;
+	for (size_t bucket = 0; bucket < METRICS_HISTOGRAM_BUCKETS - 1; bucket++) {
+		cumulative += histogram.buckets[bucket];
+		snprintf(line, sizeof(line), "%s%s_bucket{%sle=\"%.9g\"} %llu\n", METRICS_PREFIX, name, labels, (double)(1ULL << bucket) / 1e9, (unsigned long long)cumulative);
+		output += line;
+	}
+	snprintf(line, sizeof(line), "%s%s_bucket{%sle=\"+Inf\"} %llu\n", METRICS_PREFIX, name, labels, (unsigned long long)histogram.count);
+	output += line;
+
+	// Drop the trailing comma for the sum and count
+	std::string plainLabels(labels);
+	if (!plainLabels.empty()) {
+		plainLabels.erase(plainLabels.size() - 1);
+		plainLabels = "{" + plainLabels + "}";
+	}
+	snprintf(line, sizeof(line), "%s%s_sum%s %.9f\n%s%s_count%s %llu\n", METRICS_PREFIX, name, plainLabels.c_str(), (double)histogram.sumNs / 1e9, METRICS_PREFIX, name, plainLabels.c_str(), (unsigned long long)histogram.count);
+	output += line;
+}
+
+void ExampleMetrics::WritePrometheus(const Snapshot & snapshot, std::string & output) {
+	AppendCounter(output, "received_packets_total", "Messages passed to the CAS BACnet Stack or the announcer", snapshot.counters[COUNTER_RECEIVED_PACKETS]);
+	AppendCounter(output, "received_bytes_total", "Bytes of the received messages", snapshot.counters[COUNTER_RECEIVED_BYTES]);
+	AppendCounter(output, "receive_errors_total", "Received messages that could not be handled", snapshot.counters[COUNTER_RECEIVE_ERRORS]);
+	AppendCounter(output, "sent_packets_total", "Messages sent or queued for sending", snapshot.counters[COUNTER_SENT_PACKETS]);
+	AppendCounter(output, "sent_bytes_total", "Bytes of the sent messages", snapshot.counters[COUNTER_SENT_BYTES]);
+	AppendCounter(output, "send_errors_total", "Messages that could not be sent", snapshot.counters[COUNTER_SEND_ERRORS]);
+
+	output += "# HELP bacnet_server_loop_duration_seconds Time spent in fpLoop()\n";
+	output += "# TYPE bacnet_server_loop_duration_seconds histogram\n";
+	AppendHistogramSeries(output, "loop_duration_seconds", "", snapshot.histograms[HISTOGRAM_LOOP]);
+
+	output += "# HELP bacnet_server_get_property_duration_seconds Time spent in the GetProperty callbacks\n";
+	output += "# TYPE bacnet_server_get_property_duration_seconds histogram\n";
+	for (size_t callback = 0; callback < GET_PROPERTY_CALLBACK_COUNT; callback++) {
+		char labels[64];
+		snprintf(labels, sizeof(labels), "callback=\"%s\",", GetCallbackName((GetPropertyCallback)callback));
+		AppendHistogramSeries(output, "get_property_duration_seconds", labels, snapshot.histograms[HISTOGRAM_GET_PROPERTY + callback]);
+	}
+
+	static const char* PROPERTY_SERIES[3][2] = {
+		{ "get_property_calls_total", "GetProperty callbacks by object type and property" },
+		{ "get_property_failures_total", "GetProperty callbacks that returned false" },
+		{ "get_property_seconds_total", "Time spent in the GetProperty callbacks by object type and property" }
+	};
+	for (size_t series = 0; series < 3; series++) {
+		char line[256];
+		snprintf(line, sizeof(line), "# HELP %s%s %s\n# TYPE %s%s counter\n", METRICS_PREFIX, PROPERTY_SERIES[series][0], PROPERTY_SERIES[series][1], METRICS_PREFIX, PROPERTY_SERIES[series][0]);
+		output += line;
+		for (size_t offset = 0; offset < snapshot.properties.size(); offset++) {
+			const PropertySnapshot & property = snapshot.properties[offset];
+			int length = snprintf(line, sizeof(line), "%s%s{callback=\"%s\",object_type=\"%u\",property=\"%u\"} ", METRICS_PREFIX, PROPERTY_SERIES[series][0], GetCallbackName((GetPropertyCallback)property.callback), property.objectType, property.propertyIdentifier);
+			if (length < 0 || (size_t)length >= sizeof(line)) {
+				continue;
+			}
+			if (series == 0) {
+				snprintf(line + length, sizeof(line) - length, "%llu\n", (unsigned long long)property.count);
+			}
+			else if (series == 1) {
+				snprintf(line + length, sizeof(line) - length, "%llu\n", (unsigned long long)property.failures);
+			}
+			else {
+				snprintf(line + length, sizeof(line) - length, "%.9f\n", (double)property.totalNs / 1e9);
+			}
+			output += line;
+		}
+	}
+	AppendCounter(output, "get_property_not_tracked_total", "GetProperty callbacks that did not fit in the property table", snapshot.propertiesNotTracked);
+}
+
+void ExampleMetrics::WriteSummary(const Snapshot & snapshot, std::ostream & output) {
+	output << "Received: packets=[" << snapshot.counters[COUNTER_RECEIVED_PACKETS] << "], bytes=[" << snapshot.counters[COUNTER_RECEIVED_BYTES] << "], errors=[" << snapshot.counters[COUNTER_RECEIVE_ERRORS] << "]" << std::endl;
+	output << "Sent: packets=[" << snapshot.counters[COUNTER_SENT_PACKETS] << "], bytes=[" << snapshot.counters[COUNTER_SENT_BYTES] << "], errors=[" << snapshot.counters[COUNTER_SEND_ERRORS] << "]" << std::endl;
+
+	const HistogramSnapshot & loop = snapshot.histograms[HISTOGRAM_LOOP];
+	output << "fpLoop: calls=[" << loop.count << "], p50=[<" << GetPercentileNs(loop, 0.50) << " ns], p99=[<" << GetPercentileNs(loop, 0.99) << " ns], total=[" << loop.sumNs / 1000000 << " ms]" << std::endl;
+	for (size_t callback = 0; callback < GET_PROPERTY_CALLBACK_COUNT; callback++) {
+		const HistogramSnapshot & histogram = snapshot.histograms[HISTOGRAM_GET_PROPERTY + callback];
+		if (histogram.count == 0) {
+			continue;
+		}
+		output << "GetProperty " << GetCallbackName((GetPropertyCallback)callback) << ": calls=[" << histogram.count << "], p50=[<" << GetPercentileNs(histogram, 0.50) << " ns], p99=[<" << GetPercentileNs(histogram, 0.99) << " ns]" << std::endl;
+	}
+
+	// The busiest properties
+	std::vector<PropertySnapshot> properties(snapshot.properties);
+	std::sort(properties.begin(), properties.end(), CompareByCount);
+	for (size_t offset = 0; offset < properties.size() && offset < METRICS_SUMMARY_PROPERTIES; offset++) {
+		const PropertySnapshot & property = properties[offset];
+		output << "  " << GetCallbackName((GetPropertyCallback)property.callback) << " objectType=[" << property.objectType << "], property=[" << property.propertyIdentifier << "]: calls=[" << property.count << "], failures=[" << property.failures << "], average=[" << (property.count > 0 ? property.totalNs / property.count : 0) << " ns]" << std::endl;
+	}
+}
+
+uint64_t ExampleMetrics::GetPercentileNs(const HistogramSnapshot & histogram, const double percentile) {
+	if (histogram.count == 0) {
+		return 0;
+	}
+	uint64_t target = (uint64_t)(percentile * (double)histogram.count);
+	if (target >= histogram.count) {
+		target = histogram.count - 1;
+	}
+	uint64_t cumulative = 0;
+	for (size_t bucket = 0; bucket < METRICS_HISTOGRAM_BUCKETS; bucket++) {
+		cumulative += histogram.buckets[bucket];
+		if (cumulative > target) {
+			return 1ULL << bucket;
+		}
+	}
+	return 1ULL << (METRICS_HISTOGRAM_BUCKETS - 1);
+}
+
+const char* ExampleMetrics::GetCallbackName(const GetPropertyCallback callback) {
+	switch (callback) {
+	case GET_PROPERTY_CHARACTER_STRING:
+		return "character_string";
+	case GET_PROPERTY_ENUMERATED:
+		return "enumerated";
+	case GET_PROPERTY_OCTET_STRING:
+		return "octet_string";
+	case GET_PROPERTY_REAL:
+		return "real";
+	case GET_PROPERTY_UNSIGNED_INTEGER:
+		return "unsigned_integer";
+	default:
+		break;
+	}
+	return "unknown";
+}
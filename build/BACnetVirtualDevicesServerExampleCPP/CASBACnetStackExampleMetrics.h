@@ -0,0 +1,155 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * CASBACnetStackExampleMetrics.h
+ *
+ * Counters and latency histograms for the hot paths. Every thread updates its
+ * own block of counters without locks or atomic read-modify-write, the blocks
+ * are only added together when the metrics are read. Histograms use power of
+ * two buckets of nanoseconds.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#ifndef __CASBACnetStackExampleMetrics_h__
+#define __CASBACnetStackExampleMetrics_h__
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#define METRICS_HISTOGRAM_BUCKETS	32	// Bucket n counts durations below 2^n ns, the last bucket is everything else
+#define METRICS_PROPERTY_TABLE_SIZE	256	// (callback, object type, property) combinations tracked per thread, power of two
+
+// Measures the time between its construction and GetElapsedNs()
+class ExampleMetricsTimer
+{
+public:
+	ExampleMetricsTimer() : start(std::chrono::steady_clock::now()) {}
+	uint64_t GetElapsedNs() const {
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - this->start).count();
+	}
+
+private:
+	std::chrono::steady_clock::time_point start;
+};
+
+class ExampleMetrics
+{
+public:
+	enum Counter {
+		COUNTER_RECEIVED_PACKETS = 0,
+		COUNTER_RECEIVED_BYTES,
+		COUNTER_RECEIVE_ERRORS,
+		COUNTER_SENT_PACKETS,
+		COUNTER_SENT_BYTES,
+		COUNTER_SEND_ERRORS,
+		COUNTER_COUNT
+	};
+
+	enum GetPropertyCallback {
+		GET_PROPERTY_CHARACTER_STRING = 0,
+		GET_PROPERTY_ENUMERATED,
+		GET_PROPERTY_OCTET_STRING,
+		GET_PROPERTY_REAL,
+		GET_PROPERTY_UNSIGNED_INTEGER,
+		GET_PROPERTY_CALLBACK_COUNT
+	};
+
+	// One histogram for fpLoop() and one for each GetProperty callback
+	enum Histogram {
+		HISTOGRAM_LOOP = 0,
+		HISTOGRAM_GET_PROPERTY,
+		HISTOGRAM_COUNT = HISTOGRAM_GET_PROPERTY + GET_PROPERTY_CALLBACK_COUNT
+	};
+
+	struct HistogramSnapshot {
+		uint64_t buckets[METRICS_HISTOGRAM_BUCKETS];
+		uint64_t count;
+		uint64_t sumNs;
+	};
+
+	struct PropertySnapshot {
+		uint8_t callback;
+		uint16_t objectType;
+		uint32_t propertyIdentifier;
+		uint64_t count;
+		uint64_t failures;	// The callback returned false
+		uint64_t totalNs;
+	};
+
+	struct Snapshot {
+		uint64_t counters[COUNTER_COUNT];
+		HistogramSnapshot histograms[HISTOGRAM_COUNT];
+		std::vector<PropertySnapshot> properties; // Sorted by callback, object type and property
+		uint64_t propertiesNotTracked; // Calls that did not fit in a property table
+	};
+
+	// Options
+	uint32_t statsIntervalSeconds; // Periodic stats dump, 0 is off
+
+	ExampleMetrics();
+
+	// Sets one option by name, eg. "stats-interval". Returns false if the option is
+	// unknown or the value is invalid.
+	bool SetOption(const std::string & name, const std::string & value);
+
+	// Hot path. Only touch the calling thread's block.
+	void Add(const Counter counter, const uint64_t value = 1);
+	void Record(const Histogram histogram, const uint64_t durationNs);
+	void RecordGetProperty(const GetPropertyCallback callback, const uint16_t objectType, const uint32_t propertyIdentifier, const bool found, const uint64_t durationNs);
+
+	// Adds up the blocks of all threads
+	void GetSnapshot(Snapshot & snapshot) const;
+
+	// Prometheus text format. AppendCounter/AppendGauge are used by the application to
+	// add values kept by other modules.
+	static void WritePrometheus(const Snapshot & snapshot, std::string & output);
+	static void AppendCounter(std::string & output, const char* name, const char* help, const uint64_t value);
+	static void AppendGauge(std::string & output, const char* name, const char* help, const uint64_t value);
+
+	// Short human readable summary, used by the 'h' command and the periodic dump
+	static void WriteSummary(const Snapshot & snapshot, std::ostream & output);
+
+	// Upper bound of the bucket that holds the given percentile, in ns
+	static uint64_t GetPercentileNs(const HistogramSnapshot & histogram, const double percentile);
+
+	static const char* GetCallbackName(const GetPropertyCallback callback);
+
+private:
+	// Written only by the owning thread. The atomics are there so that reads from
+	// other threads are well defined, updates are plain relaxed loads and stores.
+	struct ThreadHistogram {
+		std::atomic<uint64_t> buckets[METRICS_HISTOGRAM_BUCKETS];
+		std::atomic<uint64_t> count;
+		std::atomic<uint64_t> sumNs;
+	};
+	struct ThreadProperty {
+		std::atomic<uint64_t> key; // 0 is unused
+		std::atomic<uint64_t> count;
+		std::atomic<uint64_t> failures;
+		std::atomic<uint64_t> totalNs;
+	};
+	struct ThreadBlock {
+		std::atomic<uint64_t> counters[COUNTER_COUNT];
+		ThreadHistogram histograms[HISTOGRAM_COUNT];
+		ThreadProperty properties[METRICS_PROPERTY_TABLE_SIZE];
+		std::atomic<uint64_t> propertiesNotTracked;
+	};
+
+	ThreadBlock & GetThreadBlock();
+	static void Increment(std::atomic<uint64_t> & value, const uint64_t amount) {
+		value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	// Blocks are never freed, a thread that exits keeps its counts
+	mutable std::mutex blocksMutex;
+	std::vector<std::unique_ptr<ThreadBlock> > blocks;
+};
+
+#endif // __CASBACnetStackExampleMetrics_h__
@@ -0,0 +1,250 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * CASBACnetStackExampleMetricsServer.cpp
+ *
+ * Non-blocking HTTP endpoint for the metrics.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#include "CASBACnetStackExampleMetricsServer.h"
+
+#include <stdio.h> // snprintf()
+#include <stdlib.h> // strtoul()
+#include <string.h>
+
+#if defined(__GNUC__)
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif // __GNUC__
+
+static const size_t METRICS_SERVER_MAX_REQUEST_LENGTH = 4096;
+static const int METRICS_SERVER_TIMEOUT_SECONDS = 5;
+
+// A client that closes the connection before the response is sent must not
+// raise SIGPIPE, which would stop the server.
+#if defined(MSG_NOSIGNAL)
+static const int METRICS_SERVER_SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int METRICS_SERVER_SEND_FLAGS = 0; // SO_NOSIGPIPE is set on the socket instead, where it exists
+#endif
+
+ExampleMetricsServer::ExampleMetricsServer() {
+	this->port = 0;
+	this->address = METRICS_SERVER_ADDRESS;
+	this->requestsServed = 0;
+	this->running = false;
+	this->listenSocket = 0;
+}
+
+ExampleMetricsServer::~ExampleMetricsServer() {
+	this->Stop();
+}
+
+bool ExampleMetricsServer::SetOption(const std::string & name, const std::string & value) {
+	if (name == "metrics-port") {
+		char* end = NULL;
+		unsigned long number = strtoul(value.c_str(), &end, 10);
+		if (value.empty() || end == NULL || *end != '\0' || number > 65535) {
+			return false;
+		}
+		this->port = (uint16_t)number;
+		return true;
+	}
+	else if (name == "metrics-address") {
+		struct in_addr parsed;
+		if (inet_pton(AF_INET, value.c_str(), &parsed) != 1) {
+			return false;
+		}
+		this->address = value;
+		return true;
+	}
+	return false;
+}
+
+bool ExampleMetricsServer::Start() {
+	if (this->running || this->port == 0) {
+		return false;
+	}
+
+#ifdef _MSC_VER
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != NO_ERROR) {
+		return false;
+	}
+#endif
+
+	this->listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+#ifdef _MSC_VER
+	if (this->listenSocket == INVALID_SOCKET) {
+		WSACleanup();
+		return false;
+	}
+#else
+	if (this->listenSocket < 0) {
+		return false;
+	}
+#endif
+
+	int reuse = 1;
+	setsockopt(this->listenSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+	struct sockaddr_in localAddress;
+	memset(&localAddress, 0, sizeof(localAddress));
+	localAddress.sin_family = AF_INET;
+	localAddress.sin_port = htons(this->port);
+	inet_pton(AF_INET, this->address.c_str(), &localAddress.sin_addr);
+	if (bind(this->listenSocket, (struct sockaddr*)&localAddress, sizeof(localAddress)) != 0 ||
+		listen(this->listenSocket, METRICS_SERVER_MAX_CONNECTIONS) != 0 ||
+		!SetNonBlocking(this->listenSocket)) {
+		CloseSocket(this->listenSocket);
+#ifdef _MSC_VER
+		WSACleanup();
+#endif
+		return false;
+	}
+
+	this->running = true;
+	return true;
+}
+
+void ExampleMetricsServer::Stop() {
+	if (!this->running) {
+		return;
+	}
+	for (size_t offset = 0; offset < this->connections.size(); offset++) {
+		CloseSocket(this->connections[offset].socket);
+	}
+	this->connections.clear();
+	CloseSocket(this->listenSocket);
+#ifdef _MSC_VER
+	WSACleanup();
+#endif
+	this->running = false;
+}
+
+void ExampleMetricsServer::Loop(RenderFunction render) {
+	if (!this->running) {
+		return;
+	}
+
+	// Accept new connections
+	while (this->connections.size() < METRICS_SERVER_MAX_CONNECTIONS) {
+		Socket client = accept(this->listenSocket, NULL, NULL);
+#ifdef _MSC_VER
+		if (client == INVALID_SOCKET) {
+			break;
+		}
+#else
+		if (client < 0) {
+			break;
+		}
+#endif
+		if (!SetNonBlocking(client)) {
+			CloseSocket(client);
+			continue;
+		}
+#if defined(SO_NOSIGPIPE)
+		int noSignal = 1;
+		setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &noSignal, sizeof(noSignal));
+#endif
+		Connection connection;
+		connection.socket = client;
+		connection.sent = 0;
+		connection.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(METRICS_SERVER_TIMEOUT_SECONDS);
+		this->connections.push_back(connection);
+	}
+
+	// Service the open connections, closing the ones that are done
+	for (size_t offset = 0; offset < this->connections.size();) {
+		if (this->Service(this->connections[offset], render)) {
+			offset++;
+			continue;
+		}
+		CloseSocket(this->connections[offset].socket);
+		this->connections.erase(this->connections.begin() + offset);
+	}
+}
+
+bool ExampleMetricsServer::Service(Connection & connection, RenderFunction render) {
+	if (std::chrono::steady_clock::now() > connection.deadline) {
+		return false;
+	}
+
+	if (connection.response.empty()) {
+		// Read until the end of the request headers
+		char buffer[1024];
+		int received = recv(connection.socket, buffer, sizeof(buffer), 0);
+		if (received == 0) {
+			return false; // Closed by the client
+		}
+		if (received < 0) {
+#ifdef _MSC_VER
+			return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+		}
+		connection.request.append(buffer, received);
+		if (connection.request.find("\r\n\r\n") == std::string::npos) {
+			return connection.request.size() < METRICS_SERVER_MAX_REQUEST_LENGTH;
+		}
+
+		std::string body;
+		const char* status = "200 OK";
+		if (connection.request.compare(0, 13, "GET /metrics ") == 0 || connection.request.compare(0, 13, "GET /metrics?") == 0) {
+			render(body);
+			this->requestsServed++;
+		}
+		else {
+			status = "404 Not Found";
+			body = "Not found, the metrics are at /metrics\n";
+		}
+
+		char header[256];
+		snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %u\r\nConnection: close\r\n\r\n", status, (unsigned int)body.size());
+		connection.response = header;
+		connection.response += body;
+		connection.sent = 0;
+	}
+
+	// Write as much of the response as the socket takes
+	while (connection.sent < connection.response.size()) {
+		int sent = send(connection.socket, connection.response.data() + connection.sent, (int)(connection.response.size() - connection.sent), METRICS_SERVER_SEND_FLAGS);
+		if (sent < 0) {
+#ifdef _MSC_VER
+			return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+			if (errno == EPIPE || errno == ECONNRESET) {
+				return false; // The client went away, close this connection
+			}
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+		}
+		connection.sent += sent;
+	}
+	return false; // Done
+}
+
+void ExampleMetricsServer::CloseSocket(Socket socket) {
+#ifdef _MSC_VER
+	closesocket(socket);
+#else
+	close(socket);
+#endif
+}
+
+bool ExampleMetricsServer::SetNonBlocking(Socket socket) {
+#ifdef _MSC_VER
+	u_long enabled = 1;
+	return ioctlsocket(socket, FIONBIO, &enabled) == 0;
+#else
+	int flags = fcntl(socket, F_GETFL, 0);
+	return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
@@ -0,0 +1,82 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * CASBACnetStackExampleMetricsServer.h
+ *
+ * Minimal HTTP server for a Prometheus scraper. Serves GET /metrics on a
+ * local TCP port. The sockets are non-blocking and serviced from the main
+ * loop, so the metrics are rendered on the BACnet thread and can read any
+ * of the example's state without locking.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#ifndef __CASBACnetStackExampleMetricsServer_h__
+#define __CASBACnetStackExampleMetricsServer_h__
+
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib,"Ws2_32.lib")
+#endif // _MSC_VER
+
+#define METRICS_SERVER_ADDRESS			"127.0.0.1"
+#define METRICS_SERVER_MAX_CONNECTIONS	16
+
+class ExampleMetricsServer
+{
+public:
+	// Renders the metrics in the Prometheus text format. Provided by the application.
+	typedef void (*RenderFunction)(std::string & output);
+
+	// Options
+	uint16_t port; // 0 turns the server off
+	std::string address;
+
+	// Counters
+	uint64_t requestsServed;
+
+	ExampleMetricsServer();
+	~ExampleMetricsServer();
+
+	// Sets one option by name, eg. "metrics-port". Returns false if the option is
+	// unknown or the value is invalid.
+	bool SetOption(const std::string & name, const std::string & value);
+
+	bool Start();
+	void Stop();
+	bool IsRunning() const { return this->running; }
+
+	// Accepts connections, reads requests and writes responses without blocking
+	void Loop(RenderFunction render);
+
+private:
+#ifdef _MSC_VER
+	typedef SOCKET Socket;
+#else
+	typedef int Socket;
+#endif
+
+	struct Connection {
+		Socket socket;
+		std::string request;
+		std::string response;
+		size_t sent;
+		std::chrono::steady_clock::time_point deadline;
+	};
+
+	static void CloseSocket(Socket socket);
+	static bool SetNonBlocking(Socket socket);
+	bool Service(Connection & connection, RenderFunction render);
+
+	bool running;
+	Socket listenSocket;
+	std::vector<Connection> connections;
+};
+
+#endif // __CASBACnetStackExampleMetricsServer_h__
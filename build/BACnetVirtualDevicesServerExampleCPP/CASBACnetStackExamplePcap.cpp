@@ -0,0 +1,264 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * CASBACnetStackExamplePcap.cpp
+ *
+ * pcap capture file writer and reader.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#include "CASBACnetStackExamplePcap.h"
+
+#include <string.h>
+
+static const uint8_t IPV4_HEADER_LENGTH = 20;
+static const uint8_t UDP_HEADER_LENGTH = 8;
+static const uint8_t IP_PROTOCOL_UDP = 17;
+static const uint32_t PCAP_MAGIC_MICROSECONDS = 0xA1B2C3D4;
+static const uint32_t PCAP_MAGIC_NANOSECONDS = 0xA1B23C4D;
+static const uint32_t PCAP_MAX_RECORD_LENGTH = 262144;
+
+static uint32_t SwapUInt32(const uint32_t value)
+{
+	return ((value & 0xFF) << 24) | ((value & 0xFF00) << 8) | ((value >> 8) & 0xFF00) | (value >> 24);
+}
+
+// pcap files are written in host byte order, the magic number tells the reader which one
+static void WriteUInt32(FILE* file, const uint32_t value)
+{
+	fwrite(&value, sizeof(value), 1, file);
+}
+
+static void WriteUInt16(FILE* file, const uint16_t value)
+{
+	fwrite(&value, sizeof(value), 1, file);
+}
+
+ExamplePcapFile::ExamplePcapFile() {
+	this->file = NULL;
+}
+
+ExamplePcapFile::~ExamplePcapFile() {
+	this->Close();
+}
+
+bool ExamplePcapFile::Open(const std::string & path) {
+	this->Close();
+	this->file = fopen(path.c_str(), "wb");
+	if (this->file == NULL) {
+		return false;
+	}
+
+	// Global header
+	WriteUInt32(this->file, PCAP_MAGIC_MICROSECONDS); // Magic number, microsecond timestamps
+	WriteUInt16(this->file, 2); // Version 2.4
+	WriteUInt16(this->file, 4);
+	WriteUInt32(this->file, 0); // GMT offset
+	WriteUInt32(this->file, 0); // Timestamp accuracy
+	WriteUInt32(this->file, MAX_PACKET_LENGTH); // Snap length
+	WriteUInt32(this->file, LINK_TYPE_RAW_IP);
+	return true;
+}
+
+void ExamplePcapFile::Close() {
+	if (this->file != NULL) {
+		fclose(this->file);
+		this->file = NULL;
+	}
+}
+
+void ExamplePcapFile::Flush() {
+	if (this->file != NULL) {
+		fflush(this->file);
+	}
+}
+
+bool ExamplePcapFile::Write(const uint64_t timestampUs, const uint8_t* sourceAddress, const uint16_t sourcePort, const uint8_t* destinationAddress, const uint16_t destinationPort, const uint8_t* data, const uint16_t length) {
+	if (this->file == NULL || data == NULL || length > MAX_PACKET_LENGTH - IPV4_HEADER_LENGTH - UDP_HEADER_LENGTH) {
+		return false;
+	}
+	uint16_t totalLength = IPV4_HEADER_LENGTH + UDP_HEADER_LENGTH + length;
+
+	// IPv4 header
+	uint8_t header[IPV4_HEADER_LENGTH + UDP_HEADER_LENGTH];
+	memset(header, 0, sizeof(header));
+	header[0] = 0x45; // Version 4, 5 words
+	header[2] = (uint8_t)(totalLength >> 8);
+	header[3] = (uint8_t)(totalLength & 0xFF);
+	header[8] = 64; // TTL
+	header[9] = IP_PROTOCOL_UDP;
+	memcpy(header + 12, sourceAddress, 4);
+	memcpy(header + 16, destinationAddress, 4);
+	uint32_t checksum = 0;
+	for (uint8_t offset = 0; offset < IPV4_HEADER_LENGTH; offset += 2) {
+		checksum += (header[offset] << 8) | header[offset + 1];
+	}
+	while (checksum >> 16) {
+		checksum = (checksum & 0xFFFF) + (checksum >> 16);
+	}
+	checksum = ~checksum & 0xFFFF;
+	header[10] = (uint8_t)(checksum >> 8);
+	header[11] = (uint8_t)(checksum & 0xFF);
+
+	// UDP header, a checksum of zero means none
+	uint16_t udpLength = UDP_HEADER_LENGTH + length;
+	header[20] = (uint8_t)(sourcePort >> 8);
+	header[21] = (uint8_t)(sourcePort & 0xFF);
+	header[22] = (uint8_t)(destinationPort >> 8);
+	header[23] = (uint8_t)(destinationPort & 0xFF);
+	header[24] = (uint8_t)(udpLength >> 8);
+	header[25] = (uint8_t)(udpLength & 0xFF);
+
+	// Record header
+	WriteUInt32(this->file, (uint32_t)(timestampUs / 1000000));
+	WriteUInt32(this->file, (uint32_t)(timestampUs % 1000000));
+	WriteUInt32(this->file, totalLength);
+	WriteUInt32(this->file, totalLength);
+
+	fwrite(header, 1, sizeof(header), this->file);
+	return fwrite(data, 1, length, this->file) == length;
+}
+
+ExamplePcapReader::ExamplePcapReader() {
+	this->file = NULL;
+	this->swapped = false;
+	this->nanoseconds = false;
+	this->linkType = 0;
+}
+
+ExamplePcapReader::~ExamplePcapReader() {
+	this->Close();
+}
+
+bool ExamplePcapReader::Open(const std::string & path) {
+	this->Close();
+	this->file = fopen(path.c_str(), "rb");
+	if (this->file == NULL) {
+		return false;
+	}
+
+	// Global header. The magic number gives the byte order and the timestamp resolution.
+	uint32_t magic = 0;
+	if (fread(&magic, sizeof(magic), 1, this->file) != 1) {
+		this->Close();
+		return false;
+	}
+	this->swapped = magic == SwapUInt32(PCAP_MAGIC_MICROSECONDS) || magic == SwapUInt32(PCAP_MAGIC_NANOSECONDS);
+	if (this->swapped) {
+		magic = SwapUInt32(magic);
+	}
+	if (magic != PCAP_MAGIC_MICROSECONDS && magic != PCAP_MAGIC_NANOSECONDS) {
+		this->Close();
+		return false;
+	}
+	this->nanoseconds = magic == PCAP_MAGIC_NANOSECONDS;
+
+	uint32_t ignored;
+	if (!this->ReadUInt32(&ignored) || // Version
+		!this->ReadUInt32(&ignored) || // GMT offset
+		!this->ReadUInt32(&ignored) || // Timestamp accuracy
+		!this->ReadUInt32(&ignored) || // Snap length
+		!this->ReadUInt32(&this->linkType)) {
+		this->Close();
+		return false;
+	}
+	if (this->linkType != ExamplePcapFile::LINK_TYPE_RAW_IP && this->linkType != LINK_TYPE_ETHERNET && this->linkType != LINK_TYPE_LINUX_COOKED && this->linkType != LINK_TYPE_IPV4) {
+		this->Close();
+		return false;
+	}
+	return true;
+}
+
+void ExamplePcapReader::Close() {
+	if (this->file != NULL) {
+		fclose(this->file);
+		this->file = NULL;
+	}
+}
+
+bool ExamplePcapReader::ReadUInt32(uint32_t* value) {
+	if (fread(value, sizeof(*value), 1, this->file) != 1) {
+		return false;
+	}
+	if (this->swapped) {
+		*value = SwapUInt32(*value);
+	}
+	return true;
+}
+
+bool ExamplePcapReader::Read(uint64_t* timestampUs, uint8_t* sourceAddress, uint16_t* sourcePort, uint8_t* destinationAddress, uint16_t* destinationPort, uint8_t* data, const uint16_t maxLength, uint16_t* length) {
+	if (this->file == NULL) {
+		return false;
+	}
+
+	for (;;) {
+		// Record header
+		uint32_t seconds, fraction, capturedLength, originalLength;
+		if (!this->ReadUInt32(&seconds) || !this->ReadUInt32(&fraction) || !this->ReadUInt32(&capturedLength) || !this->ReadUInt32(&originalLength)) {
+			return false;
+		}
+		if (capturedLength > PCAP_MAX_RECORD_LENGTH) {
+			return false; // Corrupt file
+		}
+		this->record.resize(capturedLength);
+		if (capturedLength > 0 && fread(&this->record[0], 1, capturedLength, this->file) != capturedLength) {
+			return false;
+		}
+
+		// Link layer
+		size_t offset = 0;
+		if (this->linkType == LINK_TYPE_ETHERNET) {
+			if (capturedLength < 14) {
+				continue;
+			}
+			uint16_t etherType = (uint16_t)((this->record[12] << 8) | this->record[13]);
+			offset = 14;
+			if (etherType == 0x8100 && capturedLength >= 18) {
+				// VLAN tag
+				etherType = (uint16_t)((this->record[16] << 8) | this->record[17]);
+				offset = 18;
+			}
+			if (etherType != 0x0800) {
+				continue;
+			}
+		}
+		else if (this->linkType == LINK_TYPE_LINUX_COOKED) {
+			if (capturedLength < 16 || this->record[14] != 0x08 || this->record[15] != 0x00) {
+				continue;
+			}
+			offset = 16;
+		}
+
+		// IPv4 and UDP headers
+		if (capturedLength < offset + IPV4_HEADER_LENGTH || (this->record[offset] >> 4) != 4) {
+			continue;
+		}
+		size_t ipHeaderLength = (this->record[offset] & 0x0F) * 4;
+		if (this->record[offset + 9] != IP_PROTOCOL_UDP || ipHeaderLength < IPV4_HEADER_LENGTH || capturedLength < offset + ipHeaderLength + UDP_HEADER_LENGTH) {
+			continue;
+		}
+		if (((this->record[offset + 6] & 0x1F) | this->record[offset + 7]) != 0 || (this->record[offset + 6] & 0x20) != 0) {
+			continue; // IP fragment
+		}
+		const uint8_t* ipHeader = &this->record[offset];
+		const uint8_t* udpHeader = ipHeader + ipHeaderLength;
+		uint16_t udpLength = (uint16_t)((udpHeader[4] << 8) | udpHeader[5]);
+		if (udpLength < UDP_HEADER_LENGTH || offset + ipHeaderLength + udpLength > capturedLength) {
+			continue; // Truncated by the snap length
+		}
+		uint16_t payloadLength = udpLength - UDP_HEADER_LENGTH;
+		if (payloadLength > maxLength) {
+			continue;
+		}
+
+		*timestampUs = (uint64_t)seconds * 1000000 + (this->nanoseconds ? fraction / 1000 : fraction);
+		memcpy(sourceAddress, ipHeader + 12, 4);
+		memcpy(destinationAddress, ipHeader + 16, 4);
+		*sourcePort = (uint16_t)((udpHeader[0] << 8) | udpHeader[1]);
+		*destinationPort = (uint16_t)((udpHeader[2] << 8) | udpHeader[3]);
+		memcpy(data, udpHeader + UDP_HEADER_LENGTH, payloadLength);
+		*length = payloadLength;
+		return true;
+	}
+}
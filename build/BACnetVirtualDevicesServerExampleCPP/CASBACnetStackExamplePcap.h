@@ -0,0 +1,74 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * CASBACnetStackExamplePcap.h
+ *
+ * Writes BACnet/IP datagrams to a pcap capture file so that traffic can be
+ * inspected offline with Wireshark. Each datagram is wrapped in an IPv4 and
+ * UDP header (raw IP link type). The reader takes the UDP datagrams back out
+ * of a capture, it is used by the load generator to replay traffic.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#ifndef __CASBACnetStackExamplePcap_h__
+#define __CASBACnetStackExamplePcap_h__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+class ExamplePcapFile
+{
+public:
+	static const uint32_t LINK_TYPE_RAW_IP = 101;
+	static const uint32_t MAX_PACKET_LENGTH = 65535;
+
+	ExamplePcapFile();
+	~ExamplePcapFile();
+
+	bool Open(const std::string & path);
+	void Close();
+	bool IsOpen() const { return this->file != NULL; }
+	void Flush();
+
+	// Writes one UDP datagram. Addresses are 4 byte IPv4 addresses in network order,
+	// timestampUs is microseconds since the epoch.
+	bool Write(const uint64_t timestampUs, const uint8_t* sourceAddress, const uint16_t sourcePort, const uint8_t* destinationAddress, const uint16_t destinationPort, const uint8_t* data, const uint16_t length);
+
+private:
+	FILE* file;
+};
+
+class ExamplePcapReader
+{
+public:
+	static const uint32_t LINK_TYPE_ETHERNET = 1;
+	static const uint32_t LINK_TYPE_LINUX_COOKED = 113;
+	static const uint32_t LINK_TYPE_IPV4 = 228;
+
+	ExamplePcapReader();
+	~ExamplePcapReader();
+
+	// Opens a capture written by ExamplePcapFile, Wireshark or tcpdump. Returns false
+	// if the file can not be read or the link type is not supported.
+	bool Open(const std::string & path);
+	void Close();
+	bool IsOpen() const { return this->file != NULL; }
+
+	// Reads the next IPv4 UDP datagram, anything else in the capture is skipped.
+	// Returns false at the end of the file. Datagrams longer than maxLength are skipped.
+	bool Read(uint64_t* timestampUs, uint8_t* sourceAddress, uint16_t* sourcePort, uint8_t* destinationAddress, uint16_t* destinationPort, uint8_t* data, const uint16_t maxLength, uint16_t* length);
+
+private:
+	bool ReadUInt32(uint32_t* value);
+
+	FILE* file;
+	bool swapped;		// Written on a host with the other byte order
+	bool nanoseconds;	// Timestamps are in nanoseconds instead of microseconds
+	uint32_t linkType;
+	std::vector<uint8_t> record;
+};
+
+#endif // __CASBACnetStackExamplePcap_h__
@@ -0,0 +1,123 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * CASBACnetStackExampleSimulator.cpp
+ *
+ * Simulated field drivers for the Analog Input present values.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#include "CASBACnetStackExampleSimulator.h"
+
+#include <algorithm> // std::min
+#include <chrono>
+#include <random>
+#include <stdlib.h> // strtoul()
+
+static const uint32_t RELIABILITY_NO_FAULT_DETECTED = 0;
+static const uint32_t RELIABILITY_UNRELIABLE_OTHER = 7;
+static const uint32_t UNRELIABLE_ONE_IN = 1000; // Chance of a value being reported as unreliable
+static const int SIMULATOR_STOP_CHECK_MS = 100;
+
+ExampleSimulator::ExampleSimulator() : running(false) {
+	this->updatesPerSecond = 0;
+	this->threadCount = 1;
+	this->database = NULL;
+}
+
+ExampleSimulator::~ExampleSimulator() {
+	this->Stop();
+}
+
+bool ExampleSimulator::SetOption(const std::string & name, const std::string & value) {
+	uint32_t* option = NULL;
+	uint32_t minimum = 0;
+	uint32_t maximum = 0xFFFFFFFF;
+	if (name == "simulate-rate") {
+		option = &this->updatesPerSecond;
+	}
+	else if (name == "simulate-threads") {
+		option = &this->threadCount;
+		minimum = 1;
+		maximum = SIMULATOR_MAX_THREADS;
+	}
+	if (option == NULL || value.empty()) {
+		return false;
+	}
+
+	char* end = NULL;
+	unsigned long number = strtoul(value.c_str(), &end, 10);
+	if (end == NULL || *end != '\0' || number < minimum || number > maximum) {
+		return false;
+	}
+	*option = (uint32_t)number;
+	return true;
+}
+
+void ExampleSimulator::Start(ExampleDatabase* database) {
+	if (this->IsRunning() || this->updatesPerSecond == 0 || database->analogInputs.empty()) {
+		return;
+	}
+	this->database = database;
+	this->running.store(true);
+	for (uint32_t threadIndex = 0; threadIndex < this->threadCount; threadIndex++) {
+		this->threads.push_back(std::thread(&ExampleSimulator::ThreadLoop, this, threadIndex));
+	}
+}
+
+void ExampleSimulator::Stop() {
+	this->running.store(false);
+	for (size_t offset = 0; offset < this->threads.size(); offset++) {
+		this->threads[offset].join();
+	}
+	this->threads.clear();
+}
+
+void ExampleSimulator::ThreadLoop(const uint32_t threadIndex) {
+	// Each thread owns every threadCount'th Analog Input, starting at threadIndex
+	const size_t count = this->database->analogInputs.size();
+	if (threadIndex >= count) {
+		return;
+	}
+	double rate = (double)this->updatesPerSecond / this->threadCount;
+	std::chrono::steady_clock::duration batchInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(SIMULATOR_BATCH_SIZE / rate));
+
+	std::minstd_rand random(threadIndex + 1);
+	std::uniform_real_distribution<float> step(-1.0f, 1.0f);
+	ExampleDatabaseValueUpdate batch[SIMULATOR_BATCH_SIZE];
+	size_t slot = threadIndex;
+	std::chrono::steady_clock::time_point nextBatchTime = std::chrono::steady_clock::now();
+
+	while (this->running.load(std::memory_order_relaxed)) {
+		uint64_t timestamp = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		for (size_t offset = 0; offset < SIMULATOR_BATCH_SIZE; offset++) {
+			const ExampleDatabaseAnalogInput & analogInput = this->database->analogInputs[slot];
+			float presentValue = 0.0f;
+			this->database->analogInputValues.Read(slot, &presentValue, NULL);
+
+			batch[offset].deviceInstance = analogInput.deviceInstance;
+			batch[offset].objectInstance = analogInput.instance;
+			batch[offset].presentValue = presentValue + step(random);
+			batch[offset].reliability = random() % UNRELIABLE_ONE_IN == 0 ? RELIABILITY_UNRELIABLE_OTHER : RELIABILITY_NO_FAULT_DETECTED;
+			batch[offset].timestamp = timestamp;
+
+			slot += this->threadCount;
+			if (slot >= count) {
+				slot = threadIndex;
+			}
+		}
+		this->database->UpdateAnalogInputs(batch, SIMULATOR_BATCH_SIZE);
+
+		// Do not try to catch up after a long stall
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		nextBatchTime += batchInterval;
+		if (nextBatchTime < now - std::chrono::seconds(1)) {
+			nextBatchTime = now;
+		}
+		// Sleep in short steps so that Stop() does not wait for a slow rate
+		while (this->running.load(std::memory_order_relaxed) && std::chrono::steady_clock::now() < nextBatchTime) {
+			std::this_thread::sleep_until(std::min(nextBatchTime, std::chrono::steady_clock::now() + std::chrono::milliseconds(SIMULATOR_STOP_CHECK_MS)));
+		}
+	}
+}
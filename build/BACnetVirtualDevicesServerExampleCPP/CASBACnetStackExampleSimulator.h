@@ -0,0 +1,55 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * CASBACnetStackExampleSimulator.h
+ *
+ * Simulated field drivers. Each driver thread walks its share of the Analog
+ * Inputs and pushes batches of timestamped values into the database with
+ * ExampleDatabase::UpdateAnalogInputs(), the same way a real field driver
+ * would. Off by default.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#ifndef __CASBACnetStackExampleSimulator_h__
+#define __CASBACnetStackExampleSimulator_h__
+
+#include "CASBACnetStackExampleDatabase.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define SIMULATOR_BATCH_SIZE	64	// Updates pushed to the database in one call
+#define SIMULATOR_MAX_THREADS	64
+
+class ExampleSimulator
+{
+public:
+	// Options
+	uint32_t updatesPerSecond;	// Across all threads, 0 turns the simulator off
+	uint32_t threadCount;
+
+	ExampleSimulator();
+	~ExampleSimulator();
+
+	// Sets one option by name, eg. "simulate-rate". Returns false if the option is
+	// unknown or the value is invalid.
+	bool SetOption(const std::string & name, const std::string & value);
+
+	// Starts the driver threads if the simulator is turned on
+	void Start(ExampleDatabase* database);
+	void Stop();
+	bool IsRunning() const { return !this->threads.empty(); }
+
+private:
+	void ThreadLoop(const uint32_t threadIndex);
+
+	ExampleDatabase* database;
+	std::atomic<bool> running;
+	std::vector<std::thread> threads;
+};
+
+#endif // __CASBACnetStackExampleSimulator_h__
@@ -0,0 +1,132 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * CASBACnetStackExampleTopology.cpp
+ *
+ * Topology options and their validation.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#include "CASBACnetStackExampleTopology.h"
+
+#include <stdlib.h> // strtoul(), strtod()
+
+ExampleDatabaseTopology::ExampleDatabaseTopology() {
+	this->numberOfNetworks = NUMBER_OF_VIRTUAL_NETWORKS;
+	this->startingNetwork = STARTING_VIRTUAL_NETWORK;
+	this->networkOffset = VIRTUAL_NETWORK_OFFSET;
+	this->devicesPerNetwork = NUMBER_OF_DEVICES_PER_NETWORK;
+	this->startingDeviceInstance = STARTING_DEVICE_INSTANCE;
+	this->deviceInstanceOffset = DEVICE_INSTANCE_OFFSET;
+	this->analogInputsPerDevice = NUMBER_OF_ANALOG_INPUTS_PER_DEVICE;
+	this->analogValuesPerDevice = NUMBER_OF_ANALOG_VALUES_PER_DEVICE;
+	this->analogInputCOVIncrement = ANALOG_INPUT_COV_INCREMENT;
+	this->deviceNameTemplate = "Virtual Device {device}";
+	this->analogInputNameTemplate = "Analog Input {instance} of {device}";
+	this->analogValueNameTemplate = "Analog Value {instance} of {device}";
+}
+
+bool ExampleDatabaseTopology::SetOption(const std::string & name, const std::string & value) {
+	// Name templates
+	if (name == "device-name") {
+		this->deviceNameTemplate = value;
+		return true;
+	}
+	else if (name == "analog-input-name") {
+		this->analogInputNameTemplate = value;
+		return true;
+	}
+	else if (name == "analog-value-name") {
+		this->analogValueNameTemplate = value;
+		return true;
+	}
+	else if (name == "cov-increment") {
+		char* end = NULL;
+		double number = strtod(value.c_str(), &end);
+		if (value.empty() || end == NULL || *end != '\0' || !(number >= 0.0)) {
+			return false;
+		}
+		this->analogInputCOVIncrement = (float)number;
+		return true;
+	}
+
+	// Everything else is a number
+	uint32_t* option = NULL;
+	if (name == "networks") {
+		option = &this->numberOfNetworks;
+	}
+	else if (name == "first-network") {
+		option = &this->startingNetwork;
+	}
+	else if (name == "network-offset") {
+		option = &this->networkOffset;
+	}
+	else if (name == "devices-per-network") {
+		option = &this->devicesPerNetwork;
+	}
+	else if (name == "first-device-instance") {
+		option = &this->startingDeviceInstance;
+	}
+	else if (name == "device-instance-offset") {
+		option = &this->deviceInstanceOffset;
+	}
+	else if (name == "analog-inputs-per-device") {
+		option = &this->analogInputsPerDevice;
+	}
+	else if (name == "analog-values-per-device") {
+		option = &this->analogValuesPerDevice;
+	}
+	if (option == NULL || value.empty()) {
+		return false;
+	}
+
+	char* end = NULL;
+	unsigned long number = strtoul(value.c_str(), &end, 10);
+	if (end == NULL || *end != '\0' || number > MAX_INSTANCE) {
+		return false;
+	}
+	*option = (uint32_t)number;
+	return true;
+}
+
+bool ExampleDatabaseTopology::Validate(std::string & error) const {
+	if (this->numberOfNetworks == 0 || this->devicesPerNetwork == 0) {
+		error = "At least one network and one device per network is required";
+		return false;
+	}
+	if (this->numberOfNetworks > 1 && this->networkOffset == 0) {
+		error = "network-offset must be greater than zero";
+		return false;
+	}
+	if (this->startingNetwork == 0 || (uint64_t)this->startingNetwork + (uint64_t)(this->numberOfNetworks - 1) * this->networkOffset > MAX_NETWORK_NUMBER) {
+		error = "Virtual network numbers must be between 1 and 65534";
+		return false;
+	}
+	if (this->numberOfNetworks > 1 && this->devicesPerNetwork > this->deviceInstanceOffset) {
+		error = "devices-per-network must not be larger than device-instance-offset, device instances would overlap";
+		return false;
+	}
+	uint64_t lastDeviceInstance = (uint64_t)this->startingDeviceInstance + (uint64_t)(this->numberOfNetworks - 1) * this->deviceInstanceOffset + (this->devicesPerNetwork - 1);
+	if (lastDeviceInstance > MAX_INSTANCE) {
+		error = "Device instances must not be larger than 4194302";
+		return false;
+	}
+	for (uint32_t networkIndex = 0; networkIndex < this->numberOfNetworks; networkIndex++) {
+		uint32_t firstDeviceInstance = this->GetDeviceInstance(networkIndex, 0);
+		if (MAIN_DEVICE_INSTANCE >= firstDeviceInstance && MAIN_DEVICE_INSTANCE < firstDeviceInstance + this->devicesPerNetwork) {
+			error = "Virtual device instances overlap the main device instance";
+			return false;
+		}
+	}
+	uint64_t numberOfDevices = (uint64_t)this->numberOfNetworks * this->devicesPerNetwork;
+	if (numberOfDevices * (1 + (uint64_t)this->analogInputsPerDevice + this->analogValuesPerDevice) >= MAX_OBJECTS) {
+		error = "Too many objects";
+		return false;
+	}
+	if (this->deviceNameTemplate.find("{device}") == std::string::npos) {
+		error = "device-name must contain {device} so that every virtual device name is unique";
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,73 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * CASBACnetStackExampleTopology.h
+ *
+ * Shape of the virtual device tree: the virtual networks, the devices on each
+ * network and the objects in each device. Does not use the CAS BACnet Stack,
+ * so the load generator and the benchmarks can share it with the server.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#ifndef __CASBACnetStackExampleTopology_h__
+#define __CASBACnetStackExampleTopology_h__
+
+#include <stdint.h>
+#include <string>
+
+// Default topology. Can be changed at runtime, see ExampleDatabaseTopology
+#define NUMBER_OF_VIRTUAL_NETWORKS		3
+#define STARTING_VIRTUAL_NETWORK		1000
+#define VIRTUAL_NETWORK_OFFSET			1000
+#define NUMBER_OF_DEVICES_PER_NETWORK	10
+#define STARTING_DEVICE_INSTANCE		100000
+#define DEVICE_INSTANCE_OFFSET			100000
+#define NUMBER_OF_ANALOG_INPUTS_PER_DEVICE	1
+#define NUMBER_OF_ANALOG_VALUES_PER_DEVICE	0
+#define ANALOG_INPUT_COV_INCREMENT		1.0f
+
+#define MAIN_DEVICE_INSTANCE			389999
+
+// Largest valid BACnet instance number. 4194303 is reserved for wildcards.
+#define MAX_INSTANCE					4194302
+#define MAX_NETWORK_NUMBER				65534
+
+// Objects are stored in slots with a 32 bit index, 0xFFFFFFFF means not found
+#define MAX_OBJECTS						0xFFFFFFFFULL
+
+// Set from the command line or a config file before ExampleDatabase::Setup() is called.
+class ExampleDatabaseTopology
+{
+public:
+	uint32_t numberOfNetworks;
+	uint32_t startingNetwork;
+	uint32_t networkOffset;
+	uint32_t devicesPerNetwork;
+	uint32_t startingDeviceInstance;
+	uint32_t deviceInstanceOffset;		// Gap between the first device of each network
+	uint32_t analogInputsPerDevice;
+	uint32_t analogValuesPerDevice;
+	float analogInputCOVIncrement;
+
+	// Name templates. {network}, {device} and {instance} are replaced with the
+	// network number, device instance and object instance.
+	std::string deviceNameTemplate;
+	std::string analogInputNameTemplate;
+	std::string analogValueNameTemplate;
+
+	ExampleDatabaseTopology();
+
+	// Sets one option by name, eg. "devices-per-network". Returns false if the
+	// option is unknown or the value is invalid.
+	bool SetOption(const std::string & name, const std::string & value);
+
+	// Checks that every device and network number is in range and unique
+	bool Validate(std::string & error) const;
+
+	uint32_t GetNumberOfDevices() const { return this->numberOfNetworks * this->devicesPerNetwork; }
+	uint32_t GetNetwork(const uint32_t networkIndex) const { return this->startingNetwork + networkIndex * this->networkOffset; }
+	uint32_t GetDeviceInstance(const uint32_t networkIndex, const uint32_t deviceIndex) const { return this->startingDeviceInstance + networkIndex * this->deviceInstanceOffset + deviceIndex; }
+};
+
+#endif // __CASBACnetStackExampleTopology_h__
@@ -0,0 +1,253 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * CASBACnetStackExampleTrace.cpp
+ *
+ * Background packet tracing and capture.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#include "CASBACnetStackExampleTrace.h"
+
+#include <chrono>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+
+static const uint32_t MAX_XML_RENDER_BUFFER_LENGTH = 1024 * 20;
+static const int TRACE_IDLE_WAIT_MS = 5;
+static const size_t TRACE_OUTPUT_FLUSH_LENGTH = 64 * 1024; // Rendered text is written out before it grows past this
+
+ExampleTrace::ExampleTrace() : level(LEVEL_OFF), enabled(false), running(false), dropped(0), head(0), decoded(0), tail(0) {
+	this->decodeAsXML = NULL;
+	this->isSetup = false;
+	memset(this->localIPAddress, 0, sizeof(this->localIPAddress));
+	this->localPort = 0;
+}
+
+ExampleTrace::~ExampleTrace() {
+	this->Stop();
+}
+
+bool ExampleTrace::SetOption(const std::string & name, const std::string & value) {
+	if (name == "trace") {
+		if (value == "off") {
+			this->SetLevel(LEVEL_OFF);
+		}
+		else if (value == "summary") {
+			this->SetLevel(LEVEL_SUMMARY);
+		}
+		else if (value == "xml") {
+			this->SetLevel(LEVEL_XML);
+		}
+		else {
+			return false;
+		}
+		return true;
+	}
+	else if (name == "pcap") {
+		// Opened in Setup()
+		this->capturePath = value;
+		return !value.empty();
+	}
+	return false;
+}
+
+void ExampleTrace::Setup(DecodeAsXMLFunction decodeAsXML) {
+	this->decodeAsXML = decodeAsXML;
+	this->isSetup = true;
+	if (!this->capturePath.empty() && !this->OpenCapture(this->capturePath)) {
+		std::cerr << "Failed to open pcap capture file [" << this->capturePath << "]" << std::endl;
+	}
+	this->UpdateEnabled();
+}
+
+void ExampleTrace::Stop() {
+	this->enabled.store(false, std::memory_order_relaxed);
+	if (this->thread.joinable()) {
+		// Stop is called from the BACnet thread, decode whatever is left. The thread
+		// drains the ring before it exits.
+		this->Decode(this->ring.size());
+		this->running.store(false);
+		this->thread.join();
+	}
+	this->capture.Close();
+}
+
+void ExampleTrace::SetLevel(const Level level) {
+	this->level.store(level, std::memory_order_relaxed);
+	this->UpdateEnabled();
+}
+
+const char* ExampleTrace::GetLevelName(const Level level) {
+	switch (level) {
+	case LEVEL_OFF:
+		return "off";
+	case LEVEL_SUMMARY:
+		return "summary";
+	case LEVEL_XML:
+		return "xml";
+	}
+	return "unknown";
+}
+
+bool ExampleTrace::OpenCapture(const std::string & path) {
+	if (this->thread.joinable()) {
+		// The capture file belongs to the background thread once it is running
+		return false;
+	}
+	if (!this->capture.Open(path)) {
+		return false;
+	}
+	this->capturePath = path;
+	this->UpdateEnabled();
+	return true;
+}
+
+void ExampleTrace::SetLocalAddress(const uint8_t* ipAddress, const uint16_t port) {
+	memcpy(this->localIPAddress, ipAddress, 4);
+	this->localPort = port;
+}
+
+void ExampleTrace::Capture(const bool sent, const uint8_t* message, const uint16_t length, const uint8_t* ipAddress, const uint16_t port) {
+	size_t tail = this->tail.load(std::memory_order_relaxed);
+	if (tail - this->head.load(std::memory_order_acquire) >= this->ring.size()) {
+		// The background thread is behind, drop the packet rather than block the BACnet thread
+		this->dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	Packet & packet = this->ring[tail & (this->ring.size() - 1)];
+	packet.timestampUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	memcpy(packet.ipAddress, ipAddress, 4);
+	packet.port = port;
+	packet.sent = sent;
+	packet.level = (uint8_t)this->GetLevel();
+	packet.length = length < TRACE_MAX_PACKET_LENGTH ? length : TRACE_MAX_PACKET_LENGTH;
+	memcpy(packet.data, message, packet.length);
+
+	this->tail.store(tail + 1, std::memory_order_release);
+}
+
+void ExampleTrace::Loop() {
+	if (this->decoded.load(std::memory_order_relaxed) != this->tail.load(std::memory_order_relaxed)) {
+		this->Decode(TRACE_XML_DECODES_PER_LOOP);
+	}
+}
+
+void ExampleTrace::Decode(const size_t maxDecodes) {
+	// Both indexes are written by this thread
+	size_t decoded = this->decoded.load(std::memory_order_relaxed);
+	size_t tail = this->tail.load(std::memory_order_relaxed);
+	size_t decodes = 0;
+	for (; decoded != tail; decoded++) {
+		Packet & packet = this->ring[decoded & (this->ring.size() - 1)];
+		packet.xml.clear(); // Keeps the capacity of the previous use of the slot
+		if (packet.level != LEVEL_XML || this->decodeAsXML == NULL) {
+			continue;
+		}
+		if (decodes >= maxDecodes) {
+			break;
+		}
+		decodes++;
+
+		char* buffer = &this->xmlBuffer[0];
+		if (this->decodeAsXML(packet.data, packet.length, buffer, MAX_XML_RENDER_BUFFER_LENGTH - 1) > 0) {
+			// Only the used part of the buffer is cleared, the rest is still zero from last time
+			size_t xmlLength = strnlen(buffer, MAX_XML_RENDER_BUFFER_LENGTH - 1);
+			packet.xml.assign(buffer, xmlLength);
+			memset(buffer, 0, xmlLength);
+		}
+	}
+	this->decoded.store(decoded, std::memory_order_release);
+}
+
+void ExampleTrace::UpdateEnabled() {
+	// Options can be set before Setup(), the thread is not started until then
+	bool enable = this->isSetup && (this->GetLevel() != LEVEL_OFF || this->capture.IsOpen());
+	if (enable) {
+		this->StartThread();
+	}
+	this->enabled.store(enable && this->thread.joinable(), std::memory_order_relaxed);
+}
+
+void ExampleTrace::StartThread() {
+	if (this->thread.joinable()) {
+		return;
+	}
+	// The ring is only allocated the first time tracing is turned on
+	this->ring.resize(TRACE_RING_SIZE);
+	this->xmlBuffer.assign(MAX_XML_RENDER_BUFFER_LENGTH, 0);
+	this->running.store(true);
+	this->thread = std::thread(&ExampleTrace::ThreadLoop, this);
+}
+
+void ExampleTrace::ThreadLoop() {
+	std::string output;
+	for (;;) {
+		bool running = this->running.load();
+		size_t head = this->head.load(std::memory_order_relaxed);
+		size_t tail = this->decoded.load(std::memory_order_acquire);
+		if (head == tail) {
+			if (!running) {
+				break;
+			}
+			// Write out everything rendered so far in one go
+			if (!output.empty()) {
+				std::cout << output << std::flush;
+				output.clear();
+			}
+			this->capture.Flush();
+			std::this_thread::sleep_for(std::chrono::milliseconds(TRACE_IDLE_WAIT_MS));
+			continue;
+		}
+
+		for (; head != tail; head++) {
+			const Packet & packet = this->ring[head & (this->ring.size() - 1)];
+			if (packet.level != LEVEL_OFF) {
+				this->Render(packet, output);
+				if (output.size() >= TRACE_OUTPUT_FLUSH_LENGTH) {
+					std::cout << output;
+					output.clear();
+				}
+			}
+			if (this->capture.IsOpen()) {
+				if (packet.sent) {
+					this->capture.Write(packet.timestampUs, this->localIPAddress, this->localPort, packet.ipAddress, packet.port, packet.data, packet.length);
+				}
+				else {
+					this->capture.Write(packet.timestampUs, packet.ipAddress, packet.port, this->localIPAddress, this->localPort, packet.data, packet.length);
+				}
+			}
+		}
+		this->head.store(head, std::memory_order_release);
+
+		// Write out the batch, the ring may never be idle under sustained traffic
+		if (!output.empty()) {
+			std::cout << output << std::flush;
+			output.clear();
+		}
+	}
+
+	if (!output.empty()) {
+		std::cout << output << std::flush;
+	}
+	this->capture.Flush();
+}
+
+void ExampleTrace::Render(const Packet & packet, std::string & output) {
+	char line[128];
+	snprintf(line, sizeof(line), "\nFYI: %s message %s [%u.%u.%u.%u:%u], length [%u]\n",
+		packet.sent ? "Sending" : "Received",
+		packet.sent ? "to" : "from",
+		packet.ipAddress[0], packet.ipAddress[1], packet.ipAddress[2], packet.ipAddress[3],
+		packet.port, packet.length);
+	output += line;
+
+	// Decoded by the BACnet thread, see Loop()
+	if (!packet.xml.empty()) {
+		output += packet.xml;
+		output += '\n';
+	}
+}
@@ -0,0 +1,117 @@
+/*
+ * BACnet Virtual Devices Server Example C++
+ * ----------------------------------------------------------------------------
+ * CASBACnetStackExampleTrace.h
+ *
+ * Packet tracing. Sent and received datagrams are copied into a lock free
+ * single producer / single consumer ring by the BACnet thread, and rendered
+ * and written to the console and a pcap capture by a background thread.
+ * When tracing is off the message callbacks only test one flag.
+ *
+ * The XML is decoded by the CAS BACnet Stack, which is not thread safe. At the
+ * xml level the BACnet thread decodes a few of the queued packets each time
+ * through the main loop (Loop()), the background thread only writes them out.
+ *
+ * Created by: Steven Smethurst
+*/
+
+#ifndef __CASBACnetStackExampleTrace_h__
+#define __CASBACnetStackExampleTrace_h__
+
+#include "CASBACnetStackExamplePcap.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TRACE_RING_SIZE			1024	// Must be a power of two
+#define TRACE_MAX_PACKET_LENGTH	1536
+#define TRACE_XML_DECODES_PER_LOOP	16	// Packets decoded as XML by one call to Loop()
+
+class ExampleTrace
+{
+public:
+	enum Level {
+		LEVEL_OFF = 0,		// Nothing
+		LEVEL_SUMMARY = 1,	// One line per packet
+		LEVEL_XML = 2		// One line per packet followed by the decoded packet as XML
+	};
+
+	// Renders a packet as XML. Provided by the application, only called from the BACnet thread.
+	typedef uint32_t (*DecodeAsXMLFunction)(const uint8_t* message, const uint16_t messageLength, char* buffer, const uint32_t maxBufferLength);
+
+	ExampleTrace();
+	~ExampleTrace();
+
+	// Sets one option by name, eg. "trace". Returns false if the option is unknown
+	// or the value is invalid.
+	bool SetOption(const std::string & name, const std::string & value);
+
+	void Setup(DecodeAsXMLFunction decodeAsXML);
+	void Stop();
+
+	void SetLevel(const Level level);
+	Level GetLevel() const { return (Level)this->level.load(std::memory_order_relaxed); }
+	static const char* GetLevelName(const Level level);
+
+	// Capture to a pcap file. The local address is used as the source of sent packets
+	// and the destination of received packets.
+	bool OpenCapture(const std::string & path);
+	void SetLocalAddress(const uint8_t* ipAddress, const uint16_t port);
+
+	// Hot path check, call this before Capture()
+	bool IsEnabled() const { return this->enabled.load(std::memory_order_relaxed); }
+
+	// Copies a packet into the ring. Must only be called from the BACnet thread.
+	// ipAddress is the 4 byte IPv4 address of the other end in network order.
+	void Capture(const bool sent, const uint8_t* message, const uint16_t length, const uint8_t* ipAddress, const uint16_t port);
+
+	// Decodes the XML of up to TRACE_XML_DECODES_PER_LOOP captured packets and hands
+	// them to the background thread. Must only be called from the BACnet thread.
+	void Loop();
+
+	uint64_t GetDroppedCount() const { return this->dropped.load(std::memory_order_relaxed); }
+
+private:
+	struct Packet {
+		uint64_t timestampUs;
+		uint8_t ipAddress[4];
+		uint16_t port;
+		uint16_t length;
+		bool sent;
+		uint8_t level;		// Trace level when the packet was captured
+		uint8_t data[TRACE_MAX_PACKET_LENGTH];
+		std::string xml;	// Filled in by Loop() at the xml level
+	};
+
+	void UpdateEnabled();
+	void StartThread();
+	void ThreadLoop();
+	void Decode(const size_t maxDecodes);
+	void Render(const Packet & packet, std::string & output);
+
+	DecodeAsXMLFunction decodeAsXML;
+	bool isSetup;
+	std::atomic<int> level;
+	std::atomic<bool> enabled;
+	std::atomic<bool> running;
+	std::atomic<uint64_t> dropped;
+	std::thread thread;
+
+	// Ring. head is only written by the background thread, decoded and tail only by
+	// the BACnet thread. The background thread takes packets up to decoded.
+	std::vector<Packet> ring;
+	std::atomic<size_t> head;
+	std::atomic<size_t> decoded;
+	std::atomic<size_t> tail;
+	std::vector<char> xmlBuffer; // Only used by the BACnet thread
+
+	ExamplePcapFile capture;
+	std::string capturePath;
+	uint8_t localIPAddress[4];
+	uint16_t localPort;
+};
+
+#endif // __CASBACnetStackExampleTrace_h__
@@ -58,6 +58,19 @@ CSimpleUDP::CSimpleUDP() {
 	m_connected = false;
 	m_port = 0;
 	this->m_socket = 0;
+#if defined(__GNUC__)
+	this->m_eventMode = false;
+	this->m_epoll = -1;
+	this->m_ringHead = 0;
+	this->m_ringCount = 0;
+#endif
+	this->m_sendQueueCount = 0;
+	this->m_sendQueued = 0;
+	this->m_sendSent = 0;
+	this->m_sendDropped = 0;
+	this->m_sendDisconnects = 0;
+	this->m_sharedSocket = false;
+	this->m_reConnectNeeded = false;
 }
 
 bool CSimpleUDP::ReConnect() {
@@ -74,6 +87,13 @@ bool CSimpleUDP::ReConnect() {
 	return false;
 }
 
+bool CSimpleUDP::ReConnectShared() {
+	// Wait for any send in progress, the sending thread must not see the socket closed under it
+	std::lock_guard<std::mutex> lock(this->m_sendMutex);
+	this->m_reConnectNeeded = false;
+	return this->ReConnect();
+}
+
 void CSimpleUDP::Disconnect() {
 	// Check if the resource has already been disconnected
 	if (!this->IsConnected()) {
@@ -85,11 +105,27 @@ void CSimpleUDP::Disconnect() {
 	WSACleanup();
 	#elif defined (__GNUC__)
 	close(this->m_socket);
+	if (this->m_epoll >= 0) {
+		close(this->m_epoll);
+		this->m_epoll = -1;
+	}
+	// Anything still queued belongs to the old socket
+	this->m_ringHead = 0;
+	this->m_ringCount = 0;
 	#endif
 	
 	this->m_connected = false;
 }
 
+void CSimpleUDP::DisconnectAfterSendError() {
+	if (this->m_sharedSocket) {
+		// The receive thread may be using the socket, let it close and reopen it
+		this->m_reConnectNeeded = true;
+		return;
+	}
+	this->Disconnect();
+}
+
 bool CSimpleUDP::Connect(unsigned short port, bool bindport /* = true */, const char * ipAddress /* = NULL */) {
 
 	struct sockaddr_in addr;
@@ -131,12 +167,25 @@ bool CSimpleUDP::Connect(unsigned short port, bool bindport /* = true */, const
 		this->Disconnect();
 		return false;
 	}
-	// Set Timeout
-	tv.tv_sec = 1;
-	tv.tv_usec = 0;
-	if (setsockopt(this->m_socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(struct timeval)) == SOCKET_ERROR) {
-		this->Disconnect();
-		return false;
+#if defined(__GNUC__)
+	if (this->m_eventMode) {
+		// Event mode, the socket never blocks. Readiness is reported by epoll.
+		int flags = fcntl(this->m_socket, F_GETFL, 0);
+		if (flags < 0 || fcntl(this->m_socket, F_SETFL, flags | O_NONBLOCK) < 0) {
+			this->Disconnect();
+			return false;
+		}
+	}
+	else
+#endif
+	{
+		// Set Timeout
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		if (setsockopt(this->m_socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(struct timeval)) == SOCKET_ERROR) {
+			this->Disconnect();
+			return false;
+		}
 	}
 	// Set broadcast
 	if (setsockopt(this->m_socket, SOL_SOCKET, SO_BROADCAST, (char*)&bOptVal, bOptLen) == SOCKET_ERROR) {
@@ -172,7 +221,27 @@ bool CSimpleUDP::Connect(unsigned short port, bool bindport /* = true */, const
 		}
 	}
 
+	// Mark as connected before setting up epoll so that Disconnect() cleans up on failure
 	this->m_connected = true;
+
+#if defined(__GNUC__)
+	if (this->m_eventMode) {
+		this->m_epoll = epoll_create1(0);
+		if (this->m_epoll < 0) {
+			this->Disconnect();
+			return false;
+		}
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.fd = this->m_socket;
+		if (epoll_ctl(this->m_epoll, EPOLL_CTL_ADD, this->m_socket, &event) != 0) {
+			this->Disconnect();
+			return false;
+		}
+	}
+#endif
+
 	return true;
 }
 
@@ -181,11 +250,13 @@ bool CSimpleUDP::SendMessage(const char * ipAddress, unsigned short portnum, uns
 	struct sockaddr_in toAddr;
 	int toAddrLen = sizeof(toAddr);
 	int ret;
+
+	std::lock_guard<std::mutex> lock(this->m_sendMutex);
 	
 	// Check to see if we have created a connection 
 	if (!this->IsConnected()) {
-		// Not connected, try to reconnect
-		if (!this->ReConnect()) {
+		// Not connected, try to reconnect. In shared mode the receive thread does that.
+		if (this->m_sharedSocket || !this->ReConnect()) {
 			// we can not create a connection 
 			return false;
 		}
@@ -215,8 +286,15 @@ bool CSimpleUDP::SendMessage(const char * ipAddress, unsigned short portnum, uns
 	}
 
 	if (ret == SOCKET_ERROR) {
+#if defined(__GNUC__)
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			// Non-blocking socket and the send buffer is full. The socket is fine.
+			return false;
+		}
+#endif
 		// Issue with the socket, disconnect
-		this->Disconnect();
+		this->m_sendDisconnects++;
+		this->DisconnectAfterSendError();
 	}
     return false;
 }
@@ -238,6 +316,37 @@ int CSimpleUDP::GetMessage(unsigned char * buffer, unsigned short maxLength, cha
 
 	int ret;
 
+#if defined(__GNUC__)
+	if (this->m_eventMode) {
+		// Top up the ring if it is empty. This never blocks.
+		if (this->m_ringCount == 0 && this->DrainMessages() < 0) {
+			return -1;
+		}
+
+		while (this->m_ringCount > 0) {
+			CSimpleUDPPacket & packet = this->m_ring[this->m_ringHead];
+			this->m_ringHead = (this->m_ringHead + 1) % this->m_ring.size();
+			this->m_ringCount--;
+
+			// Truncated datagrams are stored with a length of zero. Skip them and any
+			// datagram that does not fit in the callers buffer.
+			if (packet.length == 0 || packet.length > maxLength) {
+				continue;
+			}
+
+			memcpy(buffer, packet.data, packet.length);
+			if (ipAddress != NULL) {
+				sprintf(ipAddress, "%s", inet_ntoa(packet.address.sin_addr));
+			}
+			if (port != NULL) {
+				*port = packet.address.sin_port;
+			}
+			return packet.length;
+		}
+		return 0;
+	}
+#endif
+
 	// If windows, do some other checks
 #ifdef _MSC_VER
 // Set up a time out 
@@ -285,6 +394,353 @@ int CSimpleUDP::GetMessage(unsigned char * buffer, unsigned short maxLength, cha
 	return ret;
 }
 
+bool CSimpleUDP::SetEventMode(bool enabled, unsigned short ringSize /* = 256 */) {
+#if defined(__GNUC__)
+	// The socket options are set up in Connect()
+	if (this->IsConnected()) {
+		return false;
+	}
+	if (enabled && ringSize == 0) {
+		return false;
+	}
+
+	this->m_eventMode = enabled;
+	this->m_ringHead = 0;
+	this->m_ringCount = 0;
+	if (!enabled) {
+		this->m_ring.clear();
+		this->m_ringHeaders.clear();
+		this->m_ringVectors.clear();
+		return true;
+	}
+
+	// Preallocate the ring and point one recvmmsg header at each slot. The vectors are
+	// never resized after this so the pointers stay valid.
+	this->m_ring.resize(ringSize);
+	this->m_ringHeaders.resize(ringSize);
+	this->m_ringVectors.resize(ringSize);
+	for (size_t offset = 0; offset < ringSize; offset++) {
+		this->m_ringVectors[offset].iov_base = this->m_ring[offset].data;
+		this->m_ringVectors[offset].iov_len = CSimpleUDPPacket::MAX_LENGTH;
+
+		memset(&this->m_ringHeaders[offset], 0, sizeof(struct mmsghdr));
+		this->m_ringHeaders[offset].msg_hdr.msg_name = &this->m_ring[offset].address;
+		this->m_ringHeaders[offset].msg_hdr.msg_iov = &this->m_ringVectors[offset];
+		this->m_ringHeaders[offset].msg_hdr.msg_iovlen = 1;
+	}
+	return true;
+#else
+	// Only supported on linux
+	return !enabled;
+#endif
+}
+
+bool CSimpleUDP::IsEventMode() {
+#if defined(__GNUC__)
+	return this->m_eventMode;
+#else
+	return false;
+#endif
+}
+
+int CSimpleUDP::DrainMessages() {
+#if defined(__GNUC__)
+	if (!this->m_eventMode) {
+		return 0;
+	}
+	if (!this->IsConnected()) {
+		if (!this->ReConnect()) {
+			return -1;
+		}
+	}
+
+	int total = 0;
+	const size_t ringSize = this->m_ring.size();
+	while (this->m_ringCount < ringSize) {
+		// recvmmsg needs a contiguous run of headers, stop at the end of the ring and wrap
+		// around on the next pass.
+		size_t tail = (this->m_ringHead + this->m_ringCount) % ringSize;
+		size_t available = ringSize - this->m_ringCount;
+		if (available > ringSize - tail) {
+			available = ringSize - tail;
+		}
+
+		for (size_t offset = tail; offset < tail + available; offset++) {
+			this->m_ringHeaders[offset].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			this->m_ringHeaders[offset].msg_hdr.msg_flags = 0;
+		}
+
+		int ret = recvmmsg(this->m_socket, &this->m_ringHeaders[tail], (unsigned int)available, MSG_DONTWAIT, NULL);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break; // Nothing left to read
+			}
+			// Issue with the socket, disconnect
+			this->Disconnect();
+			return -1;
+		}
+
+		for (int offset = 0; offset < ret; offset++) {
+			struct mmsghdr & header = this->m_ringHeaders[tail + offset];
+			this->m_ring[tail + offset].length = (header.msg_hdr.msg_flags & MSG_TRUNC) ? 0 : (unsigned short)header.msg_len;
+		}
+		this->m_ringCount += ret;
+		total += ret;
+
+		if ((size_t)ret < available) {
+			break; // The socket has been drained
+		}
+	}
+	return total;
+#else
+	return 0;
+#endif
+}
+
+bool CSimpleUDP::WaitForMessage(int timeoutMs) {
+#if defined(__GNUC__)
+	if (!this->m_eventMode) {
+		// Blocking mode, GetMessage() does the waiting
+		return true;
+	}
+	if (this->m_ringCount > 0) {
+		return true;
+	}
+	if (!this->IsConnected() || this->m_epoll < 0) {
+		return false;
+	}
+
+	struct epoll_event event;
+	return epoll_wait(this->m_epoll, &event, 1, timeoutMs) > 0;
+#else
+	return true;
+#endif
+}
+
+int CSimpleUDP::ReceiveMessages(CSimpleUDPPacket * packets, unsigned int maxCount) {
+#if defined(__GNUC__)
+	if (!this->m_eventMode || !this->IsConnected() || packets == NULL) {
+		return -1;
+	}
+
+	const unsigned int BATCH_SIZE = 64;
+	struct mmsghdr headers[BATCH_SIZE];
+	struct iovec vectors[BATCH_SIZE];
+
+	unsigned int total = 0;
+	while (total < maxCount) {
+		unsigned int count = maxCount - total < BATCH_SIZE ? maxCount - total : BATCH_SIZE;
+		memset(headers, 0, sizeof(struct mmsghdr) * count);
+		for (unsigned int offset = 0; offset < count; offset++) {
+			CSimpleUDPPacket & packet = packets[total + offset];
+			vectors[offset].iov_base = packet.data;
+			vectors[offset].iov_len = CSimpleUDPPacket::MAX_LENGTH;
+			headers[offset].msg_hdr.msg_iov = &vectors[offset];
+			headers[offset].msg_hdr.msg_iovlen = 1;
+			headers[offset].msg_hdr.msg_name = &packet.address;
+			headers[offset].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		}
+
+		int ret = recvmmsg(this->m_socket, headers, count, MSG_DONTWAIT, NULL);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break; // Nothing left to read
+			}
+			return total > 0 ? (int)total : -1;
+		}
+
+		for (int offset = 0; offset < ret; offset++) {
+			// A truncated datagram is returned with a length of zero
+			packets[total + offset].length = (headers[offset].msg_hdr.msg_flags & MSG_TRUNC) ? 0 : (unsigned short)headers[offset].msg_len;
+		}
+		total += ret;
+		if ((unsigned int)ret < count) {
+			break; // The socket has been drained
+		}
+	}
+	return (int)total;
+#else
+	return -1;
+#endif
+}
+
+void CSimpleUDP::SetSendQueueSize(unsigned short queueSize) {
+	// Anything still queued is sent before the queue is resized
+	this->FlushMessages();
+	this->m_sendQueue.clear();
+	this->m_sendQueue.resize(queueSize);
+	this->m_sendQueueCount = 0;
+}
+
+bool CSimpleUDP::QueueMessage(const unsigned char * ipAddress, unsigned short port, const unsigned char * buffer, unsigned short bufferLength) {
+	if (ipAddress == NULL || buffer == NULL || bufferLength == 0 || bufferLength > CSimpleUDPPacket::MAX_LENGTH) {
+		this->m_sendDropped++;
+		return false;
+	}
+	this->m_sendQueued++;
+
+	// Make room, drop the message if the queue is still full (socket buffer full)
+	if (this->m_sendQueueCount >= this->m_sendQueue.size() && this->m_sendQueue.size() > 0) {
+		this->FlushMessages();
+	}
+	if (this->m_sendQueueCount >= this->m_sendQueue.size()) {
+		if (this->m_sendQueue.size() == 0) {
+			// No queue, send straight away
+			char ipAddressText[32];
+			snprintf(ipAddressText, sizeof(ipAddressText), "%u.%u.%u.%u", ipAddress[0], ipAddress[1], ipAddress[2], ipAddress[3]);
+			if (this->SendMessage(ipAddressText, port, (unsigned char *)buffer, bufferLength)) {
+				this->m_sendSent++;
+				return true;
+			}
+		}
+		this->m_sendDropped++;
+		return false;
+	}
+
+	CSimpleUDPPacket & packet = this->m_sendQueue[this->m_sendQueueCount++];
+	memset(&packet.address, 0, sizeof(packet.address));
+	packet.address.sin_family = AF_INET;
+	packet.address.sin_port = htons(port);
+	memcpy(&packet.address.sin_addr, ipAddress, 4);
+	memcpy(packet.data, buffer, bufferLength);
+	packet.length = bufferLength;
+	return true;
+}
+
+int CSimpleUDP::FlushMessages() {
+	if (this->m_sendQueueCount == 0) {
+		return 0;
+	}
+
+	std::lock_guard<std::mutex> lock(this->m_sendMutex);
+	if (!this->IsConnected()) {
+		// In shared mode the receive thread reconnects, keep the queue until then
+		if (this->m_sharedSocket || !this->ReConnect()) {
+			return 0;
+		}
+	}
+
+	bool socketError = false;
+	size_t sent = this->SendPackets(&this->m_sendQueue[0], this->m_sendQueueCount, &socketError);
+	if (socketError) {
+		// Issue with the socket, drop everything that is left
+		this->m_sendDropped += this->m_sendQueueCount - sent;
+		this->m_sendQueueCount = 0;
+		return (int)sent;
+	}
+
+	// Keep whatever could not be sent yet at the front of the queue
+	size_t remaining = this->m_sendQueueCount - sent;
+	for (size_t offset = 0; offset < remaining; offset++) {
+		this->m_sendQueue[offset] = this->m_sendQueue[sent + offset];
+	}
+	this->m_sendQueueCount = remaining;
+	return (int)sent;
+}
+
+int CSimpleUDP::SendMessages(const CSimpleUDPPacket * packets, unsigned int count) {
+	if (packets == NULL || count == 0) {
+		return 0;
+	}
+
+	std::lock_guard<std::mutex> lock(this->m_sendMutex);
+	if (!this->IsConnected()) {
+		if (this->m_sharedSocket || !this->ReConnect()) {
+			return 0;
+		}
+	}
+
+	bool socketError = false;
+	size_t sent = this->SendPackets(packets, count, &socketError);
+	if (socketError) {
+		this->m_sendDropped += count - sent;
+		return (int)count;
+	}
+	return (int)sent;
+}
+
+size_t CSimpleUDP::SendPackets(const CSimpleUDPPacket * packets, size_t count, bool * socketError) {
+	size_t sent = 0;
+	*socketError = false;
+#if defined(__GNUC__)
+	bool blocked = false;
+	const size_t MAX_BATCH = 64;
+	struct mmsghdr headers[MAX_BATCH];
+	struct iovec vectors[MAX_BATCH];
+
+	while (sent < count && !blocked) {
+		size_t batch = count - sent;
+		if (batch > MAX_BATCH) {
+			batch = MAX_BATCH;
+		}
+		for (size_t offset = 0; offset < batch; offset++) {
+			const CSimpleUDPPacket & packet = packets[sent + offset];
+			vectors[offset].iov_base = (void *)packet.data;
+			vectors[offset].iov_len = packet.length;
+			memset(&headers[offset], 0, sizeof(struct mmsghdr));
+			headers[offset].msg_hdr.msg_name = (void *)&packet.address;
+			headers[offset].msg_hdr.msg_namelen = sizeof(packet.address);
+			headers[offset].msg_hdr.msg_iov = &vectors[offset];
+			headers[offset].msg_hdr.msg_iovlen = 1;
+		}
+
+		int ret = sendmmsg(this->m_socket, headers, (unsigned int)batch, MSG_DONTWAIT);
+		if (ret > 0) {
+			sent += ret;
+			this->m_sendSent += ret;
+			continue;
+		}
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			blocked = true; // Socket buffer is full, try again on the next flush
+			continue;
+		}
+		if (ret < 0 && (errno == EBADF || errno == ENOTSOCK)) {
+			// Issue with the socket, disconnect
+			this->m_sendDisconnects++;
+			this->DisconnectAfterSendError();
+			*socketError = true;
+			return sent;
+		}
+		// This message could not be sent (eg. unreachable destination), drop it and carry on
+		sent++;
+		this->m_sendDropped++;
+	}
+#else
+	for (; sent < count; sent++) {
+		const CSimpleUDPPacket & packet = packets[sent];
+		int ret = sendto(this->m_socket, (char*)packet.data, packet.length, 0, (struct sockaddr *)&packet.address, sizeof(packet.address));
+		if (ret == packet.length) {
+			this->m_sendSent++;
+		}
+		else {
+			this->m_sendDropped++;
+		}
+	}
+#endif
+	return sent;
+}
+
+void CSimpleUDP::GetSendCounters(unsigned long long * queued, unsigned long long * sent, unsigned long long * dropped) {
+	if (queued != NULL) {
+		*queued = this->m_sendQueued;
+	}
+	if (sent != NULL) {
+		*sent = this->m_sendSent;
+	}
+	if (dropped != NULL) {
+		*dropped = this->m_sendDropped;
+	}
+}
+
 
 int CSimpleUDP::GetBroadcastIPAddress(char * broadcastIPAddress, unsigned short maxLength) {
 #ifdef _MSC_VER
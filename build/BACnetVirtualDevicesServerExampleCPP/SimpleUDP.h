@@ -64,6 +64,15 @@ to create a unique and verifiable version.
 *     0.04  25 Sep 2017     ACF     Made class platform independent
 *     0.05  25 Sep 2017     ACF     Added header files needed for linux
 *									Cleaned up the code for use with linux
+*     0.06  17 Oct 2026     agent   Added event mode. Non-blocking socket serviced
+*									through epoll and drained with recvmmsg into a
+*									preallocated packet ring (linux only)
+*     0.07  17 Oct 2026     agent   Added send queue flushed in batches with sendmmsg
+*     0.08  17 Oct 2026     agent   Added ReceiveMessages for a dedicated receive thread
+*     0.09  17 Oct 2026     agent   Count send errors that disconnect the socket
+*     0.10  17 Oct 2026     agent   Added shared socket mode, only the receive thread
+*									opens and closes the socket
+*     0.11  17 Oct 2026     agent   Added SendMessages for senders on several threads
 *
 */
 
@@ -71,6 +80,9 @@ to create a unique and verifiable version.
 
 #include <string.h>
 #include <stdio.h>
+#include <vector>
+#include <atomic>
+#include <mutex>
 
 #ifdef _MSC_VER
 #include <winsock2.h>
@@ -91,6 +103,8 @@ to create a unique and verifiable version.
 #include <unistd.h>
 #include <resolv.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
 
 #define INT_TO_ADDR(_addr) \
 	(_addr & 0xFF), \
@@ -104,22 +118,63 @@ to create a unique and verifiable version.
 
 #endif
 
+// One slot of the event mode receive ring or the send queue. Large enough for
+// any BACnet/IP datagram (max APDU 1476 + BVLL + NPDU headers).
+struct CSimpleUDPPacket
+{
+	static const unsigned short MAX_LENGTH = 1536;
+
+	unsigned char data[MAX_LENGTH];
+	unsigned short length;
+	struct sockaddr_in address;	// Source of a received packet, destination of a queued packet
+};
 
 class CSimpleUDP
 {
 
 private:
 	unsigned short		m_port;			// Stores the port that the resource is connected to	
-	bool				m_connected;	// flag that gets set when the resource is successfully connected
+	std::atomic<bool>	m_connected;	// flag that gets set when the resource is successfully connected
+
+	// Shared socket mode. A receive thread reads the socket while other threads send.
+	// Only the receive thread opens and closes the socket, senders set m_reConnectNeeded
+	// instead. m_sendMutex keeps the socket open while a sender is using it.
+	bool				m_sharedSocket;
+	std::atomic<bool>	m_reConnectNeeded;
+	std::mutex			m_sendMutex;
 	
 #ifdef _MSC_VER
 	SOCKET				m_socket;
 #elif defined(__GNUC__)
 	int m_socket;
+
+	// Event mode. The socket is non-blocking and pending datagrams are drained
+	// in batches into m_ring, GetMessage() then pops from the ring.
+	bool m_eventMode;
+	int m_epoll;
+	std::vector<CSimpleUDPPacket> m_ring;
+	std::vector<struct mmsghdr> m_ringHeaders;
+	std::vector<struct iovec> m_ringVectors;
+	size_t m_ringHead;	// Index of the oldest queued packet
+	size_t m_ringCount;	// Number of queued packets
 #endif
 
+	// Send queue. Messages are copied in by QueueMessage() and sent by FlushMessages().
+	std::vector<CSimpleUDPPacket> m_sendQueue;
+	size_t m_sendQueueCount;
+	unsigned long long m_sendQueued;
+	unsigned long long m_sendSent;
+	unsigned long long m_sendDropped;
+	unsigned long long m_sendDisconnects;	// Send errors that closed the socket
+
 	//Function used to force a reconnect of the resource to the stored port
 	bool ReConnect();
+	void DisconnectAfterSendError();
+
+	// Sends packets in batches, m_sendMutex must be held. Stops early when the socket
+	// buffer is full. Returns the number of packets sent or dropped from the front of
+	// packets. socketError is set if the socket failed and was disconnected.
+	size_t SendPackets(const CSimpleUDPPacket * packets, size_t count, bool * socketError);
 
 public:
 
@@ -136,8 +191,52 @@ public:
 	int GetMessage(unsigned char * buffer, unsigned short maxLength, char * ipAddress, unsigned short * port = NULL);
 		 
 	int GetBroadcastIPAddress(char * broadcastIPAddress, unsigned short maxLength);
-	
 
+	// Event mode (linux only). Must be set before Connect().
+	// ringSize is the number of datagrams that can be queued between calls to GetMessage.
+	bool SetEventMode(bool enabled, unsigned short ringSize = 256);
+	bool IsEventMode();
+
+	// Reads every datagram waiting on the socket into the ring. Returns the number of
+	// datagrams read, or -1 on a socket error.
+	int DrainMessages();
+
+	// Blocks until a datagram is available or timeoutMs has passed. Returns straight away
+	// if the ring still holds datagrams. Returns true if there is something to read.
+	bool WaitForMessage(int timeoutMs);
+
+	// Reads up to maxCount datagrams that are waiting on the socket, without blocking.
+	// Event mode only, the ring is not used. Returns the number of datagrams read, or
+	// -1 on a socket error. Never disconnects or reconnects.
+	int ReceiveMessages(CSimpleUDPPacket * packets, unsigned int maxCount);
+
+	// Shared socket mode, for a receive thread that uses WaitForMessage() and ReceiveMessages()
+	// while another thread sends. In this mode sending never closes or reopens the socket, a
+	// send error only asks for a reconnect. The receive thread checks NeedsReConnect() and
+	// calls ReConnectShared(), it waits for any send in progress before closing the socket.
+	// Set it before the receive thread starts and clear it after the thread has stopped.
+	void SetSharedSocket(bool enabled) { m_sharedSocket = enabled; }
+	bool NeedsReConnect() { return m_reConnectNeeded.load() || !m_connected.load(); }
+	void RequestReConnect() { m_reConnectNeeded.store(true); }
+	bool ReConnectShared();
+
+	// Send queue. With a queue size of zero QueueMessage() sends straight away.
+	// ipAddress is the 4 byte IPv4 address in network order.
+	void SetSendQueueSize(unsigned short queueSize);
+	bool QueueMessage(const unsigned char * ipAddress, unsigned short port, const unsigned char * buffer, unsigned short bufferLength);
+
+	// Sends everything in the send queue, using sendmmsg on linux. Messages that can not
+	// be sent yet (socket buffer full) stay queued. Returns the number of messages sent.
+	int FlushMessages();
+	size_t GetSendQueueCount() { return m_sendQueueCount; }
+
+	// Sends packets straight away without the send queue, using sendmmsg on linux. Unlike
+	// the queue it can be called from several threads at once, eg. a worker per shard of
+	// the dispatcher. Returns the number of packets sent or dropped from the front of
+	// packets, the rest could not be sent yet (socket buffer full) and should be retried.
+	int SendMessages(const CSimpleUDPPacket * packets, unsigned int count);
+	void GetSendCounters(unsigned long long * queued, unsigned long long * sent, unsigned long long * dropped);
+	unsigned long long GetSendDisconnectCount() { return m_sendDisconnects; }
 
 };
 